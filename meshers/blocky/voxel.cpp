@@ -198,6 +198,7 @@ Ref<Resource> Voxel::duplicate(bool p_subresources) const {
 	d._collision_aabbs = _collision_aabbs;
 	d._random_tickable = _random_tickable;
 	d._empty = _empty;
+	d._collision_mask = _collision_mask;
 
 	if (p_subresources) {
 		if (d._custom_mesh.is_valid()) {
@@ -258,6 +259,8 @@ static void bake_cube_geometry(Voxel &config, Voxel::BakedData &baked_data,
 			uvs[i] = (config.get_cube_tile(side) + uv[i]) * s;
 		}
 
+		baked_data.cube_tiles[side] = config.get_cube_tile(side);
+
 		if (bake_tangents) {
 			std::vector<float> &tangents = baked_data.model.side_tangents[side];
 			for (unsigned int i = 0; i < 4; ++i) {
@@ -269,21 +272,16 @@ static void bake_cube_geometry(Voxel &config, Voxel::BakedData &baked_data,
 	}
 
 	baked_data.empty = false;
+	baked_data.cube = true;
 }
 
-static void bake_mesh_geometry(Voxel &config, Voxel::BakedData &baked_data,
-		bool bake_tangents) {
-	Ref<Mesh> mesh = config.get_custom_mesh();
-
-	if (mesh.is_null()) {
+static void bake_mesh_geometry(const Voxel &config, Voxel::BakedData &baked_data,
+		bool bake_tangents, const Array &arrays) {
+	if (arrays.is_empty()) {
 		baked_data.empty = true;
 		return;
 	}
 
-	Array arrays = mesh->surface_get_arrays(0);
-
-	ERR_FAIL_COND(arrays.size() == 0);
-
 	PackedInt32Array indices = arrays[Mesh::ARRAY_INDEX];
 	ERR_FAIL_COND_MSG(indices.size() % 3 != 0,
 			"Mesh is empty or does not contain triangles");
@@ -479,13 +477,45 @@ static void bake_mesh_geometry(Voxel &config, Voxel::BakedData &baked_data,
 	}
 }
 
-void Voxel::bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents) {
+static void bake_side_ao_weights(Voxel::BakedData::Model &model) {
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		const std::vector<Vector3> &positions = model.side_positions[side];
+		std::vector<uint32_t> &weights = model.side_ao_weights[side];
+		weights.resize(positions.size());
+
+		for (unsigned int i = 0; i < positions.size(); ++i) {
+			const Vector3 v = positions[i];
+			uint32_t packed = 0;
+			for (unsigned int j = 0; j < 4; ++j) {
+				const unsigned int corner = Cube::g_side_corners[side][j];
+				// Falloff from the corner. Vertices of cubes are exactly on corners,
+				// so they are only affected by their own.
+				const float k = 1.f - Cube::g_corner_position[corner].distance_squared_to(v);
+				const uint32_t w = k > 0.f ? static_cast<uint32_t>(Math::round(k * 255.f)) : 0;
+				packed |= MIN(w, 255u) << (j * 8);
+			}
+			weights[i] = packed;
+		}
+	}
+}
+
+Array Voxel::get_custom_mesh_arrays() const {
+	if (_geometry_type != GEOMETRY_CUSTOM_MESH || _custom_mesh.is_null()) {
+		return Array();
+	}
+	ERR_FAIL_COND_V(_custom_mesh->get_surface_count() == 0, Array());
+	return _custom_mesh->surface_get_arrays(0);
+}
+
+void Voxel::bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents,
+		const Array &custom_mesh_arrays) {
 	baked_data.clear();
 
 	// baked_data.contributes_to_ao is set by the side culling phase
 	baked_data.transparency_index = _transparency_index;
 	baked_data.material_id = _material_id;
 	baked_data.color = _color;
+	baked_data.collision_mask = _collision_mask;
 
 	switch (_geometry_type) {
 		case GEOMETRY_NONE:
@@ -497,7 +527,7 @@ void Voxel::bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents) {
 			break;
 
 		case GEOMETRY_CUSTOM_MESH:
-			bake_mesh_geometry(*this, baked_data, bake_tangents);
+			bake_mesh_geometry(*this, baked_data, bake_tangents, custom_mesh_arrays);
 			break;
 
 		default:
@@ -505,6 +535,18 @@ void Voxel::bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents) {
 			break;
 	}
 
+	bake_side_ao_weights(baked_data.model);
+
+	const BakedData::Model &model = baked_data.model;
+	baked_data.max_vertex_count = model.positions.size();
+	baked_data.max_index_count = model.indices.size();
+	baked_data.max_tangent_count = model.tangents.size();
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		baked_data.max_vertex_count += model.side_positions[side].size();
+		baked_data.max_index_count += model.side_indices[side].size();
+		baked_data.max_tangent_count += model.side_tangents[side].size();
+	}
+
 	_empty = baked_data.empty;
 }
 
@@ -71,6 +71,11 @@ public:
 			FixedArray<std::vector<int>, Cube::SIDE_COUNT> side_indices;
 			FixedArray<std::vector<float>, Cube::SIDE_COUNT> side_tangents;
 
+			// For each side vertex, how much each of the 4 corners of the side
+			// (in `Cube::g_side_corners` order) affects its ambient occlusion,
+			// as 4 packed bytes from 0 to 255.
+			FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> side_ao_weights;
+
 			FixedArray<uint32_t, Cube::SIDE_COUNT> side_pattern_indices;
 
 			void clear() {
@@ -85,6 +90,7 @@ public:
 					side_uvs[side].clear();
 					side_indices[side].clear();
 					side_tangents[side].clear();
+					side_ao_weights[side].clear();
 				}
 			}
 		};
@@ -95,10 +101,25 @@ public:
 		uint8_t transparency_index;
 		bool contributes_to_ao;
 		bool empty;
+		// Upper bounds of what the model adds to a mesh, if all its sides are
+		// visible. Used to reserve memory ahead of meshing.
+		uint32_t max_vertex_count = 0;
+		uint32_t max_index_count = 0;
+		uint32_t max_tangent_count = 0;
+		// Geometry is a plain cube, which allows its faces to be merged
+		bool cube = false;
+		// Atlas tile of each cube side, if `cube` is true
+		FixedArray<Vector2, Cube::SIDE_COUNT> cube_tiles;
+		// Physics layers the voxel is part of
+		uint32_t collision_mask = 0;
 
 		inline void clear() {
 			model.clear();
 			empty = true;
+			cube = false;
+			max_vertex_count = 0;
+			max_index_count = 0;
+			max_tangent_count = 0;
 		}
 	};
 
@@ -168,7 +189,17 @@ public:
 	//------------------------------------------
 	// Properties for internal usage only
 
-	void bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents);
+	// Arrays of the custom mesh, as expected by `bake()`. Fetching them may
+	// involve the RenderingServer, so it should be done on the calling thread
+	// before baking in parallel.
+	Array get_custom_mesh_arrays() const;
+
+	// Does not access resources, so voxels can be baked from multiple threads.
+	void bake(BakedData &baked_data, int p_atlas_size, bool bake_tangents,
+			const Array &custom_mesh_arrays);
+
+	// Used when baked data was obtained without calling `bake()`
+	void set_empty_from_baked_data(bool empty) { _empty = empty; }
 
 	const std::vector<AABB> &get_collision_aabbs() const {
 		return _collision_aabbs;
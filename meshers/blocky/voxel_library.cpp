@@ -29,11 +29,15 @@
 /**************************************************************************/
 
 #include "voxel_library.h"
+#include "../../util/funcs.h"
 #include "../../util/macros.h"
+#include "../../util/profiling.h"
 #include "core/math/geometry_2d.h"
-#include <bitset>
+#include <core/io/file_access.h>
+#include <core/object/worker_thread_pool.h>
 
-VoxelLibrary::VoxelLibrary() {}
+VoxelLibrary::VoxelLibrary() :
+		_baked_data(std::make_shared<const BakedData>()) {}
 
 VoxelLibrary::~VoxelLibrary() {}
 
@@ -184,199 +188,169 @@ static void rasterize_triangle_barycentric(Vector2 a, Vector2 b, Vector2 c,
 	}
 }
 
-void VoxelLibrary::bake() {
-	RWLockWrite lock(_baked_data_rw_lock);
+namespace {
+struct BakeVoxelsTask {
+	const std::vector<Ref<Voxel>> *voxel_types;
+	const std::vector<Array> *custom_mesh_arrays;
+	std::vector<Voxel::BakedData> *models;
+	int atlas_size;
+	bool bake_tangents;
+
+	static void run(void *userdata, uint32_t i) {
+		BakeVoxelsTask &task = *static_cast<BakeVoxelsTask *>(userdata);
+		const Ref<Voxel> &voxel = (*task.voxel_types)[i];
+		if (voxel.is_valid()) {
+			voxel->bake((*task.models)[i], task.atlas_size, task.bake_tangents,
+					(*task.custom_mesh_arrays)[i]);
+		} else {
+			(*task.models)[i].clear();
+		}
+	}
+};
+} // namespace
 
+void VoxelLibrary::bake() {
 	const uint64_t time_before = OS::get_singleton()->get_ticks_usec();
 
-	// This is the only place we modify the data.
-
-	_baked_data.models.resize(_voxel_types.size());
+	// Mesh resources can't be accessed from worker threads, fetch them first
+	std::vector<Array> custom_mesh_arrays;
+	custom_mesh_arrays.resize(_voxel_types.size());
 	for (size_t i = 0; i < _voxel_types.size(); ++i) {
-		Ref<Voxel> config = _voxel_types[i];
-		if (config.is_valid()) {
-			_voxel_types[i]->bake(_baked_data.models[i], _atlas_size, _bake_tangents);
-		} else {
-			_baked_data.models[i].clear();
+		const Ref<Voxel> &voxel = _voxel_types[i];
+		if (voxel.is_valid()) {
+			custom_mesh_arrays[i] = voxel->get_custom_mesh_arrays();
 		}
 	}
 
-	generate_side_culling_matrix();
+	const uint64_t hash = _bake_cache_path.is_empty()
+			? 0
+			: compute_bake_hash(custom_mesh_arrays);
 
-	uint64_t time_spent = OS::get_singleton()->get_ticks_usec() - time_before;
-	PRINT_VERBOSE(
-			String("Took {0} us to bake VoxelLibrary").format(varray(time_spent)));
-}
+	MutexLock lock(_bake_mutex);
 
-void VoxelLibrary::generate_side_culling_matrix() {
-	// When two blocky voxels are next to each other, they share a side.
-	// Geometry of either side can be culled away if covered by the other,
-	// but it's very expensive to do a full polygon check when we build the mesh.
-	// So instead, we compute which sides occlude which for every voxel type,
-	// and generate culling masks ahead of time, using an approximation.
-	// It may have a limitation of the number of different side types,
-	// so it's a tradeoff to take when designing the models.
-
-	static const unsigned int RASTER_SIZE = 32;
+	// Meshers may still be using the previous data, so a new one is built
+	std::shared_ptr<BakedData> baked_data = std::make_shared<BakedData>();
+	baked_data->atlas_size = _atlas_size;
+	baked_data->version = get_baked_data()->version + 1;
 
-	//	struct TypeAndSide {
-	//		uint16_t type;
-	//		uint16_t side;
-	//	};
-
-	struct Pattern {
-		std::bitset<RASTER_SIZE * RASTER_SIZE> bitmap;
-		// std::vector<TypeAndSide> occurrences;
-	};
+	if (!_bake_cache_path.is_empty() &&
+			load_baked_data(_bake_cache_path, hash, *baked_data)) {
+		std::atomic_store(&_baked_data, std::shared_ptr<const BakedData>(baked_data));
+		_needs_baking = false;
+		PRINT_VERBOSE(String("Loaded baked VoxelLibrary from {0}")
+							  .format(varray(_bake_cache_path)));
+		return;
+	}
 
-	std::vector<Pattern> patterns;
-	uint32_t full_side_pattern_index = NULL_INDEX;
+	baked_data->models.resize(_voxel_types.size());
+
+	BakeVoxelsTask task;
+	task.voxel_types = &_voxel_types;
+	task.custom_mesh_arrays = &custom_mesh_arrays;
+	task.models = &baked_data->models;
+	task.atlas_size = _atlas_size;
+	task.bake_tangents = _bake_tangents;
+
+	// Most libraries only have a few cheap cubes, not worth scheduling
+	static const unsigned int MIN_VOXELS_FOR_THREADS = 64;
+	WorkerThreadPool *thread_pool = WorkerThreadPool::get_singleton();
+
+	if (thread_pool != nullptr && _voxel_types.size() >= MIN_VOXELS_FOR_THREADS) {
+		const WorkerThreadPool::GroupID group_id = thread_pool->add_native_group_task(
+				&BakeVoxelsTask::run, &task, _voxel_types.size(), -1, true,
+				"Bake VoxelLibrary");
+		thread_pool->wait_for_group_task_completion(group_id);
+	} else {
+		for (uint32_t i = 0; i < _voxel_types.size(); ++i) {
+			BakeVoxelsTask::run(&task, i);
+		}
+	}
 
-	CRASH_COND(_voxel_types.size() != _baked_data.models.size());
+	generate_side_culling_matrix(*baked_data);
 
-	// Gather patterns
-	for (uint16_t type_id = 0; type_id < _voxel_types.size(); ++type_id) {
-		if (_voxel_types[type_id].is_null()) {
-			continue;
-		}
+	std::atomic_store(&_baked_data, std::shared_ptr<const BakedData>(baked_data));
+	_needs_baking = false;
 
-		Voxel::BakedData &model_data = _baked_data.models[type_id];
-		model_data.contributes_to_ao = true;
-
-		for (uint16_t side = 0; side < Cube::SIDE_COUNT; ++side) {
-			const std::vector<Vector3> &positions =
-					model_data.model.side_positions[side];
-			const std::vector<int> &indices = model_data.model.side_indices[side];
-			ERR_FAIL_COND(indices.size() % 3 != 0);
-
-			std::bitset<RASTER_SIZE * RASTER_SIZE> bitmap;
-
-			for (unsigned int j = 0; j < indices.size(); j += 3) {
-				const Vector3 va = positions[indices[j]];
-				const Vector3 vb = positions[indices[j + 1]];
-				const Vector3 vc = positions[indices[j + 2]];
-
-				// Convert 3D vertices into 2D
-				Vector2 a, b, c;
-				switch (side) {
-					case Cube::SIDE_NEGATIVE_X:
-					case Cube::SIDE_POSITIVE_X:
-						a = Vector2(va.y, va.z);
-						b = Vector2(vb.y, vb.z);
-						c = Vector2(vc.y, vc.z);
-						break;
-
-					case Cube::SIDE_NEGATIVE_Y:
-					case Cube::SIDE_POSITIVE_Y:
-						a = Vector2(va.x, va.z);
-						b = Vector2(vb.x, vb.z);
-						c = Vector2(vc.x, vc.z);
-						break;
-
-					case Cube::SIDE_NEGATIVE_Z:
-					case Cube::SIDE_POSITIVE_Z:
-						a = Vector2(va.x, va.y);
-						b = Vector2(vb.x, vb.y);
-						c = Vector2(vc.x, vc.y);
-						break;
-
-					default:
-						CRASH_NOW();
-				}
-
-				a *= RASTER_SIZE;
-				b *= RASTER_SIZE;
-				c *= RASTER_SIZE;
-
-				// Rasterize pattern
-				rasterize_triangle_barycentric(
-						a, b, c, [&bitmap](unsigned int x, unsigned int y) {
-							if (x >= RASTER_SIZE || y >= RASTER_SIZE) {
-								return;
-							}
-							const unsigned int i = x + y * RASTER_SIZE;
-							bitmap.set(i);
-						});
-			}
+	if (!_bake_cache_path.is_empty()) {
+		save_baked_data(_bake_cache_path, hash, *baked_data);
+	}
 
-			// Find if the same pattern already exists
-			uint32_t pattern_index = NULL_INDEX;
-			for (unsigned int i = 0; i < patterns.size(); ++i) {
-				if (patterns[i].bitmap == bitmap) {
-					pattern_index = i;
-					break;
-				}
-			}
+	uint64_t time_spent = OS::get_singleton()->get_ticks_usec() - time_before;
+	PRINT_VERBOSE(
+			String("Took {0} us to bake VoxelLibrary").format(varray(time_spent)));
+}
 
-			// Get or create pattern
-			Pattern *pattern = nullptr;
-			if (pattern_index != NULL_INDEX) {
-				pattern = &patterns[pattern_index];
-			} else {
-				pattern_index = patterns.size();
-				patterns.push_back(Pattern());
-				pattern = &patterns.back();
-				pattern->bitmap = bitmap;
-			}
+void VoxelLibrary::bake_voxel(int id) {
+	ERR_FAIL_INDEX(id, static_cast<int>(_voxel_types.size()));
 
-			CRASH_COND(pattern == nullptr);
+	std::shared_ptr<const BakedData> current = get_baked_data();
 
-			if (full_side_pattern_index == NULL_INDEX && bitmap.all()) {
-				full_side_pattern_index = pattern_index;
-			}
-			if (pattern_index != full_side_pattern_index) {
-				// Non-cube voxels don't contribute to AO at the moment
-				model_data.contributes_to_ao = false;
-			}
+	if (_needs_baking || current->models.size() != _voxel_types.size()) {
+		bake();
+		return;
+	}
 
-			// pattern->occurrences.push_back(TypeAndSide{ type_id, side });
-			model_data.model.side_pattern_indices[side] = pattern_index;
+	const Ref<Voxel> &voxel = _voxel_types[id];
+	const Array custom_mesh_arrays =
+			voxel.is_valid() ? voxel->get_custom_mesh_arrays() : Array();
 
-		} // side
-	} // type
+	MutexLock lock(_bake_mutex);
 
-	// Find which pattern occludes which
+	// Copy, because meshers may still be using the current data
+	std::shared_ptr<BakedData> baked_data = std::make_shared<BakedData>(*get_baked_data());
+	++baked_data->version;
 
-	_baked_data.side_pattern_count = patterns.size();
-	_baked_data.side_pattern_culling.resize(_baked_data.side_pattern_count *
-			_baked_data.side_pattern_count);
-	_baked_data.side_pattern_culling.fill(false);
+	Voxel::BakedData &model_data = baked_data->models[id];
+	if (voxel.is_valid()) {
+		voxel->bake(model_data, _atlas_size, _bake_tangents, custom_mesh_arrays);
+	} else {
+		model_data.clear();
+	}
 
-	for (unsigned int ai = 0; ai < patterns.size(); ++ai) {
-		const Pattern &pattern_a = patterns[ai];
+	bake_side_patterns(*baked_data, id);
+	// Only patterns the voxel introduced get compared with the others
+	update_side_pattern_culling(*baked_data);
+	// Patterns the voxel used before may no longer be used by any voxel
+	compact_side_patterns(*baked_data);
+	// Other voxels keep their flags: if the full pattern did not exist before,
+	// none of them could have had occluding sides.
+	update_voxel_flags(*baked_data, id);
 
-		if (pattern_a.bitmap.any()) {
-			// Pattern always occludes itself
-			_baked_data.side_pattern_culling.set(ai +
-					ai * _baked_data.side_pattern_count);
-		}
+	std::atomic_store(&_baked_data, std::shared_ptr<const BakedData>(baked_data));
+}
 
-		for (unsigned int bi = ai + 1; bi < patterns.size(); ++bi) {
-			const Pattern &pattern_b = patterns[bi];
+void VoxelLibrary::set_bake_cache_path(String path) {
+	_bake_cache_path = path;
+}
 
-			std::bitset<RASTER_SIZE *RASTER_SIZE> res =
-					pattern_a.bitmap & pattern_b.bitmap;
+void VoxelLibrary::generate_side_culling_matrix(BakedData &baked_data) {
+	// When two blocky voxels are next to each other, they share a side.
+	// Geometry of either side can be culled away if covered by the other,
+	// but it's very expensive to do a full polygon check when we build the mesh.
+	// So instead, we compute which sides occlude which for every voxel type,
+	// and generate culling masks ahead of time, using an approximation.
+	// It may have a limitation of the number of different side types,
+	// so it's a tradeoff to take when designing the models.
 
-			if (!res.any()) {
-				// Patterns have nothing in common, there is no occlusion
-				continue;
-			}
+	CRASH_COND(_voxel_types.size() != baked_data.models.size());
 
-			bool b_occludes_a = (res == pattern_a.bitmap);
-			bool a_occludes_b = (res == pattern_b.bitmap);
+	_side_patterns.clear();
+	baked_data.side_pattern_count = 0;
+	baked_data.full_side_pattern_index = NULL_INDEX;
 
-			// Same patterns? That can't be, they must be unique
-			CRASH_COND(b_occludes_a && a_occludes_b);
+	// Gather patterns
+	for (unsigned int type_id = 0; type_id < _voxel_types.size(); ++type_id) {
+		bake_side_patterns(baked_data, type_id);
+	}
 
-			if (a_occludes_b) {
-				_baked_data.side_pattern_culling.set(
-						ai + bi * _baked_data.side_pattern_count);
+	// Find which pattern occludes which
+	update_side_pattern_culling(baked_data);
 
-			} else if (b_occludes_a) {
-				_baked_data.side_pattern_culling.set(
-						bi + ai * _baked_data.side_pattern_count);
-			}
-		}
+	// Summarize models into flags
+	baked_data.voxel_flags.resize(baked_data.models.size());
+	baked_data.hidden_when_enclosed.resize(baked_data.models.size());
+	for (unsigned int type_id = 0; type_id < baked_data.models.size(); ++type_id) {
+		update_voxel_flags(baked_data, type_id);
 	}
 
 	// DEBUG
@@ -422,6 +396,496 @@ void VoxelLibrary::generate_side_culling_matrix() {
 	print_line("");*/
 }
 
+void VoxelLibrary::bake_side_patterns(BakedData &baked_data, unsigned int type_id) {
+	if (_voxel_types[type_id].is_null()) {
+		return;
+	}
+
+	static const unsigned int RASTER_SIZE = SIDE_PATTERN_RASTER_SIZE;
+
+	Voxel::BakedData &model_data = baked_data.models[type_id];
+
+	for (uint16_t side = 0; side < Cube::SIDE_COUNT; ++side) {
+		const std::vector<Vector3> &positions =
+				model_data.model.side_positions[side];
+		const std::vector<int> &indices = model_data.model.side_indices[side];
+		ERR_FAIL_COND(indices.size() % 3 != 0);
+
+		SidePatternBitmap bitmap;
+
+		for (unsigned int j = 0; j < indices.size(); j += 3) {
+			const Vector3 va = positions[indices[j]];
+			const Vector3 vb = positions[indices[j + 1]];
+			const Vector3 vc = positions[indices[j + 2]];
+
+			// Convert 3D vertices into 2D
+			Vector2 a, b, c;
+			switch (side) {
+				case Cube::SIDE_NEGATIVE_X:
+				case Cube::SIDE_POSITIVE_X:
+					a = Vector2(va.y, va.z);
+					b = Vector2(vb.y, vb.z);
+					c = Vector2(vc.y, vc.z);
+					break;
+
+				case Cube::SIDE_NEGATIVE_Y:
+				case Cube::SIDE_POSITIVE_Y:
+					a = Vector2(va.x, va.z);
+					b = Vector2(vb.x, vb.z);
+					c = Vector2(vc.x, vc.z);
+					break;
+
+				case Cube::SIDE_NEGATIVE_Z:
+				case Cube::SIDE_POSITIVE_Z:
+					a = Vector2(va.x, va.y);
+					b = Vector2(vb.x, vb.y);
+					c = Vector2(vc.x, vc.y);
+					break;
+
+				default:
+					CRASH_NOW();
+			}
+
+			a *= RASTER_SIZE;
+			b *= RASTER_SIZE;
+			c *= RASTER_SIZE;
+
+			// Rasterize pattern
+			rasterize_triangle_barycentric(
+					a, b, c, [&bitmap](unsigned int x, unsigned int y) {
+						if (x >= RASTER_SIZE || y >= RASTER_SIZE) {
+							return;
+						}
+						const unsigned int i = x + y * RASTER_SIZE;
+						bitmap.set(i);
+					});
+		}
+
+		model_data.model.side_pattern_indices[side] =
+				get_or_create_side_pattern(baked_data, bitmap);
+	}
+}
+
+uint32_t VoxelLibrary::get_or_create_side_pattern(BakedData &baked_data,
+		const SidePatternBitmap &bitmap) {
+	// Find if the same pattern already exists
+	for (unsigned int i = 0; i < _side_patterns.size(); ++i) {
+		if (_side_patterns[i] == bitmap) {
+			return i;
+		}
+	}
+
+	const uint32_t pattern_index = _side_patterns.size();
+	_side_patterns.push_back(bitmap);
+
+	if (baked_data.full_side_pattern_index == NULL_INDEX && bitmap.all()) {
+		baked_data.full_side_pattern_index = pattern_index;
+	}
+
+	return pattern_index;
+}
+
+void VoxelLibrary::update_side_pattern_culling(BakedData &baked_data) {
+	// Patterns below that count were already compared with each other
+	const unsigned int old_count = baked_data.side_pattern_count;
+	const unsigned int count = _side_patterns.size();
+
+	if (old_count == count && baked_data.side_pattern_culling.size() == count * count) {
+		return;
+	}
+
+	DynamicBitset culling;
+	culling.resize(count * count);
+	culling.fill(false);
+
+	// Keep existing results. Their position changes because rows got longer.
+	for (unsigned int bi = 0; bi < old_count; ++bi) {
+		for (unsigned int ai = 0; ai < old_count; ++ai) {
+			if (baked_data.side_pattern_culling.get(ai + bi * old_count)) {
+				culling.set(ai + bi * count);
+			}
+		}
+	}
+
+	// Compare new patterns with all others
+	for (unsigned int bi = old_count; bi < count; ++bi) {
+		const SidePatternBitmap &pattern_b = _side_patterns[bi];
+
+		if (pattern_b.any()) {
+			// Pattern always occludes itself
+			culling.set(bi + bi * count);
+		}
+
+		for (unsigned int ai = 0; ai < bi; ++ai) {
+			const SidePatternBitmap &pattern_a = _side_patterns[ai];
+
+			const SidePatternBitmap res = pattern_a & pattern_b;
+
+			if (!res.any()) {
+				// Patterns have nothing in common, there is no occlusion
+				continue;
+			}
+
+			bool b_occludes_a = (res == pattern_a);
+			bool a_occludes_b = (res == pattern_b);
+
+			// Same patterns? That can't be, they must be unique
+			CRASH_COND(b_occludes_a && a_occludes_b);
+
+			if (a_occludes_b) {
+				culling.set(ai + bi * count);
+
+			} else if (b_occludes_a) {
+				culling.set(bi + ai * count);
+			}
+		}
+	}
+
+	baked_data.side_pattern_culling = std::move(culling);
+	baked_data.side_pattern_count = count;
+}
+
+void VoxelLibrary::compact_side_patterns(BakedData &baked_data) {
+	const unsigned int count = _side_patterns.size();
+	CRASH_COND(baked_data.side_pattern_count != count);
+
+	// Mark used patterns, then give them their new index
+	std::vector<uint32_t> remap;
+	remap.resize(count, NULL_INDEX);
+	for (unsigned int type_id = 0; type_id < baked_data.models.size(); ++type_id) {
+		if (_voxel_types[type_id].is_null()) {
+			continue;
+		}
+		const Voxel::BakedData &model_data = baked_data.models[type_id];
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			remap[model_data.model.side_pattern_indices[side]] = 0;
+		}
+	}
+	unsigned int used_count = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		if (remap[i] != NULL_INDEX) {
+			remap[i] = used_count;
+			++used_count;
+		}
+	}
+
+	if (used_count == count) {
+		return;
+	}
+
+	// Patterns only move towards the start, so this can be done in place
+	for (unsigned int i = 0; i < count; ++i) {
+		if (remap[i] != NULL_INDEX) {
+			_side_patterns[remap[i]] = _side_patterns[i];
+		}
+	}
+	_side_patterns.resize(used_count);
+
+	// Occlusion between remaining patterns doesn't change
+	DynamicBitset culling;
+	culling.resize(used_count * used_count);
+	culling.fill(false);
+	for (unsigned int bi = 0; bi < count; ++bi) {
+		if (remap[bi] == NULL_INDEX) {
+			continue;
+		}
+		for (unsigned int ai = 0; ai < count; ++ai) {
+			if (remap[ai] != NULL_INDEX &&
+					baked_data.side_pattern_culling.get(ai + bi * count)) {
+				culling.set(remap[ai] + remap[bi] * used_count);
+			}
+		}
+	}
+	baked_data.side_pattern_culling = std::move(culling);
+	baked_data.side_pattern_count = used_count;
+
+	for (unsigned int type_id = 0; type_id < baked_data.models.size(); ++type_id) {
+		Voxel::BakedData &model_data = baked_data.models[type_id];
+		const bool valid = _voxel_types[type_id].is_valid();
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			uint32_t &pattern_index = model_data.model.side_pattern_indices[side];
+			// Empty voxels don't use patterns, but must not keep stale indices
+			pattern_index = valid ? remap[pattern_index] : NULL_INDEX;
+		}
+	}
+
+	if (baked_data.full_side_pattern_index != NULL_INDEX) {
+		baked_data.full_side_pattern_index = remap[baked_data.full_side_pattern_index];
+	}
+}
+
+void VoxelLibrary::update_voxel_flags(BakedData &baked_data, unsigned int type_id) {
+	Voxel::BakedData &model_data = baked_data.models[type_id];
+	const bool valid = _voxel_types[type_id].is_valid();
+	const uint32_t full_side_pattern_index = baked_data.full_side_pattern_index;
+
+	// Non-cube voxels don't contribute to AO at the moment
+	model_data.contributes_to_ao = valid;
+	if (valid) {
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			if (model_data.model.side_pattern_indices[side] != full_side_pattern_index) {
+				model_data.contributes_to_ao = false;
+				break;
+			}
+		}
+	}
+
+	uint8_t flags = 0;
+
+	if (!valid || model_data.empty) {
+		flags |= BakedData::FLAG_EMPTY;
+
+	} else if (model_data.transparency_index == 0) {
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			if (model_data.model.side_pattern_indices[side] == full_side_pattern_index) {
+				flags |= (1 << side);
+			}
+		}
+	}
+
+	if (model_data.contributes_to_ao) {
+		flags |= BakedData::FLAG_CONTRIBUTES_TO_AO;
+	}
+
+	baked_data.voxel_flags[type_id] = flags;
+	baked_data.hidden_when_enclosed[type_id] =
+			(flags & BakedData::FLAG_OCCLUDING_SIDES_MASK) == BakedData::FLAG_OCCLUDING_SIDES_MASK &&
+			model_data.model.positions.empty();
+}
+
+// Bump when the layout or the meaning of the baked data changes
+static const uint32_t BAKE_CACHE_VERSION = 3;
+static const char *BAKE_CACHE_MAGIC = "VXLB";
+
+uint64_t VoxelLibrary::compute_bake_hash(
+		const std::vector<Array> &custom_mesh_arrays) const {
+	uint64_t h = hash_value_64(BAKE_CACHE_VERSION);
+	h = hash_value_64(_atlas_size, h);
+	h = hash_value_64(_bake_tangents, h);
+	h = hash_value_64(static_cast<uint32_t>(_voxel_types.size()), h);
+
+	for (size_t i = 0; i < _voxel_types.size(); ++i) {
+		const Ref<Voxel> &voxel_ref = _voxel_types[i];
+		if (voxel_ref.is_null()) {
+			h = hash_value_64(uint8_t(0xff), h);
+			continue;
+		}
+		const Voxel &voxel = **voxel_ref;
+		h = hash_value_64(static_cast<int>(voxel.get_geometry_type()), h);
+		h = hash_value_64(voxel.get_material_id(), h);
+		h = hash_value_64(voxel.get_transparency_index(), h);
+		h = hash_value_64(voxel.get_color(), h);
+		h = hash_value_64(voxel.get_collision_mask(), h);
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			h = hash_value_64(voxel.get_cube_tile(side), h);
+		}
+
+		const Array &arrays = custom_mesh_arrays[i];
+		if (arrays.is_empty()) {
+			continue;
+		}
+		const PackedVector3Array positions = arrays[Mesh::ARRAY_VERTEX];
+		const PackedVector3Array normals = arrays[Mesh::ARRAY_NORMAL];
+		const PackedVector2Array uvs = arrays[Mesh::ARRAY_TEX_UV];
+		const PackedFloat32Array tangents = arrays[Mesh::ARRAY_TANGENT];
+		const PackedInt32Array indices = arrays[Mesh::ARRAY_INDEX];
+		h = hash_buffer_64(positions.ptr(), positions.size() * sizeof(Vector3), h);
+		h = hash_buffer_64(normals.ptr(), normals.size() * sizeof(Vector3), h);
+		h = hash_buffer_64(uvs.ptr(), uvs.size() * sizeof(Vector2), h);
+		h = hash_buffer_64(tangents.ptr(), tangents.size() * sizeof(float), h);
+		h = hash_buffer_64(indices.ptr(), indices.size() * sizeof(int32_t), h);
+	}
+
+	return h;
+}
+
+// The cache is only meant to be read by the machine which wrote it, so plain
+// data is stored as it is in memory.
+
+template <typename T>
+static void store_vector(FileAccess &f, const std::vector<T> &v) {
+	f.store_32(v.size());
+	if (v.size() > 0) {
+		f.store_buffer(reinterpret_cast<const uint8_t *>(v.data()), v.size() * sizeof(T));
+	}
+}
+
+template <typename T>
+static bool get_vector(FileAccess &f, std::vector<T> &v) {
+	const uint32_t size = f.get_32();
+	const uint64_t len = uint64_t(size) * sizeof(T);
+	ERR_FAIL_COND_V(len > f.get_length() - f.get_position(), false);
+	v.resize(size);
+	if (size == 0) {
+		return true;
+	}
+	return f.get_buffer(reinterpret_cast<uint8_t *>(v.data()), len) == len;
+}
+
+template <typename T>
+static void store_pod(FileAccess &f, const T &v) {
+	f.store_buffer(reinterpret_cast<const uint8_t *>(&v), sizeof(T));
+}
+
+template <typename T>
+static bool get_pod(FileAccess &f, T &v) {
+	return f.get_buffer(reinterpret_cast<uint8_t *>(&v), sizeof(T)) == sizeof(T);
+}
+
+bool VoxelLibrary::load_baked_data(String fpath, uint64_t hash, BakedData &baked_data) {
+	VOXEL_PROFILE_SCOPE();
+
+	if (!FileAccess::exists(fpath)) {
+		return false;
+	}
+	Ref<FileAccess> f_ref = FileAccess::open(fpath, FileAccess::READ);
+	ERR_FAIL_COND_V(f_ref.is_null(), false);
+	FileAccess &f = **f_ref;
+
+	char magic[5] = { 0 };
+	f.get_buffer(reinterpret_cast<uint8_t *>(magic), 4);
+	if (strcmp(magic, BAKE_CACHE_MAGIC) != 0 || f.get_32() != BAKE_CACHE_VERSION ||
+			f.get_8() != sizeof(real_t) || f.get_64() != hash) {
+		// Outdated, it will be overwritten
+		return false;
+	}
+
+	std::vector<uint64_t> pattern_words;
+	if (!get_vector(f, pattern_words)) {
+		return false;
+	}
+	static const unsigned int WORDS_PER_PATTERN = SidePatternBitmap().size() / 64;
+	ERR_FAIL_COND_V(pattern_words.size() % WORDS_PER_PATTERN != 0, false);
+
+	std::vector<Voxel::BakedData> models;
+	models.resize(f.get_32());
+	ERR_FAIL_COND_V(models.size() != _voxel_types.size(), false);
+
+	for (size_t i = 0; i < models.size(); ++i) {
+		Voxel::BakedData &m = models[i];
+		m.material_id = f.get_32();
+		m.transparency_index = f.get_8();
+		m.empty = f.get_8() != 0;
+		m.cube = f.get_8() != 0;
+		m.max_vertex_count = f.get_32();
+		m.max_index_count = f.get_32();
+		m.max_tangent_count = f.get_32();
+		m.collision_mask = f.get_32();
+		bool ok = get_pod(f, m.color) && get_pod(f, m.cube_tiles);
+
+		Voxel::BakedData::Model &model = m.model;
+		ok = ok && get_pod(f, model.side_pattern_indices);
+		ok = ok && get_vector(f, model.positions) && get_vector(f, model.normals) &&
+				get_vector(f, model.uvs) && get_vector(f, model.indices) &&
+				get_vector(f, model.tangents);
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT && ok; ++side) {
+			ok = get_vector(f, model.side_positions[side]) &&
+					get_vector(f, model.side_uvs[side]) &&
+					get_vector(f, model.side_indices[side]) &&
+					get_vector(f, model.side_tangents[side]) &&
+					get_vector(f, model.side_ao_weights[side]);
+		}
+		ERR_FAIL_COND_V_MSG(!ok, false, "Baked VoxelLibrary cache is truncated");
+	}
+
+	// Unpack patterns
+	_side_patterns.resize(pattern_words.size() / WORDS_PER_PATTERN);
+	for (size_t i = 0; i < _side_patterns.size(); ++i) {
+		SidePatternBitmap &bitmap = _side_patterns[i];
+		bitmap.reset();
+		for (unsigned int j = 0; j < bitmap.size(); ++j) {
+			if (pattern_words[i * WORDS_PER_PATTERN + j / 64] & (uint64_t(1) << (j % 64))) {
+				bitmap.set(j);
+			}
+		}
+	}
+
+	baked_data.models = std::move(models);
+	baked_data.full_side_pattern_index = NULL_INDEX;
+	for (size_t i = 0; i < _side_patterns.size(); ++i) {
+		if (_side_patterns[i].all()) {
+			baked_data.full_side_pattern_index = i;
+			break;
+		}
+	}
+
+	// Comparing patterns is cheap compared to baking models
+	baked_data.side_pattern_count = 0;
+	update_side_pattern_culling(baked_data);
+
+	baked_data.voxel_flags.resize(baked_data.models.size());
+	baked_data.hidden_when_enclosed.resize(baked_data.models.size());
+	for (unsigned int type_id = 0; type_id < baked_data.models.size(); ++type_id) {
+		update_voxel_flags(baked_data, type_id);
+		if (_voxel_types[type_id].is_valid()) {
+			_voxel_types[type_id]->set_empty_from_baked_data(baked_data.models[type_id].empty);
+		}
+	}
+
+	return true;
+}
+
+void VoxelLibrary::save_baked_data(String fpath, uint64_t hash,
+		const BakedData &baked_data) const {
+	VOXEL_PROFILE_SCOPE();
+
+	Error err;
+	Ref<FileAccess> f_ref = FileAccess::open(fpath, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_MSG(f_ref.is_null(),
+			String("Could not save baked VoxelLibrary to {0}: error {1}")
+					.format(varray(fpath, err)));
+	FileAccess &f = **f_ref;
+
+	f.store_buffer(reinterpret_cast<const uint8_t *>(BAKE_CACHE_MAGIC), 4);
+	f.store_32(BAKE_CACHE_VERSION);
+	f.store_8(sizeof(real_t));
+	f.store_64(hash);
+
+	std::vector<uint64_t> pattern_words;
+	static const unsigned int WORDS_PER_PATTERN = SidePatternBitmap().size() / 64;
+	pattern_words.resize(_side_patterns.size() * WORDS_PER_PATTERN, 0);
+	for (size_t i = 0; i < _side_patterns.size(); ++i) {
+		const SidePatternBitmap &bitmap = _side_patterns[i];
+		for (unsigned int j = 0; j < bitmap.size(); ++j) {
+			if (bitmap.test(j)) {
+				pattern_words[i * WORDS_PER_PATTERN + j / 64] |= uint64_t(1) << (j % 64);
+			}
+		}
+	}
+	store_vector(f, pattern_words);
+
+	f.store_32(baked_data.models.size());
+
+	for (size_t i = 0; i < baked_data.models.size(); ++i) {
+		const Voxel::BakedData &m = baked_data.models[i];
+		f.store_32(m.material_id);
+		f.store_8(m.transparency_index);
+		f.store_8(m.empty);
+		f.store_8(m.cube);
+		f.store_32(m.max_vertex_count);
+		f.store_32(m.max_index_count);
+		f.store_32(m.max_tangent_count);
+		f.store_32(m.collision_mask);
+		store_pod(f, m.color);
+		store_pod(f, m.cube_tiles);
+
+		const Voxel::BakedData::Model &model = m.model;
+		store_pod(f, model.side_pattern_indices);
+		store_vector(f, model.positions);
+		store_vector(f, model.normals);
+		store_vector(f, model.uvs);
+		store_vector(f, model.indices);
+		store_vector(f, model.tangents);
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			store_vector(f, model.side_positions[side]);
+			store_vector(f, model.side_uvs[side]);
+			store_vector(f, model.side_indices[side]);
+			store_vector(f, model.side_tangents[side]);
+			store_vector(f, model.side_ao_weights[side]);
+		}
+	}
+}
+
 void VoxelLibrary::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("create_voxel", "id", "name"),
 			&VoxelLibrary::create_voxel);
@@ -449,6 +913,12 @@ void VoxelLibrary::_bind_methods() {
 			&VoxelLibrary::_b_get_voxel_by_name);
 
 	ClassDB::bind_method(D_METHOD("bake"), &VoxelLibrary::bake);
+	ClassDB::bind_method(D_METHOD("bake_voxel", "id"), &VoxelLibrary::bake_voxel);
+
+	ClassDB::bind_method(D_METHOD("set_bake_cache_path", "path"),
+			&VoxelLibrary::set_bake_cache_path);
+	ClassDB::bind_method(D_METHOD("get_bake_cache_path"),
+			&VoxelLibrary::get_bake_cache_path);
 
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "atlas_size"), "set_atlas_size",
 			"get_atlas_size");
@@ -457,6 +927,9 @@ void VoxelLibrary::_bind_methods() {
 			"set_voxel_count", "get_voxel_count");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "bake_tangents"),
 			"set_bake_tangents", "get_bake_tangents");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "bake_cache_path",
+						 PROPERTY_HINT_GLOBAL_SAVE_FILE),
+			"set_bake_cache_path", "get_bake_cache_path");
 
 	BIND_CONSTANT(MAX_VOXEL_TYPES);
 }
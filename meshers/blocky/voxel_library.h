@@ -34,6 +34,9 @@
 #include "../../util/dynamic_bitset.h"
 #include "voxel.h"
 #include <core/object/ref_counted.h>
+#include <core/os/mutex.h>
+#include <bitset>
+#include <memory>
 
 // TODO Rename VoxelBlockyLibrary
 
@@ -43,16 +46,43 @@ class VoxelLibrary : public Resource {
 
 public:
 	// Limit based on maximum supported by VoxelMesherBlocky
-	static const unsigned int MAX_VOXEL_TYPES = 65536;
+	// Needs a 32-bit type channel above 65536. Voxels are only stored for
+	// `voxel_count`, so this limit doesn't cost memory.
+	static const unsigned int MAX_VOXEL_TYPES = 1 << 20;
 	static const uint32_t NULL_INDEX = 0xFFFFFFFF;
 
 	struct BakedData {
+		// Summary of how a voxel type affects faces of its neighbors, so the mesher
+		// can resolve most of them without looking at models.
+		enum VoxelFlags {
+			// Bits 0 to 5: the side of that index is fully covered and opaque,
+			// so it hides any face touching it.
+			FLAG_OCCLUDING_SIDES_MASK = (1 << Cube::SIDE_COUNT) - 1,
+			// The voxel has no geometry.
+			FLAG_EMPTY = (1 << 6),
+			FLAG_CONTRIBUTES_TO_AO = (1 << 7),
+
+			// Flags to use for values that don't have a model
+			FLAGS_NO_MODEL = FLAG_EMPTY | FLAG_CONTRIBUTES_TO_AO
+		};
+
 		// 2D array: { X : pattern A, Y : pattern B } => Does A occlude B
 		// Where index is X + Y * pattern count
 		DynamicBitset side_pattern_culling;
 		unsigned int side_pattern_count = 0;
+		uint32_t full_side_pattern_index = NULL_INDEX;
 		// Lots of data can get moved but it's only on load.
 		std::vector<Voxel::BakedData> models;
+		// VoxelFlags for each model, in a compact array
+		std::vector<uint8_t> voxel_flags;
+		// For each model, 1 if it produces no geometry when all its neighbors
+		// have occluding sides: all its own sides are occluding, and it has no
+		// geometry besides them.
+		std::vector<uint8_t> hidden_when_enclosed;
+		// Size of the texture atlas in tiles, models UVs were baked with it
+		int atlas_size = 16;
+		// Incremented every time the library is baked
+		uint32_t version = 0;
 
 		inline bool has_model(uint32_t i) const { return i < models.size(); }
 
@@ -92,6 +122,17 @@ public:
 
 	void bake();
 
+	// Rebakes only one voxel, and updates side culling for the patterns it
+	// introduces. Falls back to a full bake if the library itself changed.
+	void bake_voxel(int id);
+
+	// If set, results of `bake()` are saved to this file, and loaded back
+	// instead of baking as long as the library has the same contents.
+	void set_bake_cache_path(String path);
+	String get_bake_cache_path() const {
+		return _bake_cache_path;
+	}
+
 	//-------------------------
 	// Internal use
 
@@ -103,17 +144,33 @@ public:
 		return **_voxel_types[id];
 	}
 
-	const BakedData &get_baked_data() const {
-		return _baked_data;
-	}
-	const RWLock &get_baked_data_rw_lock() const {
-		return _baked_data_rw_lock;
+	// Baked data is immutable once published, and replaced as a whole when the
+	// library is baked again. Holders of the returned pointer can keep reading it
+	// without locking, even while a new version is being baked.
+	std::shared_ptr<const BakedData> get_baked_data() const {
+		return std::atomic_load(&_baked_data);
 	}
 
 private:
 	void set_voxel(unsigned int id, Ref<Voxel> voxel);
 
-	void generate_side_culling_matrix();
+	static const unsigned int SIDE_PATTERN_RASTER_SIZE = 32;
+	typedef std::bitset<SIDE_PATTERN_RASTER_SIZE * SIDE_PATTERN_RASTER_SIZE>
+			SidePatternBitmap;
+
+	void generate_side_culling_matrix(BakedData &baked_data);
+	void bake_side_patterns(BakedData &baked_data, unsigned int type_id);
+	uint32_t get_or_create_side_pattern(BakedData &baked_data,
+			const SidePatternBitmap &bitmap);
+	void update_side_pattern_culling(BakedData &baked_data);
+	// Removes patterns no voxel uses anymore, after incremental bakes
+	void compact_side_patterns(BakedData &baked_data);
+	void update_voxel_flags(BakedData &baked_data, unsigned int type_id);
+
+	uint64_t compute_bake_hash(const std::vector<Array> &custom_mesh_arrays) const;
+	bool load_baked_data(String fpath, uint64_t hash, BakedData &baked_data);
+	void save_baked_data(String fpath, uint64_t hash,
+			const BakedData &baked_data) const;
 
 	bool _set(const StringName &p_name, const Variant &p_value);
 	bool _get(const StringName &p_name, Variant &r_ret) const;
@@ -126,17 +183,22 @@ private:
 
 private:
 	// There can be null entries. A vector is used because there should be no more
-	// than 65,536 items, and in practice the intented use case rarely goes over a
-	// few hundreds
+	// than MAX_VOXEL_TYPES items, and in practice the intented use case rarely
+	// goes over a few hundreds
 	std::vector<Ref<Voxel>> _voxel_types;
 	int _atlas_size = 16;
 	bool _needs_baking = true;
 	bool _bake_tangents = true;
-
-	// Used in multithread context by the mesher. Don't modify that outside of
-	// bake().
-	RWLock _baked_data_rw_lock;
-	BakedData _baked_data;
+	String _bake_cache_path;
+
+	// Used in multithread context by the mesher. Only accessed atomically, and
+	// only replaced by bake().
+	std::shared_ptr<const BakedData> _baked_data;
+	// Serializes bakes, meshers never wait on it
+	Mutex _bake_mutex;
+	// Unique bitmaps of model sides. Kept after baking so that incremental bakes
+	// only have to compare new patterns with existing ones.
+	std::vector<SidePatternBitmap> _side_patterns;
 };
 
 #endif // VOXEL_LIBRARY_H
@@ -32,8 +32,10 @@
 #include "../../constants/cube_tables.h"
 #include "../../storage/voxel_buffer.h"
 #include "../../util/funcs.h"
+#include "../../util/profiling.h"
 #include "../../util/span.h"
 #include <core/os/os.h>
+#include <core/templates/sort_array.h>
 
 // Utility functions
 namespace {
@@ -67,23 +69,496 @@ inline bool is_face_visible(const VoxelLibrary::BakedData &lib,
 	return true;
 }
 
-inline bool contributes_to_ao(const VoxelLibrary::BakedData &lib,
-		uint32_t voxel_id) {
-	if (voxel_id < lib.models.size()) {
-		const Voxel::BakedData &t = lib.models[voxel_id];
-		return t.contributes_to_ao;
+// Index of a neighbor in 27-bit neighborhood masks
+inline unsigned int get_neighbor_bit(const VoxelVector3i d) {
+	return (d.y + 1) + 3 * (d.x + 1) + 9 * (d.z + 1);
+}
+
+// Copies flags of each voxel from the library into a grid, so they can be read
+// without indirection and in bulk
+template <typename Type_T>
+void compute_voxel_flags(const Span<Type_T> type_buffer,
+		const std::vector<uint8_t> &library_flags, std::vector<uint8_t> &out_flags) {
+	const uint32_t library_size = library_flags.size();
+	const uint8_t *library_flags_ptr = library_flags.data();
+	out_flags.resize(type_buffer.size());
+	uint8_t *flags_ptr = out_flags.data();
+	const Type_T *types_ptr = type_buffer.data();
+
+	// Checked once for the whole block: if the library covers every value the
+	// channel can hold, the per-voxel bounds check can be skipped
+	if (uint64_t(library_size) >= (uint64_t(1) << (8 * sizeof(Type_T)))) {
+		for (size_t i = 0; i < type_buffer.size(); ++i) {
+			flags_ptr[i] = library_flags_ptr[types_ptr[i]];
+		}
+	} else {
+		for (size_t i = 0; i < type_buffer.size(); ++i) {
+			const uint32_t id = types_ptr[i];
+			flags_ptr[i] = id < library_size ? library_flags_ptr[id] :
+											   VoxelLibrary::BakedData::FLAGS_NO_MODEL;
+		}
+	}
+}
+
+// Counts, for each deck of the grid (slice along Z), how many voxels have
+// geometry and how many produce nothing when enclosed by opaque voxels.
+// Decks span the whole padded area, so a voxel of a deck whose count is full
+// has its 4 neighbors in X and Y in that deck.
+template <typename Type_T>
+void compute_deck_occupancy(const Span<Type_T> type_buffer, const std::vector<uint8_t> &flags,
+		const std::vector<uint8_t> &library_hidden_when_enclosed, const VoxelVector3i block_size,
+		std::vector<uint32_t> &out_non_empty_counts, std::vector<uint32_t> &out_opaque_counts) {
+	const unsigned int deck_size = block_size.x * block_size.y;
+	out_non_empty_counts.resize(block_size.z);
+	out_opaque_counts.resize(block_size.z);
+
+	const uint8_t *f = flags.data();
+	const Type_T *types = type_buffer.data();
+	const uint8_t *hidden_when_enclosed = library_hidden_when_enclosed.data();
+
+	for (int z = 0; z < block_size.z; ++z) {
+		const unsigned int deck_index = z * deck_size;
+		uint32_t non_empty_count = 0;
+		uint32_t opaque_count = 0;
+		for (unsigned int i = deck_index; i < deck_index + deck_size; ++i) {
+			non_empty_count += (f[i] & VoxelLibrary::BakedData::FLAG_EMPTY) == 0;
+			// Voxels with all sides occluding always have a model, so their ID
+			// is in range
+			if ((f[i] & VoxelLibrary::BakedData::FLAG_OCCLUDING_SIDES_MASK) ==
+					VoxelLibrary::BakedData::FLAG_OCCLUDING_SIDES_MASK) {
+				opaque_count += hidden_when_enclosed[types[i]];
+			}
+		}
+		out_non_empty_counts[z] = non_empty_count;
+		out_opaque_counts[z] = opaque_count;
+	}
+}
+
+// For each voxel, computes a 27-bit mask telling which voxels around it
+// contribute to ambient occlusion (see `get_neighbor_bit`). This is done in
+// three separable passes, one per axis, each of them being a linear loop over
+// the whole grid. Results are only valid for voxels not touching the borders.
+void compute_ao_masks(const std::vector<uint8_t> &flags, const VoxelVector3i block_size,
+		std::vector<uint32_t> &out_masks, std::vector<uint32_t> &tmp) {
+	const int row_size = block_size.y;
+	const int deck_size = block_size.x * row_size;
+	const int volume = flags.size();
+
+	out_masks.resize(volume);
+	tmp.resize(volume);
+
+	const uint8_t *f = flags.data();
+	uint32_t *a = out_masks.data();
+	uint32_t *b = tmp.data();
+
+	static_assert(VoxelLibrary::BakedData::FLAG_CONTRIBUTES_TO_AO == (1 << 7), "Bit shift assumes bit 7");
+
+	// Y (contiguous)
+	for (int i = 1; i < volume - 1; ++i) {
+		a[i] = (f[i - 1] >> 7) | ((f[i] >> 7) << 1) | ((f[i + 1] >> 7) << 2);
+	}
+	// X
+	for (int i = row_size; i < volume - row_size; ++i) {
+		b[i] = a[i - row_size] | (a[i] << 3) | (a[i + row_size] << 6);
+	}
+	// Z
+	for (int i = deck_size; i < volume - deck_size; ++i) {
+		a[i] = b[i - deck_size] | (b[i] << 9) | (b[i + deck_size] << 18);
+	}
+}
+
+// Cube faces to merge are first stored in 3D masks, one per side. Each value
+// identifies the voxel type and the occlusion of the face. Zero means no face,
+// so IDs are stored plus one.
+const unsigned int GREEDY_MASK_ID_BITS = 24;
+const uint32_t GREEDY_MASK_ID_MASK = (uint32_t(1) << GREEDY_MASK_ID_BITS) - 1;
+static_assert(VoxelLibrary::MAX_VOXEL_TYPES <= GREEDY_MASK_ID_MASK,
+		"Voxel IDs plus one must fit in greedy mask values");
+// Occlusion of 4 corners, 2 bits each
+static_assert(GREEDY_MASK_ID_BITS + 4 * 2 <= 32, "Occlusion must fit in greedy mask values");
+
+inline uint32_t make_greedy_mask_value(uint32_t voxel_id, uint32_t ao) {
+	return (voxel_id + 1) | (ao << GREEDY_MASK_ID_BITS);
+}
+
+inline uint32_t get_greedy_mask_voxel_id(uint32_t v) {
+	return (v & GREEDY_MASK_ID_MASK) - 1;
+}
+
+inline uint32_t get_greedy_mask_ao(uint32_t v) {
+	return v >> GREEDY_MASK_ID_BITS;
+}
+
+// Converts occlusion darkness into fixed point with 16 bits of fraction
+inline uint32_t get_darkness_fp16(float baked_occlusion_darkness) {
+	return static_cast<uint32_t>(baked_occlusion_darkness * 65536.f + 0.5f);
+}
+
+// Gets a grey level from 0 to 255, given a shade made of an occlusion level
+// (0 to 3) multiplied by a corner weight (0 to 255).
+inline uint32_t get_occlusion_gray8(uint32_t shade, uint32_t darkness_fp16) {
+	const uint32_t darkening = (shade * darkness_fp16 + 0x8000) >> 16;
+	return darkening < 255 ? 255 - darkening : 0;
+}
+
+inline Color get_occluded_color(const Color modulate_color, uint32_t gray8) {
+	const float gs = static_cast<float>(gray8) * (1.f / 255.f);
+	return Color(modulate_color.r * gs, modulate_color.g * gs, modulate_color.b * gs, modulate_color.a);
+}
+
+// Gets the type channel of a buffer as a dense array. Uniform channels are
+// decompressed into `backing`, to still allow the use of the same algorithm.
+bool get_dense_type_channel(const VoxelBuffer &voxels, std::vector<uint8_t> &backing,
+		Span<uint8_t> &out_channel) {
+	const int channel = VoxelBuffer::CHANNEL_TYPE;
+
+	if (voxels.get_channel_compression(channel) ==
+			VoxelBuffer::COMPRESSION_UNIFORM) {
+		const uint64_t voxel_id = voxels.get_voxel(0, 0, 0, channel);
+		const unsigned int volume = voxels.get_size().volume();
+
+		switch (voxels.get_channel_depth(channel)) {
+			case VoxelBuffer::DEPTH_8_BIT:
+				backing.resize(volume);
+				memset(backing.data(), voxel_id, volume);
+				break;
+
+			case VoxelBuffer::DEPTH_16_BIT: {
+				backing.resize(volume * sizeof(uint16_t));
+				uint16_t *w = reinterpret_cast<uint16_t *>(backing.data());
+				for (unsigned int i = 0; i < volume; ++i) {
+					w[i] = voxel_id;
+				}
+			} break;
+
+			case VoxelBuffer::DEPTH_32_BIT: {
+				backing.resize(volume * sizeof(uint32_t));
+				uint32_t *w = reinterpret_cast<uint32_t *>(backing.data());
+				for (unsigned int i = 0; i < volume; ++i) {
+					w[i] = voxel_id;
+				}
+			} break;
+
+			default:
+				ERR_PRINT("Unsupported voxel depth");
+				return false;
+		}
+		out_channel = to_span(backing);
+		return true;
+
+	} else if (voxels.get_channel_compression(channel) !=
+			VoxelBuffer::COMPRESSION_NONE) {
+		// No other form of compression is allowed
+		ERR_PRINT("VoxelMesherBlocky received unsupported voxel compression");
+		return false;
+
+	} else if (!voxels.get_channel_raw(channel, out_channel)) {
+		/*       _
+		//      | \
+		//     /\ \\
+		//    / /|\\\
+		//    | |\ \\\
+		//    | \_\ \\|
+		//    |    |  )
+		//     \   |  |
+		//      \    /
+		*/
+		// Case supposedly handled before...
+		ERR_PRINT("Something wrong happened");
+		return false;
 	}
+
 	return true;
 }
+
+inline unsigned int get_surface_index(const Voxel::BakedData &voxel, bool transparent_surfaces) {
+	return transparent_surfaces && voxel.transparency_index != 0 ?
+			VoxelMesherBlocky::MAX_MATERIALS + voxel.material_id :
+			voxel.material_id;
+}
+
+// Reorders triangles of a transparent surface so they blend properly when drawn
+// in index order. Vertices are left untouched.
+void sort_triangles(VoxelMesherBlocky::Arrays &arrays, VoxelMesherBlocky::TransparentSorting sorting,
+		const Vector3 direction, std::vector<VoxelMesherBlocky::SortedTriangle> &triangles,
+		std::vector<int> &sorted_indices) {
+	const unsigned int triangle_count = arrays.indices.size() / 3;
+	triangles.resize(triangle_count);
+
+	for (unsigned int i = 0; i < triangle_count; ++i) {
+		const int i0 = arrays.indices[i * 3];
+		// Scaled by 3, it doesn't matter for comparisons
+		const Vector3 center = arrays.positions[i0] + arrays.positions[arrays.indices[i * 3 + 1]] +
+				arrays.positions[arrays.indices[i * 3 + 2]];
+
+		VoxelMesherBlocky::SortedTriangle &t = triangles[i];
+		t.index = i;
+
+		if (sorting == VoxelMesherBlocky::TRANSPARENT_SORTING_DIRECTION) {
+			// Furthest along the view direction comes first
+			t.group = 0;
+			t.depth = -direction.dot(center);
+
+		} else {
+			// Triangles facing no particular side come last
+			const Vector3 normal = arrays.normals[i0];
+			t.group = Cube::SIDE_COUNT;
+			t.depth = 0.f;
+			for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+				const Vector3 side_normal = Cube::g_side_normals[side].to_vec3();
+				if (normal == side_normal) {
+					// Seen from the side it faces, the furthest is the one behind
+					t.group = side;
+					t.depth = side_normal.dot(center);
+					break;
+				}
+			}
+		}
+	}
+
+	SortArray<VoxelMesherBlocky::SortedTriangle> sorter;
+	sorter.sort(triangles.data(), triangles.size());
+
+	sorted_indices.resize(arrays.indices.size());
+	for (unsigned int i = 0; i < triangle_count; ++i) {
+		const int *src = arrays.indices.data() + triangles[i].index * 3;
+		int *dst = sorted_indices.data() + i * 3;
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+	arrays.indices.swap(sorted_indices);
+}
+
+inline unsigned int get_axis(const Vector3 v) {
+	return v.x != 0 ? VoxelVector3i::AXIS_X : (v.y != 0 ? VoxelVector3i::AXIS_Y : VoxelVector3i::AXIS_Z);
+}
+
+// Merges coplanar cube faces having the same type and occlusion into larger
+// quads. Their UVs extend past the tile by as many tiles as the quad is long,
+// and UV2 holds the origin of the tile, so a shader can repeat it.
+void merge_cube_faces(
+		FixedArray<VoxelMesherBlocky::Arrays, VoxelMesherBlocky::MAX_SURFACES> &out_arrays_per_material,
+		int *index_offsets, FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> &masks,
+		const VoxelVector3i size, const VoxelLibrary::BakedData &library,
+		float baked_occlusion_darkness, bool transparent_surfaces) {
+	// Same layout as cube UVs baked in `Voxel`, without the tile offset
+	const Vector2 quad_uvs[4] = { Vector2(0, 1), Vector2(1, 1), Vector2(1, 0), Vector2(0, 0) };
+	const float uv_margin = 0.001f;
+	const float tile_size = 1.f / static_cast<float>(library.atlas_size);
+	const uint32_t darkness_fp16 = get_darkness_fp16(baked_occlusion_darkness);
+
+	FixedArray<int, VoxelVector3i::AXIS_COUNT> strides;
+	strides[VoxelVector3i::AXIS_X] = size.y;
+	strides[VoxelVector3i::AXIS_Y] = 1;
+	strides[VoxelVector3i::AXIS_Z] = size.x * size.y;
+
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		std::vector<uint32_t> &mask = masks[side];
+		const Vector3 normal = Cube::g_side_normals[side].to_vec3();
+		const unsigned int *side_corners = Cube::g_side_corners[side];
+
+		// Axis the side is facing, and axes of the plane
+		const unsigned int axis_d = get_axis(normal);
+		const unsigned int axis_a = (axis_d + 1) % 3;
+		const unsigned int axis_b = (axis_d + 2) % 3;
+
+		// Axes along which texture coordinates go
+		const unsigned int axis_u = get_axis(
+				Cube::g_corner_position[side_corners[1]] - Cube::g_corner_position[side_corners[0]]);
+		const unsigned int axis_v = get_axis(
+				Cube::g_corner_position[side_corners[0]] - Cube::g_corner_position[side_corners[3]]);
+
+		for (int d = 0; d < size[axis_d]; ++d) {
+			for (int j = 0; j < size[axis_b]; ++j) {
+				for (int i = 0; i < size[axis_a]; ++i) {
+					const int mask_index = i * strides[axis_a] + j * strides[axis_b] + d * strides[axis_d];
+					const uint32_t v = mask[mask_index];
+					if (v == 0) {
+						continue;
+					}
+
+					// Extend along A
+					int w = 1;
+					while (i + w < size[axis_a] && mask[mask_index + w * strides[axis_a]] == v) {
+						++w;
+					}
+
+					// Extend along B, as long as whole rows match
+					int h = 1;
+					for (; j + h < size[axis_b]; ++h) {
+						const int row_index = mask_index + h * strides[axis_b];
+						bool row_matches = true;
+						for (int k = 0; k < w; ++k) {
+							if (mask[row_index + k * strides[axis_a]] != v) {
+								row_matches = false;
+								break;
+							}
+						}
+						if (!row_matches) {
+							break;
+						}
+					}
+
+					for (int hi = 0; hi < h; ++hi) {
+						for (int wi = 0; wi < w; ++wi) {
+							mask[mask_index + wi * strides[axis_a] + hi * strides[axis_b]] = 0;
+						}
+					}
+
+					const uint32_t voxel_id = get_greedy_mask_voxel_id(v);
+					const uint32_t ao = get_greedy_mask_ao(v);
+					const Voxel::BakedData &voxel = library.models[voxel_id];
+					const unsigned int surface_index = get_surface_index(voxel, transparent_surfaces);
+					VoxelMesherBlocky::Arrays &arrays = out_arrays_per_material[surface_index];
+					int &index_offset = index_offsets[surface_index];
+
+					VoxelVector3i origin;
+					origin[axis_d] = d;
+					origin[axis_a] = i;
+					origin[axis_b] = j;
+
+					VoxelVector3i extents(1);
+					extents[axis_a] = w;
+					extents[axis_b] = h;
+
+					const Vector2 tile_uv = voxel.cube_tiles[side] * tile_size;
+					const Vector2 quad_size(extents[axis_u], extents[axis_v]);
+					const Color modulate_color = voxel.color;
+
+					const int append_index = arrays.positions.size();
+					arrays.positions.resize(append_index + 4);
+					arrays.normals.resize(append_index + 4);
+					arrays.uvs.resize(append_index + 4);
+					arrays.colors.resize(append_index + 4);
+					const int uv2_append_index = arrays.uv2s.size();
+					arrays.uv2s.resize(uv2_append_index + 4);
+
+					for (unsigned int k = 0; k < 4; ++k) {
+						const Vector3 corner_pos = Cube::g_corner_position[side_corners[k]];
+						arrays.positions[append_index + k] = origin.to_vec3() +
+								Vector3(corner_pos.x * extents.x, corner_pos.y * extents.y, corner_pos.z * extents.z);
+						arrays.normals[append_index + k] = normal;
+
+						const Vector2 local_uv = quad_uvs[k] * (quad_size - Vector2(2 * uv_margin, 2 * uv_margin)) +
+								Vector2(uv_margin, uv_margin);
+						arrays.uvs[append_index + k] = tile_uv + local_uv * tile_size;
+						arrays.uv2s[uv2_append_index + k] = tile_uv;
+
+						// Vertices of cubes are fully weighted by their own corner
+						const uint32_t shade = ((ao >> (k * 2)) & 3) * 255;
+						arrays.colors[append_index + k] =
+								get_occluded_color(modulate_color, get_occlusion_gray8(shade, darkness_fp16));
+					}
+
+					const std::vector<float> &side_tangents = voxel.model.side_tangents[side];
+					if (side_tangents.size() > 0) {
+						const int tangents_append_index = arrays.tangents.size();
+						arrays.tangents.resize(tangents_append_index + side_tangents.size());
+						memcpy(arrays.tangents.data() + tangents_append_index, side_tangents.data(),
+								side_tangents.size() * sizeof(float));
+					}
+
+					const std::vector<int> &side_indices = voxel.model.side_indices[side];
+					const int indices_append_index = arrays.indices.size();
+					arrays.indices.resize(indices_append_index + side_indices.size());
+					for (unsigned int k = 0; k < side_indices.size(); ++k) {
+						arrays.indices[indices_append_index + k] = index_offset + side_indices[k];
+					}
+
+					index_offset += 4;
+				}
+			}
+		}
+	}
+}
+// Same as `merge_cube_faces`, for collision. Faces only need to be solid to be
+// merged, so quads get much larger.
+void merge_collision_faces(std::vector<Vector3> &out_positions, std::vector<int> &out_indices,
+		FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> &masks, const VoxelVector3i size) {
+	FixedArray<int, VoxelVector3i::AXIS_COUNT> strides;
+	strides[VoxelVector3i::AXIS_X] = size.y;
+	strides[VoxelVector3i::AXIS_Y] = 1;
+	strides[VoxelVector3i::AXIS_Z] = size.x * size.y;
+
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		std::vector<uint32_t> &mask = masks[side];
+		const unsigned int *side_corners = Cube::g_side_corners[side];
+
+		const unsigned int axis_d = get_axis(Cube::g_side_normals[side].to_vec3());
+		const unsigned int axis_a = (axis_d + 1) % 3;
+		const unsigned int axis_b = (axis_d + 2) % 3;
+
+		for (int d = 0; d < size[axis_d]; ++d) {
+			for (int j = 0; j < size[axis_b]; ++j) {
+				for (int i = 0; i < size[axis_a]; ++i) {
+					const int mask_index = i * strides[axis_a] + j * strides[axis_b] + d * strides[axis_d];
+					if (mask[mask_index] == 0) {
+						continue;
+					}
+
+					int w = 1;
+					while (i + w < size[axis_a] && mask[mask_index + w * strides[axis_a]] != 0) {
+						++w;
+					}
+
+					int h = 1;
+					for (; j + h < size[axis_b]; ++h) {
+						const int row_index = mask_index + h * strides[axis_b];
+						bool row_matches = true;
+						for (int k = 0; k < w; ++k) {
+							if (mask[row_index + k * strides[axis_a]] == 0) {
+								row_matches = false;
+								break;
+							}
+						}
+						if (!row_matches) {
+							break;
+						}
+					}
+
+					for (int hi = 0; hi < h; ++hi) {
+						for (int wi = 0; wi < w; ++wi) {
+							mask[mask_index + wi * strides[axis_a] + hi * strides[axis_b]] = 0;
+						}
+					}
+
+					VoxelVector3i origin;
+					origin[axis_d] = d;
+					origin[axis_a] = i;
+					origin[axis_b] = j;
+
+					VoxelVector3i extents(1);
+					extents[axis_a] = w;
+					extents[axis_b] = h;
+
+					const int index_offset = out_positions.size();
+					for (unsigned int k = 0; k < 4; ++k) {
+						const Vector3 corner_pos = Cube::g_corner_position[side_corners[k]];
+						out_positions.push_back(origin.to_vec3() +
+								Vector3(corner_pos.x * extents.x, corner_pos.y * extents.y, corner_pos.z * extents.z));
+					}
+					for (unsigned int k = 0; k < 6; ++k) {
+						out_indices.push_back(index_offset + Cube::g_side_quad_triangles[side][k]);
+					}
+				}
+			}
+		}
+	}
+}
 } // namespace
 
 template <typename Type_T>
 static void generate_blocky_mesh(
-		FixedArray<VoxelMesherBlocky::Arrays, VoxelMesherBlocky::MAX_MATERIALS>
+		FixedArray<VoxelMesherBlocky::Arrays, VoxelMesherBlocky::MAX_SURFACES>
 				&out_arrays_per_material,
+		std::vector<uint8_t> &voxel_flags, std::vector<uint32_t> &ao_masks,
+		std::vector<uint32_t> &ao_masks_tmp, std::vector<uint8_t> &deck_mask,
+		std::vector<uint32_t> &deck_non_empty_counts, std::vector<uint32_t> &deck_opaque_counts,
+		FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> *greedy_masks,
 		const Span<Type_T> type_buffer, const VoxelVector3i block_size,
 		const VoxelLibrary::BakedData &library, bool bake_occlusion,
-		float baked_occlusion_darkness) {
+		float baked_occlusion_darkness, bool transparent_surfaces) {
 	ERR_FAIL_COND(
 			block_size.x < static_cast<int>(2 * VoxelMesherBlocky::PADDING) ||
 			block_size.y < static_cast<int>(2 * VoxelMesherBlocky::PADDING) ||
@@ -100,7 +575,15 @@ static void generate_blocky_mesh(
 	const VoxelVector3i max =
 			block_size - VoxelVector3i(VoxelMesherBlocky::PADDING);
 
-	int index_offsets[VoxelMesherBlocky::MAX_MATERIALS] = { 0 };
+	const VoxelVector3i inner_size = max - min;
+
+	int index_offsets[VoxelMesherBlocky::MAX_SURFACES] = { 0 };
+
+	if (greedy_masks != nullptr) {
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			(*greedy_masks)[side].assign(inner_size.volume(), 0);
+		}
+	}
 
 	FixedArray<int, Cube::SIDE_COUNT> side_neighbor_lut;
 	side_neighbor_lut[Cube::SIDE_LEFT] = row_size;
@@ -110,86 +593,156 @@ static void generate_blocky_mesh(
 	side_neighbor_lut[Cube::SIDE_BOTTOM] = -1;
 	side_neighbor_lut[Cube::SIDE_TOP] = 1;
 
-	FixedArray<int, Cube::EDGE_COUNT> edge_neighbor_lut;
-	edge_neighbor_lut[Cube::EDGE_BOTTOM_BACK] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] + side_neighbor_lut[Cube::SIDE_BACK];
-	edge_neighbor_lut[Cube::EDGE_BOTTOM_FRONT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_FRONT];
-	edge_neighbor_lut[Cube::EDGE_BOTTOM_LEFT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] + side_neighbor_lut[Cube::SIDE_LEFT];
-	edge_neighbor_lut[Cube::EDGE_BOTTOM_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_RIGHT];
-	edge_neighbor_lut[Cube::EDGE_BACK_LEFT] =
-			side_neighbor_lut[Cube::SIDE_BACK] + side_neighbor_lut[Cube::SIDE_LEFT];
-	edge_neighbor_lut[Cube::EDGE_BACK_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_BACK] + side_neighbor_lut[Cube::SIDE_RIGHT];
-	edge_neighbor_lut[Cube::EDGE_FRONT_LEFT] =
-			side_neighbor_lut[Cube::SIDE_FRONT] + side_neighbor_lut[Cube::SIDE_LEFT];
-	edge_neighbor_lut[Cube::EDGE_FRONT_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_FRONT] + side_neighbor_lut[Cube::SIDE_RIGHT];
-	edge_neighbor_lut[Cube::EDGE_TOP_BACK] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_BACK];
-	edge_neighbor_lut[Cube::EDGE_TOP_FRONT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_FRONT];
-	edge_neighbor_lut[Cube::EDGE_TOP_LEFT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_LEFT];
-	edge_neighbor_lut[Cube::EDGE_TOP_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_RIGHT];
-
-	FixedArray<int, Cube::CORNER_COUNT> corner_neighbor_lut;
-
-	corner_neighbor_lut[Cube::CORNER_BOTTOM_BACK_LEFT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_BACK] + side_neighbor_lut[Cube::SIDE_LEFT];
-
-	corner_neighbor_lut[Cube::CORNER_BOTTOM_BACK_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_BACK] + side_neighbor_lut[Cube::SIDE_RIGHT];
-
-	corner_neighbor_lut[Cube::CORNER_BOTTOM_FRONT_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_FRONT] + side_neighbor_lut[Cube::SIDE_RIGHT];
-
-	corner_neighbor_lut[Cube::CORNER_BOTTOM_FRONT_LEFT] =
-			side_neighbor_lut[Cube::SIDE_BOTTOM] +
-			side_neighbor_lut[Cube::SIDE_FRONT] + side_neighbor_lut[Cube::SIDE_LEFT];
-
-	corner_neighbor_lut[Cube::CORNER_TOP_BACK_LEFT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_BACK] +
-			side_neighbor_lut[Cube::SIDE_LEFT];
-
-	corner_neighbor_lut[Cube::CORNER_TOP_BACK_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_BACK] +
-			side_neighbor_lut[Cube::SIDE_RIGHT];
-
-	corner_neighbor_lut[Cube::CORNER_TOP_FRONT_RIGHT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_FRONT] +
-			side_neighbor_lut[Cube::SIDE_RIGHT];
-
-	corner_neighbor_lut[Cube::CORNER_TOP_FRONT_LEFT] =
-			side_neighbor_lut[Cube::SIDE_TOP] + side_neighbor_lut[Cube::SIDE_FRONT] +
-			side_neighbor_lut[Cube::SIDE_LEFT];
+	const uint32_t darkness_fp16 = get_darkness_fp16(baked_occlusion_darkness);
+
+	// Neighbors used for AO are identified by their bit in the AO masks
+	FixedArray<VoxelVector3i, Cube::SIDE_COUNT> side_deltas;
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		// Same directions as `side_neighbor_lut`
+		side_deltas[side] = Cube::g_side_normals[side];
+	}
+
+	FixedArray<unsigned int, Cube::EDGE_COUNT> edge_neighbor_bit;
+	edge_neighbor_bit[Cube::EDGE_BOTTOM_BACK] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_BACK]);
+	edge_neighbor_bit[Cube::EDGE_BOTTOM_FRONT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_FRONT]);
+	edge_neighbor_bit[Cube::EDGE_BOTTOM_LEFT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_LEFT]);
+	edge_neighbor_bit[Cube::EDGE_BOTTOM_RIGHT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_RIGHT]);
+	edge_neighbor_bit[Cube::EDGE_BACK_LEFT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_LEFT]);
+	edge_neighbor_bit[Cube::EDGE_BACK_RIGHT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_RIGHT]);
+	edge_neighbor_bit[Cube::EDGE_FRONT_LEFT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_LEFT]);
+	edge_neighbor_bit[Cube::EDGE_FRONT_RIGHT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_RIGHT]);
+	edge_neighbor_bit[Cube::EDGE_TOP_BACK] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_BACK]);
+	edge_neighbor_bit[Cube::EDGE_TOP_FRONT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_FRONT]);
+	edge_neighbor_bit[Cube::EDGE_TOP_LEFT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_LEFT]);
+	edge_neighbor_bit[Cube::EDGE_TOP_RIGHT] =
+			get_neighbor_bit(side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_RIGHT]);
+
+	FixedArray<unsigned int, Cube::CORNER_COUNT> corner_neighbor_bit;
+	corner_neighbor_bit[Cube::CORNER_BOTTOM_BACK_LEFT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_LEFT]);
+	corner_neighbor_bit[Cube::CORNER_BOTTOM_BACK_RIGHT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_RIGHT]);
+	corner_neighbor_bit[Cube::CORNER_BOTTOM_FRONT_RIGHT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_RIGHT]);
+	corner_neighbor_bit[Cube::CORNER_BOTTOM_FRONT_LEFT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_BOTTOM] + side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_LEFT]);
+	corner_neighbor_bit[Cube::CORNER_TOP_BACK_LEFT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_LEFT]);
+	corner_neighbor_bit[Cube::CORNER_TOP_BACK_RIGHT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_BACK] + side_deltas[Cube::SIDE_RIGHT]);
+	corner_neighbor_bit[Cube::CORNER_TOP_FRONT_RIGHT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_RIGHT]);
+	corner_neighbor_bit[Cube::CORNER_TOP_FRONT_LEFT] = get_neighbor_bit(
+			side_deltas[Cube::SIDE_TOP] + side_deltas[Cube::SIDE_FRONT] + side_deltas[Cube::SIDE_LEFT]);
+
+	// Gather everything the face loop needs about neighbors in bulk, rather than
+	// looking up models for every side of every voxel
+	compute_voxel_flags(type_buffer, library.voxel_flags, voxel_flags);
+
+	// Find which decks can produce geometry. A deck can't if it is empty, or if
+	// it is buried between opaque decks. This is common underground or in the sky.
+	// Buried means every voxel of the 3 decks is opaque on all sides without
+	// inner geometry, so all 6 neighbors of the middle deck's voxels hide them.
+	compute_deck_occupancy(type_buffer, voxel_flags, library.hidden_when_enclosed, block_size,
+			deck_non_empty_counts, deck_opaque_counts);
+	const uint32_t full_deck_count = deck_size;
+	deck_mask.resize(block_size.z);
+	bool any_deck = false;
+	for (int z = min.z; z < max.z; ++z) {
+		const bool buried = deck_opaque_counts[z - 1] == full_deck_count &&
+				deck_opaque_counts[z] == full_deck_count && deck_opaque_counts[z + 1] == full_deck_count;
+		deck_mask[z] = deck_non_empty_counts[z] != 0 && !buried;
+		any_deck |= (deck_mask[z] != 0);
+	}
+	if (!any_deck) {
+		return;
+	}
+
+	if (bake_occlusion) {
+		compute_ao_masks(voxel_flags, block_size, ao_masks, ao_masks_tmp);
+	}
+
+	// Reserve enough memory for the worst case up front, so appending geometry
+	// never reallocates
+	{
+		uint32_t vertex_counts[VoxelMesherBlocky::MAX_SURFACES] = { 0 };
+		uint32_t index_counts[VoxelMesherBlocky::MAX_SURFACES] = { 0 };
+		uint32_t tangent_counts[VoxelMesherBlocky::MAX_SURFACES] = { 0 };
+
+		for (int z = min.z; z < max.z; ++z) {
+			if (deck_mask[z] == 0) {
+				continue;
+			}
+			for (int x = min.x; x < max.x; ++x) {
+				const int row_index = x * row_size + z * deck_size;
+				for (int y = min.y; y < max.y; ++y) {
+					const int voxel_index = y + row_index;
+					if (voxel_flags[voxel_index] & VoxelLibrary::BakedData::FLAG_EMPTY) {
+						continue;
+					}
+					const uint32_t voxel_id = type_buffer[voxel_index];
+					if (voxel_id == Voxel::AIR_ID) {
+						continue;
+					}
+					const Voxel::BakedData &voxel = library.models[voxel_id];
+					const unsigned int surface_index = get_surface_index(voxel, transparent_surfaces);
+					vertex_counts[surface_index] += voxel.max_vertex_count;
+					index_counts[surface_index] += voxel.max_index_count;
+					tangent_counts[surface_index] += voxel.max_tangent_count;
+				}
+			}
+		}
+
+		for (unsigned int i = 0; i < VoxelMesherBlocky::MAX_SURFACES; ++i) {
+			VoxelMesherBlocky::Arrays &arrays = out_arrays_per_material[i];
+			const uint32_t vertex_count = vertex_counts[i];
+			arrays.positions.reserve(vertex_count);
+			arrays.normals.reserve(vertex_count);
+			arrays.uvs.reserve(vertex_count);
+			arrays.colors.reserve(vertex_count);
+			arrays.indices.reserve(index_counts[i]);
+			arrays.tangents.reserve(tangent_counts[i]);
+			if (greedy_masks != nullptr) {
+				arrays.uv2s.reserve(vertex_count);
+			}
+		}
+	}
 
 	// uint64_t time_prep = OS::get_singleton()->get_ticks_usec() - time_before;
 	// time_before = OS::get_singleton()->get_ticks_usec();
 
 	for (unsigned int z = min.z; z < (unsigned int)max.z; ++z) {
+		if (deck_mask[z] == 0) {
+			continue;
+		}
 		for (unsigned int x = min.x; x < (unsigned int)max.x; ++x) {
 			for (unsigned int y = min.y; y < (unsigned int)max.y; ++y) {
 				// min and max are chosen such that you can visit 1 neighbor away from
 				// the current voxel without size check
 
 				const int voxel_index = y + x * row_size + z * deck_size;
+				if (voxel_flags[voxel_index] & VoxelLibrary::BakedData::FLAG_EMPTY) {
+					continue;
+				}
 				const int voxel_id = type_buffer[voxel_index];
 
-				if (voxel_id != 0 && library.has_model(voxel_id)) {
+				if (voxel_id != 0) {
 					const Voxel::BakedData &voxel = library.models[voxel_id];
 
-					VoxelMesherBlocky::Arrays &arrays =
-							out_arrays_per_material[voxel.material_id];
-					int &index_offset = index_offsets[voxel.material_id];
+					const unsigned int surface_index = get_surface_index(voxel, transparent_surfaces);
+					VoxelMesherBlocky::Arrays &arrays = out_arrays_per_material[surface_index];
+					int &index_offset = index_offsets[surface_index];
 
 					// Hybrid approach: extract cube faces and decimate those that aren't
 					// visible, and still allow voxels to have geometry that is not a cube
@@ -204,12 +757,20 @@ static void generate_blocky_mesh(
 							continue;
 						}
 
-						const uint32_t neighbor_voxel_id =
-								type_buffer[voxel_index + side_neighbor_lut[side]];
+						const int neighbor_index = voxel_index + side_neighbor_lut[side];
+						const uint8_t neighbor_flags = voxel_flags[neighbor_index];
 
-						if (!is_face_visible(library, voxel, neighbor_voxel_id, side)) {
+						if (neighbor_flags & (1 << g_opposite_side[side])) {
+							// Fully hidden by an opaque side
 							continue;
 						}
+						if ((neighbor_flags & VoxelLibrary::BakedData::FLAG_EMPTY) == 0) {
+							// Neighbor has a shape which may or may not hide the face
+							const uint32_t neighbor_voxel_id = type_buffer[neighbor_index];
+							if (!is_face_visible(library, voxel, neighbor_voxel_id, side)) {
+								continue;
+							}
+						}
 
 						// The face is visible
 
@@ -226,11 +787,11 @@ static void generate_blocky_mesh(
 							//	  return 3 - (side1 + side2 + corner)
 							//	}
 
+							const uint32_t ao_mask = ao_masks[voxel_index];
+
 							for (unsigned int j = 0; j < 4; ++j) {
 								const unsigned int edge = Cube::g_side_edges[side][j];
-								const int edge_neighbor_id =
-										type_buffer[voxel_index + edge_neighbor_lut[edge]];
-								if (contributes_to_ao(library, edge_neighbor_id)) {
+								if (ao_mask & (1 << edge_neighbor_bit[edge])) {
 									++shaded_corner[Cube::g_edge_corners[edge][0]];
 									++shaded_corner[Cube::g_edge_corners[edge][1]];
 								}
@@ -239,16 +800,24 @@ static void generate_blocky_mesh(
 								const unsigned int corner = Cube::g_side_corners[side][j];
 								if (shaded_corner[corner] == 2) {
 									shaded_corner[corner] = 3;
-								} else {
-									const int corner_neigbor_id =
-											type_buffer[voxel_index + corner_neighbor_lut[corner]];
-									if (contributes_to_ao(library, corner_neigbor_id)) {
-										++shaded_corner[corner];
-									}
+								} else if (ao_mask & (1 << corner_neighbor_bit[corner])) {
+									++shaded_corner[corner];
 								}
 							}
 						}
 
+						if (greedy_masks != nullptr && voxel.cube) {
+							// Deferred, to be merged with similar faces
+							uint32_t ao = 0;
+							for (unsigned int j = 0; j < 4; ++j) {
+								ao |= shaded_corner[Cube::g_side_corners[side][j]] << (j * 2);
+							}
+							const int mask_index = (y - min.y) + (x - min.x) * inner_size.y +
+									(z - min.z) * inner_size.x * inner_size.y;
+							(*greedy_masks)[side][mask_index] = make_greedy_mask_value(voxel_id, ao);
+							continue;
+						}
+
 						const std::vector<Vector2> &side_uvs = voxel.model.side_uvs[side];
 						const std::vector<float> &side_tangents =
 								voxel.model.side_tangents[side];
@@ -297,36 +866,23 @@ static void generate_blocky_mesh(
 							const Color modulate_color = voxel.color;
 
 							if (bake_occlusion) {
-								for (unsigned int i = 0; i < vertex_count; ++i) {
-									Vector3 v = side_positions[i];
+								// Weights were baked for each vertex, so shading only takes
+								// the strongest of 4 weighted corners
+								const std::vector<uint32_t> &side_ao_weights = voxel.model.side_ao_weights[side];
+								const unsigned int *side_corners = Cube::g_side_corners[side];
+								const uint32_t level0 = shaded_corner[side_corners[0]];
+								const uint32_t level1 = shaded_corner[side_corners[1]];
+								const uint32_t level2 = shaded_corner[side_corners[2]];
+								const uint32_t level3 = shaded_corner[side_corners[3]];
 
-									// General purpose occlusion colouring.
-									// TODO Optimize for cubes
+								for (unsigned int i = 0; i < vertex_count; ++i) {
 									// TODO Fix occlusion inconsistency caused by triangles
 									// orientation? Not sure if worth it
-									float shade = 0;
-									for (unsigned int j = 0; j < 4; ++j) {
-										unsigned int corner = Cube::g_side_corners[side][j];
-										if (shaded_corner[corner]) {
-											float s = baked_occlusion_darkness *
-													static_cast<float>(shaded_corner[corner]);
-											// float k = 1.f -
-											// Cube::g_corner_position[corner].distance_to(v);
-											float k =
-													1.f -
-													Cube::g_corner_position[corner].distance_squared_to(
-															v);
-											if (k < 0.0) {
-												k = 0.0;
-											}
-											s *= k;
-											if (s > shade) {
-												shade = s;
-											}
-										}
-									}
-									const float gs = 1.0 - shade;
-									w[i] = Color(gs, gs, gs) * modulate_color;
+									const uint32_t weights = side_ao_weights[i];
+									const uint32_t shade = MAX(
+											MAX((weights & 0xff) * level0, ((weights >> 8) & 0xff) * level1),
+											MAX(((weights >> 16) & 0xff) * level2, (weights >> 24) * level3));
+									w[i] = get_occluded_color(modulate_color, get_occlusion_gray8(shade, darkness_fp16));
 								}
 
 							} else {
@@ -354,8 +910,6 @@ static void generate_blocky_mesh(
 
 					// Inside
 					if (voxel.model.positions.size() != 0) {
-						// TODO Get rid of push_backs
-
 						const std::vector<Vector3> &positions = voxel.model.positions;
 						const unsigned int vertex_count = positions.size();
 						const Color modulate_color = voxel.color;
@@ -373,19 +927,49 @@ static void generate_blocky_mesh(
 									(vertex_count * 4) * sizeof(float));
 						}
 
-						for (unsigned int i = 0; i < vertex_count; ++i) {
-							arrays.normals.push_back(normals[i]);
-							arrays.uvs.push_back(uvs[i]);
-							arrays.positions.push_back(positions[i] + pos);
+						{
+							const int append_index = arrays.positions.size();
+							arrays.positions.resize(arrays.positions.size() + vertex_count);
+							Vector3 *w = arrays.positions.data() + append_index;
+							for (unsigned int i = 0; i < vertex_count; ++i) {
+								w[i] = positions[i] + pos;
+							}
+						}
+
+						{
+							const int append_index = arrays.normals.size();
+							arrays.normals.resize(arrays.normals.size() + vertex_count);
+							memcpy(arrays.normals.data() + append_index, normals.data(),
+									vertex_count * sizeof(Vector3));
+						}
+
+						{
+							const int append_index = arrays.uvs.size();
+							arrays.uvs.resize(arrays.uvs.size() + vertex_count);
+							memcpy(arrays.uvs.data() + append_index, uvs.data(),
+									vertex_count * sizeof(Vector2));
+						}
+
+						{
 							// TODO handle ambient occlusion on inner parts
-							arrays.colors.push_back(modulate_color);
+							const int append_index = arrays.colors.size();
+							arrays.colors.resize(arrays.colors.size() + vertex_count);
+							Color *w = arrays.colors.data() + append_index;
+							for (unsigned int i = 0; i < vertex_count; ++i) {
+								w[i] = modulate_color;
+							}
 						}
 
 						const std::vector<int> &indices = voxel.model.indices;
 						const unsigned int index_count = indices.size();
 
-						for (unsigned int i = 0; i < index_count; ++i) {
-							arrays.indices.push_back(index_offset + indices[i]);
+						{
+							const int append_index = arrays.indices.size();
+							arrays.indices.resize(arrays.indices.size() + index_count);
+							int *w = arrays.indices.data() + append_index;
+							for (unsigned int i = 0; i < index_count; ++i) {
+								w[i] = index_offset + indices[i];
+							}
 						}
 
 						index_offset += vertex_count;
@@ -394,6 +978,122 @@ static void generate_blocky_mesh(
 			}
 		}
 	}
+
+	if (greedy_masks != nullptr) {
+		merge_cube_faces(out_arrays_per_material, index_offsets, *greedy_masks, inner_size, library,
+				baked_occlusion_darkness, transparent_surfaces);
+	}
+}
+
+// Physics only needs the outer surface of colliding voxels. Faces are culled by
+// any colliding neighbor regardless of transparency, and faces of cubes are
+// merged regardless of their type or occlusion.
+template <typename Type_T>
+static void generate_blocky_collision(std::vector<Vector3> &out_positions,
+		std::vector<int> &out_indices, std::vector<uint8_t> &colliding,
+		FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> &masks,
+		const Span<Type_T> type_buffer, const VoxelVector3i block_size,
+		const VoxelLibrary::BakedData &library, uint32_t collision_mask) {
+	ERR_FAIL_COND(
+			block_size.x < static_cast<int>(2 * VoxelMesherBlocky::PADDING) ||
+			block_size.y < static_cast<int>(2 * VoxelMesherBlocky::PADDING) ||
+			block_size.z < static_cast<int>(2 * VoxelMesherBlocky::PADDING));
+
+	const int row_size = block_size.y;
+	const int deck_size = block_size.x * row_size;
+
+	const VoxelVector3i min = VoxelVector3i(VoxelMesherBlocky::PADDING);
+	const VoxelVector3i max =
+			block_size - VoxelVector3i(VoxelMesherBlocky::PADDING);
+	const VoxelVector3i inner_size = max - min;
+
+	// Find colliding voxels first, so checking neighbors is cheap
+	colliding.resize(type_buffer.size());
+	bool any_colliding = false;
+	for (size_t i = 0; i < type_buffer.size(); ++i) {
+		const uint32_t voxel_id = type_buffer[i];
+		const bool c = voxel_id < library.models.size() && !library.models[voxel_id].empty &&
+				(library.models[voxel_id].collision_mask & collision_mask) != 0;
+		colliding[i] = c;
+		any_colliding |= c;
+	}
+	if (!any_colliding) {
+		return;
+	}
+
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		masks[side].assign(inner_size.volume(), 0);
+	}
+
+	FixedArray<int, Cube::SIDE_COUNT> side_neighbor_lut;
+	side_neighbor_lut[Cube::SIDE_LEFT] = row_size;
+	side_neighbor_lut[Cube::SIDE_RIGHT] = -row_size;
+	side_neighbor_lut[Cube::SIDE_BACK] = -deck_size;
+	side_neighbor_lut[Cube::SIDE_FRONT] = deck_size;
+	side_neighbor_lut[Cube::SIDE_BOTTOM] = -1;
+	side_neighbor_lut[Cube::SIDE_TOP] = 1;
+
+	for (int z = min.z; z < max.z; ++z) {
+		for (int x = min.x; x < max.x; ++x) {
+			for (int y = min.y; y < max.y; ++y) {
+				const int voxel_index = y + x * row_size + z * deck_size;
+				if (colliding[voxel_index] == 0) {
+					continue;
+				}
+				const Voxel::BakedData &voxel = library.models[type_buffer[voxel_index]];
+				// Subtracting 1 because the data is padded
+				const Vector3 pos(x - 1, y - 1, z - 1);
+
+				for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+					const std::vector<Vector3> &side_positions = voxel.model.side_positions[side];
+					if (side_positions.size() == 0) {
+						continue;
+					}
+
+					const int neighbor_index = voxel_index + side_neighbor_lut[side];
+					if (colliding[neighbor_index] != 0) {
+						const Voxel::BakedData &neighbor = library.models[type_buffer[neighbor_index]];
+						const unsigned int ai = voxel.model.side_pattern_indices[side];
+						const unsigned int bi = neighbor.model.side_pattern_indices[g_opposite_side[side]];
+						if (ai == bi || library.get_side_pattern_occlusion(bi, ai)) {
+							continue;
+						}
+					}
+
+					if (voxel.cube) {
+						const int mask_index = (y - min.y) + (x - min.x) * inner_size.y +
+								(z - min.z) * inner_size.x * inner_size.y;
+						masks[side][mask_index] = 1;
+						continue;
+					}
+
+					const int index_offset = out_positions.size();
+					for (unsigned int i = 0; i < side_positions.size(); ++i) {
+						out_positions.push_back(side_positions[i] + pos);
+					}
+					const std::vector<int> &side_indices = voxel.model.side_indices[side];
+					for (unsigned int i = 0; i < side_indices.size(); ++i) {
+						out_indices.push_back(index_offset + side_indices[i]);
+					}
+				}
+
+				// Inside
+				const std::vector<Vector3> &positions = voxel.model.positions;
+				if (positions.size() != 0) {
+					const int index_offset = out_positions.size();
+					for (unsigned int i = 0; i < positions.size(); ++i) {
+						out_positions.push_back(positions[i] + pos);
+					}
+					const std::vector<int> &indices = voxel.model.indices;
+					for (unsigned int i = 0; i < indices.size(); ++i) {
+						out_indices.push_back(index_offset + indices[i]);
+					}
+				}
+			}
+		}
+	}
+
+	merge_collision_faces(out_positions, out_indices, masks, inner_size);
 }
 
 thread_local VoxelMesherBlocky::Cache VoxelMesherBlocky::_cache;
@@ -434,6 +1134,48 @@ bool VoxelMesherBlocky::get_occlusion_enabled() const {
 	return _parameters.bake_occlusion;
 }
 
+void VoxelMesherBlocky::set_greedy_meshing_enabled(bool enable) {
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.greedy_meshing = enable;
+}
+
+bool VoxelMesherBlocky::is_greedy_meshing_enabled() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.greedy_meshing;
+}
+
+void VoxelMesherBlocky::set_transparent_surfaces_enabled(bool enable) {
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.transparent_surfaces = enable;
+}
+
+bool VoxelMesherBlocky::are_transparent_surfaces_enabled() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.transparent_surfaces;
+}
+
+void VoxelMesherBlocky::set_transparent_sorting(TransparentSorting sorting) {
+	ERR_FAIL_INDEX(sorting, TRANSPARENT_SORTING_MAX);
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.transparent_sorting = sorting;
+}
+
+VoxelMesherBlocky::TransparentSorting VoxelMesherBlocky::get_transparent_sorting() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.transparent_sorting;
+}
+
+void VoxelMesherBlocky::set_transparent_sort_direction(Vector3 direction) {
+	ERR_FAIL_COND(direction.is_zero_approx());
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.transparent_sort_direction = direction.normalized();
+}
+
+Vector3 VoxelMesherBlocky::get_transparent_sort_direction() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.transparent_sort_direction;
+}
+
 void VoxelMesherBlocky::build(VoxelMesher::Output &output,
 		const VoxelMesher::Input &input) {
 	const int channel = VoxelBuffer::CHANNEL_TYPE;
@@ -458,13 +1200,19 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output,
 	}
 
 	// The technique is Culled faces.
-	// Could be improved with greedy meshing:
-	// https://0fps.net/2012/06/30/meshing-in-a-minecraft-game/ However I don't
-	// feel it's worth it yet:
+	// Faces of cubes can optionally be merged with greedy meshing:
+	// https://0fps.net/2012/06/30/meshing-in-a-minecraft-game/
+	// It is not the default because:
 	// - Not so much gain for organic worlds with lots of texture variations
 	// - Works well with cubes but not with any shape
-	// - Slower
-	// => Could be implemented in a separate class?
+	// - Requires a shader to repeat tiles
+
+	// We can only access baked data. Only this data is made for multithreaded
+	// access. Holding the snapshot keeps it valid even if the library gets baked
+	// again in the meantime, no lock is needed.
+	const std::shared_ptr<const VoxelLibrary::BakedData> library_baked_data_ref =
+			params.library->get_baked_data();
+	const VoxelLibrary::BakedData &library_baked_data = *library_baked_data_ref;
 
 	const VoxelBuffer &voxels = input.voxels;
 #ifdef TOOLS_ENABLED
@@ -481,74 +1229,86 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output,
 	// allocated). That means we can use raw pointers to voxel data inside instead
 	// of using the higher-level getters, and then save a lot of time.
 
+	const VoxelVector3i block_size = voxels.get_size();
+	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
+
 	if (voxels.get_channel_compression(channel) ==
 			VoxelBuffer::COMPRESSION_UNIFORM) {
 		// All voxels have the same type.
-		// If it's all air, nothing to do. If it's all cubes, nothing to do either.
-		// TODO Handle edge case of uniform block with non-cubic voxels!
-		// If the type of voxel still produces geometry in this situation (which is
-		// an absurd use case but not an error), decompress into a backing array to
-		// still allow the use of the same algorithm.
-		return;
-
-	} else if (voxels.get_channel_compression(channel) !=
-			VoxelBuffer::COMPRESSION_NONE) {
-		// No other form of compression is allowed
-		ERR_PRINT("VoxelMesherBlocky received unsupported voxel compression");
-		return;
+		// If it's all air, nothing to do. If it's all voxels hiding each other
+		// without inner geometry, nothing to do either.
+		const uint64_t voxel_id = voxels.get_voxel(0, 0, 0, channel);
+		if (voxel_id >= library_baked_data.voxel_flags.size()) {
+			return;
+		}
+		if ((library_baked_data.voxel_flags[voxel_id] & VoxelLibrary::BakedData::FLAG_EMPTY) ||
+				library_baked_data.hidden_when_enclosed[voxel_id]) {
+			return;
+		}
+		// The type of voxel still produces geometry in this situation (which is
+		// an unusual use case but not an error)
 	}
 
 	Span<uint8_t> raw_channel;
-	if (!voxels.get_channel_raw(channel, raw_channel)) {
-		/*       _
-		//      | \
-		//     /\ \\
-		//    / /|\\\
-		//    | |\ \\\
-		//    | \_\ \\|
-		//    |    |  )
-		//     \   |  |
-		//      \    /
-		*/
-		// Case supposedly handled before...
-		ERR_PRINT("Something wrong happened");
+	if (!get_dense_type_channel(voxels, cache.uniform_channel, raw_channel)) {
 		return;
 	}
 
-	const VoxelVector3i block_size = voxels.get_size();
-	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
-
-	{
-		// We can only access baked data. Only this data is made for multithreaded
-		// access.
-		RWLockRead lock(params.library->get_baked_data_rw_lock());
-		const VoxelLibrary::BakedData &library_baked_data =
-				params.library->get_baked_data();
-
-		switch (channel_depth) {
-			case VoxelBuffer::DEPTH_8_BIT:
-				generate_blocky_mesh(cache.arrays_per_material, raw_channel, block_size,
-						library_baked_data, params.bake_occlusion,
-						baked_occlusion_darkness);
-				break;
+	FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> *greedy_masks =
+			params.greedy_meshing ? &cache.greedy_masks : nullptr;
+
+	switch (channel_depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			generate_blocky_mesh(cache.arrays_per_material, cache.voxel_flags,
+					cache.ao_masks, cache.ao_masks_tmp, cache.deck_mask,
+					cache.deck_non_empty_counts, cache.deck_opaque_counts, greedy_masks, raw_channel, block_size,
+					library_baked_data, params.bake_occlusion,
+					baked_occlusion_darkness, params.transparent_surfaces);
+			break;
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			generate_blocky_mesh(cache.arrays_per_material, cache.voxel_flags,
+					cache.ao_masks, cache.ao_masks_tmp, cache.deck_mask,
+					cache.deck_non_empty_counts, cache.deck_opaque_counts, greedy_masks,
+					raw_channel.reinterpret_cast_to<uint16_t>(),
+					block_size, library_baked_data,
+					params.bake_occlusion, baked_occlusion_darkness, params.transparent_surfaces);
+			break;
+
+		case VoxelBuffer::DEPTH_32_BIT:
+			generate_blocky_mesh(cache.arrays_per_material, cache.voxel_flags,
+					cache.ao_masks, cache.ao_masks_tmp, cache.deck_mask,
+					cache.deck_non_empty_counts, cache.deck_opaque_counts, greedy_masks,
+					raw_channel.reinterpret_cast_to<uint32_t>(),
+					block_size, library_baked_data,
+					params.bake_occlusion, baked_occlusion_darkness, params.transparent_surfaces);
+			break;
+
+		default:
+			ERR_PRINT("Unsupported voxel depth");
+			return;
+	}
 
-			case VoxelBuffer::DEPTH_16_BIT:
-				generate_blocky_mesh(cache.arrays_per_material,
-						raw_channel.reinterpret_cast_to<uint16_t>(),
-						block_size, library_baked_data,
-						params.bake_occlusion, baked_occlusion_darkness);
-				break;
+	const unsigned int surface_count = params.transparent_surfaces ? MAX_SURFACES : MAX_MATERIALS;
 
-			default:
-				ERR_PRINT("Unsupported voxel depth");
-				return;
+	if (params.transparent_surfaces &&
+			params.transparent_sorting != TRANSPARENT_SORTING_NONE) {
+		VOXEL_PROFILE_SCOPE_NAMED("Sort transparent triangles");
+		for (unsigned int i = MAX_MATERIALS; i < MAX_SURFACES; ++i) {
+			Arrays &arrays = cache.arrays_per_material[i];
+			if (arrays.indices.size() == 0) {
+				continue;
+			}
+			sort_triangles(arrays, params.transparent_sorting, params.transparent_sort_direction,
+					cache.sorted_triangles, cache.sorted_indices);
+			output.ordered_surfaces_mask |= uint64_t(1) << i;
 		}
 	}
 
 	// TODO We could return a single byte array and use Mesh::add_surface down the
 	// line?
 
-	for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+	for (unsigned int i = 0; i < surface_count; ++i) {
 		const Arrays &arrays = cache.arrays_per_material[i];
 		if (arrays.positions.size() != 0) {
 			Array mesh_arrays;
@@ -577,6 +1337,18 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output,
 					raw_copy_to(tangents, arrays.tangents);
 					mesh_arrays[Mesh::ARRAY_TANGENT] = tangents;
 				}
+				if (params.greedy_meshing) {
+					// Merged faces come last. Others have no tile to repeat.
+					Vector<Vector2> uv2s;
+					uv2s.resize(arrays.positions.size());
+					Vector2 *w = uv2s.ptrw();
+					const unsigned int unmerged_count = arrays.positions.size() - arrays.uv2s.size();
+					for (unsigned int j = 0; j < unmerged_count; ++j) {
+						w[j] = Vector2(-1, -1);
+					}
+					memcpy(w + unmerged_count, arrays.uv2s.data(), arrays.uv2s.size() * sizeof(Vector2));
+					mesh_arrays[Mesh::ARRAY_TEX_UV2] = uv2s;
+				}
 			}
 
 			output.surfaces.push_back(mesh_arrays);
@@ -590,6 +1362,74 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output,
 	output.primitive_type = Mesh::PRIMITIVE_TRIANGLES;
 }
 
+void VoxelMesherBlocky::build_collision(CollisionOutput &output, const Input &input,
+		uint32_t collision_mask) {
+	const int channel = VoxelBuffer::CHANNEL_TYPE;
+	Ref<VoxelLibrary> library = get_library();
+	ERR_FAIL_COND(library.is_null());
+
+	const std::shared_ptr<const VoxelLibrary::BakedData> library_baked_data_ref =
+			library->get_baked_data();
+	const VoxelLibrary::BakedData &library_baked_data = *library_baked_data_ref;
+
+	const VoxelBuffer &voxels = input.voxels;
+	const VoxelVector3i block_size = voxels.get_size();
+	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
+
+	if (voxels.get_channel_compression(channel) ==
+			VoxelBuffer::COMPRESSION_UNIFORM) {
+		// Either nothing collides, or everything does and cubes hide each other
+		const uint64_t voxel_id = voxels.get_voxel(0, 0, 0, channel);
+		if (voxel_id >= library_baked_data.models.size()) {
+			return;
+		}
+		const Voxel::BakedData &voxel = library_baked_data.models[voxel_id];
+		if (voxel.empty || voxel.cube || (voxel.collision_mask & collision_mask) == 0) {
+			return;
+		}
+	}
+
+	Cache &cache = _cache;
+	Span<uint8_t> raw_channel;
+	if (!get_dense_type_channel(voxels, cache.uniform_channel, raw_channel)) {
+		return;
+	}
+
+	std::vector<Vector3> &positions = cache.collision_positions;
+	std::vector<int> &indices = cache.collision_indices;
+	positions.clear();
+	indices.clear();
+
+	// Voxel flags are not used for collision, their buffer marks colliding voxels
+	// instead
+
+	switch (channel_depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			generate_blocky_collision(positions, indices, cache.voxel_flags, cache.greedy_masks,
+					raw_channel, block_size, library_baked_data, collision_mask);
+			break;
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			generate_blocky_collision(positions, indices, cache.voxel_flags, cache.greedy_masks,
+					raw_channel.reinterpret_cast_to<uint16_t>(), block_size, library_baked_data,
+					collision_mask);
+			break;
+
+		case VoxelBuffer::DEPTH_32_BIT:
+			generate_blocky_collision(positions, indices, cache.voxel_flags, cache.greedy_masks,
+					raw_channel.reinterpret_cast_to<uint32_t>(), block_size, library_baked_data,
+					collision_mask);
+			break;
+
+		default:
+			ERR_PRINT("Unsupported voxel depth");
+			return;
+	}
+
+	raw_copy_to(output.positions, positions);
+	raw_copy_to(output.indices, indices);
+}
+
 Ref<Resource> VoxelMesherBlocky::duplicate(bool p_subresources) const {
 	Parameters params;
 	{
@@ -603,9 +1443,35 @@ Ref<Resource> VoxelMesherBlocky::duplicate(bool p_subresources) const {
 
 	VoxelMesherBlocky *c = memnew(VoxelMesherBlocky);
 	c->_parameters = params;
+	copy_base_properties_to(*c);
 	return c;
 }
 
+uint64_t VoxelMesherBlocky::get_parameters_hash() const {
+	Parameters params;
+	{
+		RWLockRead rlock(_parameters_lock);
+		params = _parameters;
+	}
+	if (params.library.is_null()) {
+		return 0;
+	}
+
+	uint64_t h = hash_value_64(params.bake_occlusion);
+	h = hash_value_64(params.baked_occlusion_darkness, h);
+	h = hash_value_64(params.greedy_meshing, h);
+	h = hash_value_64(params.transparent_surfaces, h);
+	h = hash_value_64(params.transparent_sorting, h);
+	h = hash_value_64(params.transparent_sort_direction, h);
+	// Identify the library by instance and by bake, so changes to its voxel
+	// types don't return outdated meshes
+	h = hash_value_64(uint64_t(params.library->get_instance_id()), h);
+	h = hash_value_64(params.library->get_baked_data()->version, h);
+
+	// Zero means "not cacheable"
+	return h != 0 ? h : 1;
+}
+
 int VoxelMesherBlocky::get_used_channels_mask() const {
 	return (1 << VoxelBuffer::CHANNEL_TYPE);
 }
@@ -626,6 +1492,26 @@ void VoxelMesherBlocky::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_occlusion_darkness"),
 			&VoxelMesherBlocky::get_occlusion_darkness);
 
+	ClassDB::bind_method(D_METHOD("set_greedy_meshing_enabled", "enable"),
+			&VoxelMesherBlocky::set_greedy_meshing_enabled);
+	ClassDB::bind_method(D_METHOD("is_greedy_meshing_enabled"),
+			&VoxelMesherBlocky::is_greedy_meshing_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_transparent_surfaces_enabled", "enable"),
+			&VoxelMesherBlocky::set_transparent_surfaces_enabled);
+	ClassDB::bind_method(D_METHOD("are_transparent_surfaces_enabled"),
+			&VoxelMesherBlocky::are_transparent_surfaces_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_transparent_sorting", "sorting"),
+			&VoxelMesherBlocky::set_transparent_sorting);
+	ClassDB::bind_method(D_METHOD("get_transparent_sorting"),
+			&VoxelMesherBlocky::get_transparent_sorting);
+
+	ClassDB::bind_method(D_METHOD("set_transparent_sort_direction", "direction"),
+			&VoxelMesherBlocky::set_transparent_sort_direction);
+	ClassDB::bind_method(D_METHOD("get_transparent_sort_direction"),
+			&VoxelMesherBlocky::get_transparent_sort_direction);
+
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "library",
 						 PROPERTY_HINT_RESOURCE_TYPE, "VoxelLibrary"),
 			"set_library", "get_library");
@@ -634,4 +1520,21 @@ void VoxelMesherBlocky::_bind_methods() {
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "occlusion_darkness",
 						 PROPERTY_HINT_RANGE, "0,1,0.01"),
 			"set_occlusion_darkness", "get_occlusion_darkness");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "greedy_meshing_enabled"),
+			"set_greedy_meshing_enabled", "is_greedy_meshing_enabled");
+
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "transparent_surfaces_enabled"),
+			"set_transparent_surfaces_enabled", "are_transparent_surfaces_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "transparent_sorting", PROPERTY_HINT_ENUM,
+						 "None,Direction,Sides"),
+			"set_transparent_sorting", "get_transparent_sorting");
+	ADD_PROPERTY(PropertyInfo(Variant::VECTOR3, "transparent_sort_direction"),
+			"set_transparent_sort_direction", "get_transparent_sort_direction");
+
+	BIND_ENUM_CONSTANT(TRANSPARENT_SORTING_NONE);
+	BIND_ENUM_CONSTANT(TRANSPARENT_SORTING_DIRECTION);
+	BIND_ENUM_CONSTANT(TRANSPARENT_SORTING_SIDES);
+	BIND_ENUM_CONSTANT(TRANSPARENT_SORTING_MAX);
+
+	BIND_CONSTANT(MAX_MATERIALS);
 }
@@ -46,8 +46,21 @@ class VoxelMesherBlocky : public VoxelMesher {
 
 public:
 	static const unsigned int MAX_MATERIALS = 8; // Arbitrary. Tweak if needed.
+	// Transparent voxels can have their own surfaces, after opaque ones
+	static const unsigned int MAX_SURFACES = 2 * MAX_MATERIALS;
 	static const int PADDING = 1;
 
+	enum TransparentSorting {
+		// Triangles keep the order in which voxels were visited
+		TRANSPARENT_SORTING_NONE = 0,
+		// Back to front, for a camera looking along the sort direction
+		TRANSPARENT_SORTING_DIRECTION,
+		// Grouped by the side they face, each group back to front as seen from
+		// the side it faces. Order of the groups follows `Voxel::Side`.
+		TRANSPARENT_SORTING_SIDES,
+		TRANSPARENT_SORTING_MAX
+	};
+
 	VoxelMesherBlocky();
 	~VoxelMesherBlocky();
 
@@ -60,9 +73,32 @@ public:
 	void set_occlusion_enabled(bool enable);
 	bool get_occlusion_enabled() const;
 
+	// When enabled, faces of cube voxels sharing the same type and occlusion are
+	// merged into larger quads. Their texture has to be repeated by a shader,
+	// using UV2 as the origin of the tile in the atlas.
+	void set_greedy_meshing_enabled(bool enable);
+	bool is_greedy_meshing_enabled() const;
+
+	// When enabled, faces of voxels having a transparency index go to surface
+	// `MAX_MATERIALS + material_id` instead of `material_id`, so they can be
+	// drawn after opaque geometry, in a specific order.
+	void set_transparent_surfaces_enabled(bool enable);
+	bool are_transparent_surfaces_enabled() const;
+
+	void set_transparent_sorting(TransparentSorting sorting);
+	TransparentSorting get_transparent_sorting() const;
+
+	void set_transparent_sort_direction(Vector3 direction);
+	Vector3 get_transparent_sort_direction() const;
+
 	void build(VoxelMesher::Output &output,
 			const VoxelMesher::Input &input) override;
 
+	// Uses geometry of colliding voxel models. Faces of cubes are merged as much
+	// as possible, regardless of their type.
+	void build_collision(CollisionOutput &output, const Input &input,
+			uint32_t collision_mask) override;
+
 	Ref<Resource> duplicate(bool p_subresources = false) const override;
 	int get_used_channels_mask() const override;
 
@@ -77,6 +113,8 @@ public:
 		std::vector<Color> colors;
 		std::vector<int> indices;
 		std::vector<float> tangents;
+		// Only for merged faces, which are appended last
+		std::vector<Vector2> uv2s;
 
 		void clear() {
 			positions.clear();
@@ -85,21 +123,58 @@ public:
 			colors.clear();
 			indices.clear();
 			tangents.clear();
+			uv2s.clear();
+		}
+	};
+
+	// Sort key of a triangle in a transparent surface
+	struct SortedTriangle {
+		uint32_t group;
+		float depth;
+		uint32_t index;
+
+		inline bool operator<(const SortedTriangle &other) const {
+			return group != other.group ? group < other.group : depth < other.depth;
 		}
 	};
 
 protected:
 	static void _bind_methods();
 
+	uint64_t get_parameters_hash() const override;
+
 private:
 	struct Parameters {
 		float baked_occlusion_darkness = 0.8;
 		bool bake_occlusion = true;
+		bool greedy_meshing = false;
+		bool transparent_surfaces = false;
+		TransparentSorting transparent_sorting = TRANSPARENT_SORTING_DIRECTION;
+		Vector3 transparent_sort_direction = Vector3(0, 0, -1);
 		Ref<VoxelLibrary> library;
 	};
 
 	struct Cache {
-		FixedArray<Arrays, MAX_MATERIALS> arrays_per_material;
+		FixedArray<Arrays, MAX_SURFACES> arrays_per_material;
+		// Library flags of each voxel in the block
+		std::vector<uint8_t> voxel_flags;
+		// Neighbors of each voxel contributing to ambient occlusion
+		std::vector<uint32_t> ao_masks;
+		std::vector<uint32_t> ao_masks_tmp;
+		// Which decks of the block can produce geometry
+		std::vector<uint8_t> deck_mask;
+		std::vector<uint32_t> deck_non_empty_counts;
+		std::vector<uint32_t> deck_opaque_counts;
+		// Decompressed copy of uniform blocks that still need meshing
+		std::vector<uint8_t> uniform_channel;
+		// Cube faces waiting to be merged, for each side
+		FixedArray<std::vector<uint32_t>, Cube::SIDE_COUNT> greedy_masks;
+		// Used to reorder triangles of transparent surfaces
+		std::vector<SortedTriangle> sorted_triangles;
+		std::vector<int> sorted_indices;
+		// Collision geometry before it gets copied to the output
+		std::vector<Vector3> collision_positions;
+		std::vector<int> collision_indices;
 	};
 
 	// Parameters
@@ -110,4 +185,6 @@ private:
 	static thread_local Cache _cache;
 };
 
+VARIANT_ENUM_CAST(VoxelMesherBlocky::TransparentSorting)
+
 #endif // VOXEL_MESHER_BLOCKY_H
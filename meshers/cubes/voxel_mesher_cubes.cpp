@@ -31,6 +31,7 @@
 #include "voxel_mesher_cubes.h"
 #include "../../storage/voxel_buffer.h"
 #include "../../util/funcs.h"
+#include "../../util/math/funcs.h"
 #include "../../util/profiling.h"
 #include "core/math/geometry_2d.h"
 #include "scene/resources/surface_tool.h"
@@ -65,6 +66,31 @@ const uint8_t g_indices_lut[3][2][6] = {
 	}
 };
 
+// Same as above, but quads are split along the other diagonal
+const uint8_t g_flipped_indices_lut[3][2][6] = {
+	// X
+	{
+			// Front
+			{ 0, 1, 2, 1, 3, 2 },
+			// Back
+			{ 0, 2, 1, 1, 2, 3 },
+	},
+	// Y
+	{
+			// Front
+			{ 0, 2, 1, 1, 2, 3 },
+			// Back
+			{ 0, 1, 2, 1, 3, 2 },
+	},
+	// Z
+	{
+			// Front
+			{ 0, 1, 2, 1, 3, 2 },
+			// Back
+			{ 0, 2, 1, 1, 2, 3 },
+	}
+};
+
 const uint8_t g_face_axes_lut[VoxelVector3i::AXIS_COUNT][2] = {
 	// X
 	{ VoxelVector3i::AXIS_Y, VoxelVector3i::AXIS_Z },
@@ -74,11 +100,29 @@ const uint8_t g_face_axes_lut[VoxelVector3i::AXIS_COUNT][2] = {
 	{ VoxelVector3i::AXIS_X, VoxelVector3i::AXIS_Y }
 };
 
+// Side of the block at the first and last deck along each axis
+const uint8_t g_block_side_lut[VoxelVector3i::AXIS_COUNT][2] = {
+	{ Cube::SIDE_NEGATIVE_X, Cube::SIDE_POSITIVE_X },
+	{ Cube::SIDE_NEGATIVE_Y, Cube::SIDE_POSITIVE_Y },
+	{ Cube::SIDE_NEGATIVE_Z, Cube::SIDE_POSITIVE_Z }
+};
+
 enum Side {
 	SIDE_FRONT = 0,
 	SIDE_BACK,
 	SIDE_NONE // Either means there is no face, or it was consumed
 };
+
+struct MeshingOptions {
+	// Also generate skirts on the boundaries of the block
+	bool skirts;
+	// All voxels of the block have the same value, which is the only item of
+	// the voxel buffer
+	bool uniform;
+	bool bake_occlusion;
+	// Darkening applied for each level of occlusion
+	float occlusion_darkness;
+};
 } // namespace
 
 // Returns:
@@ -89,12 +133,65 @@ inline uint8_t get_alpha_index(Color8 c) {
 	return (c.a == 0xf) + (c.a > 0);
 }
 
+// See https://0fps.net/2013/07/03/ambient-occlusion-for-minecraft-like-worlds/
+inline uint8_t get_vertex_occlusion(bool side1, bool side2, bool corner) {
+	return (side1 && side2) ? 3 : (side1 + side2 + corner);
+}
+
+// Gets occlusion levels of the 4 corners of a face, from the empty voxel in
+// front of it. Levels use 2 bits each, ordered like quad vertices:
+// 2-----3
+// |     |
+// |     |
+// 0-----1
+template <typename Voxel_T, typename Color_F>
+inline uint8_t get_face_occlusion(const Span<Voxel_T> voxel_buffer,
+		unsigned int air_voxel_index, unsigned int dx, unsigned int dy,
+		Color_F color_func) {
+	const auto is_occluder = [&voxel_buffer, &color_func](unsigned int i) {
+		return get_alpha_index(color_func(voxel_buffer[i])) != 0;
+	};
+	const unsigned int i = air_voxel_index;
+	const bool nx = is_occluder(i - dx);
+	const bool px = is_occluder(i + dx);
+	const bool ny = is_occluder(i - dy);
+	const bool py = is_occluder(i + dy);
+	const uint8_t ao0 = get_vertex_occlusion(nx, ny, is_occluder(i - dx - dy));
+	const uint8_t ao1 = get_vertex_occlusion(px, ny, is_occluder(i + dx - dy));
+	const uint8_t ao2 = get_vertex_occlusion(nx, py, is_occluder(i - dx + dy));
+	const uint8_t ao3 = get_vertex_occlusion(px, py, is_occluder(i + dx + dy));
+	return ao0 | (ao1 << 2) | (ao2 << 4) | (ao3 << 6);
+}
+
+inline const uint8_t *get_quad_indices_lut(unsigned int axis, unsigned int side,
+		uint8_t ao) {
+	// Split quads along the diagonal whose ends are the most occluded, otherwise
+	// interpolation makes shading look anisotropic. This is the rule from the
+	// article linked above, which uses light levels instead of occlusion levels:
+	// the regular split goes through vertices 0 and 3, the flipped one through
+	// 1 and 2.
+	const unsigned int ao0 = ao & 3;
+	const unsigned int ao1 = (ao >> 2) & 3;
+	const unsigned int ao2 = (ao >> 4) & 3;
+	const unsigned int ao3 = (ao >> 6) & 3;
+	if (ao0 + ao3 < ao1 + ao2) {
+		return g_flipped_indices_lut[axis][side];
+	}
+	return g_indices_lut[axis][side];
+}
+
+inline Color get_occluded_color(Color c, uint8_t ao, unsigned int vertex_index,
+		float occlusion_darkness) {
+	const float shade = 1.f - occlusion_darkness * ((ao >> (vertex_index * 2)) & 3);
+	return Color(c.r * shade, c.g * shade, c.b * shade, c.a);
+}
+
 template <typename Voxel_T, typename Color_F>
 void build_voxel_mesh_as_simple_cubes(
-		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::MATERIAL_COUNT>
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
 				&out_arrays_per_material,
 		const Span<Voxel_T> voxel_buffer, const VoxelVector3i block_size,
-		Color_F color_func) {
+		const MeshingOptions &options, Color_F color_func) {
 	ERR_FAIL_COND(
 			block_size.x < static_cast<int>(2 * VoxelMesherCubes::PADDING) ||
 			block_size.y < static_cast<int>(2 * VoxelMesherCubes::PADDING) ||
@@ -119,9 +216,11 @@ void build_voxel_mesh_as_simple_cubes(
 		const unsigned int xa = g_face_axes_lut[za][0];
 		const unsigned int ya = g_face_axes_lut[za][1];
 
+		const unsigned int first_deck = min_pos[za] - VoxelMesherCubes::PADDING;
+		const unsigned int last_deck = max_pos[za] - 1;
+
 		// For each deck
-		for (unsigned int d = min_pos[za] - VoxelMesherCubes::PADDING;
-				d < (unsigned int)max_pos[za]; ++d) {
+		for (unsigned int d = first_deck; d <= last_deck; ++d) {
 			// For each cell of the deck, gather face info
 			for (unsigned int fy = min_pos[ya]; fy < (unsigned int)max_pos[ya];
 					++fy) {
@@ -204,12 +303,29 @@ void build_voxel_mesh_as_simple_cubes(
 					arrays.positions.push_back(v2);
 					arrays.positions.push_back(v3);
 
+					uint8_t ao = 0;
+					if (options.bake_occlusion) {
+						const unsigned int air_voxel_index = side == Cube::SIDE_BACK
+								? voxel_index + neighbor_offset_d_lut[za]
+								: voxel_index;
+						ao = get_face_occlusion(voxel_buffer, air_voxel_index,
+								neighbor_offset_d_lut[xa], neighbor_offset_d_lut[ya],
+								color_func);
+					}
+
 					// TODO Any way to not need Color anywhere? It's wasteful
 					const Color colorf = color;
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
+					if (ao == 0) {
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+					} else {
+						for (unsigned int i = 0; i < 4; ++i) {
+							arrays.colors.push_back(get_occluded_color(colorf, ao, i,
+									options.occlusion_darkness));
+						}
+					}
 
 					arrays.normals.push_back(n);
 					arrays.normals.push_back(n);
@@ -219,7 +335,8 @@ void build_voxel_mesh_as_simple_cubes(
 					const unsigned int index_offset = index_offsets[material_index];
 					ERR_FAIL_INDEX(za, 3);
 					ERR_FAIL_COND(side != Cube::SIDE_BACK && side != Cube::SIDE_FRONT);
-					const uint8_t *lut = g_indices_lut[za][side == Cube::SIDE_FRONT ? 0 : 1];
+					const uint8_t *lut =
+							get_quad_indices_lut(za, side == Cube::SIDE_FRONT ? 0 : 1, ao);
 					for (unsigned int i = 0; i < 6; ++i) {
 						arrays.indices.push_back(index_offset + lut[i]);
 					}
@@ -232,10 +349,11 @@ void build_voxel_mesh_as_simple_cubes(
 
 template <typename Voxel_T, typename Color_F>
 void build_voxel_mesh_as_greedy_cubes(
-		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::MATERIAL_COUNT>
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
 				&out_arrays_per_material,
 		const Span<Voxel_T> voxel_buffer, const VoxelVector3i block_size,
-		std::vector<uint8_t> &mask_memory_pool, Color_F color_func) {
+		std::vector<uint8_t> &mask_memory_pool, const MeshingOptions &options,
+		Color_F color_func) {
 	//
 	ERR_FAIL_COND(
 			block_size.x < static_cast<int>(2 * VoxelMesherCubes::PADDING) ||
@@ -245,13 +363,15 @@ void build_voxel_mesh_as_greedy_cubes(
 	struct MaskValue {
 		Voxel_T color;
 		uint8_t side;
+		// Faces only merge if their corners have the same occlusion
+		uint8_t ao;
 
 		inline bool operator==(const MaskValue &other) const {
-			return color == other.color && side == other.side;
+			return color == other.color && side == other.side && ao == other.ao;
 		}
 
 		inline bool operator!=(const MaskValue &other) const {
-			return color != other.color || side != other.side;
+			return color != other.color || side != other.side || ao != other.ao;
 		}
 	};
 
@@ -282,9 +402,11 @@ void build_voxel_mesh_as_greedy_cubes(
 		Span<MaskValue> mask(reinterpret_cast<MaskValue *>(mask_memory_pool.data()),
 				0, mask_area);
 
+		const unsigned int first_deck = min_pos[za] - VoxelMesherCubes::PADDING;
+		const unsigned int last_deck = max_pos[za] - 1;
+
 		// For each deck
-		for (unsigned int d = min_pos[za] - VoxelMesherCubes::PADDING;
-				d < (unsigned int)max_pos[za]; ++d) {
+		for (unsigned int d = first_deck; d <= last_deck; ++d) {
 			// For each cell of the deck, gather face info
 			for (unsigned int fy = min_pos[ya]; fy < (unsigned int)max_pos[ya];
 					++fy) {
@@ -311,14 +433,26 @@ void build_voxel_mesh_as_greedy_cubes(
 					const uint8_t ai1 = get_alpha_index(color1);
 
 					MaskValue mv;
+					mv.ao = 0;
 					if (ai0 == ai1) {
 						mv.side = SIDE_NONE;
 					} else if (ai0 > ai1) {
 						mv.color = raw_color0;
 						mv.side = SIDE_BACK;
+						if (options.bake_occlusion) {
+							mv.ao = get_face_occlusion(voxel_buffer,
+									voxel_index + neighbor_offset_d_lut[za],
+									neighbor_offset_d_lut[xa], neighbor_offset_d_lut[ya],
+									color_func);
+						}
 					} else {
 						mv.color = raw_color1;
 						mv.side = SIDE_FRONT;
+						if (options.bake_occlusion) {
+							mv.ao = get_face_occlusion(voxel_buffer, voxel_index,
+									neighbor_offset_d_lut[xa], neighbor_offset_d_lut[ya],
+									color_func);
+						}
 					}
 
 					mask[(fx - VoxelMesherCubes::PADDING) +
@@ -403,10 +537,17 @@ void build_voxel_mesh_as_greedy_cubes(
 					arrays.positions.push_back(v2);
 					arrays.positions.push_back(v3);
 
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
-					arrays.colors.push_back(colorf);
+					if (m.ao == 0) {
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+						arrays.colors.push_back(colorf);
+					} else {
+						for (unsigned int i = 0; i < 4; ++i) {
+							arrays.colors.push_back(get_occluded_color(colorf, m.ao, i,
+									options.occlusion_darkness));
+						}
+					}
 
 					arrays.normals.push_back(n);
 					arrays.normals.push_back(n);
@@ -416,7 +557,7 @@ void build_voxel_mesh_as_greedy_cubes(
 					const unsigned int index_offset = index_offsets[material_index];
 					ERR_FAIL_INDEX(za, 3);
 					ERR_FAIL_INDEX(m.side, 2);
-					const uint8_t *lut = g_indices_lut[za][m.side];
+					const uint8_t *lut = get_quad_indices_lut(za, m.side, m.ao);
 					for (unsigned int i = 0; i < 6; ++i) {
 						arrays.indices.push_back(index_offset + lut[i]);
 					}
@@ -435,11 +576,12 @@ void build_voxel_mesh_as_greedy_cubes(
 
 template <typename Voxel_T, typename Color_F>
 void build_voxel_mesh_as_greedy_cubes_atlased(
-		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::MATERIAL_COUNT>
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
 				&out_arrays_per_material,
 		VoxelMesherCubes::GreedyAtlasData &out_greedy_atlas_data,
 		const Span<Voxel_T> voxel_buffer, const VoxelVector3i block_size,
-		std::vector<uint8_t> &mask_memory_pool, Color_F color_func) {
+		std::vector<uint8_t> &mask_memory_pool, const MeshingOptions &options,
+		Color_F color_func) {
 	//
 	VOXEL_PROFILE_SCOPE();
 	ERR_FAIL_COND(
@@ -450,13 +592,17 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 	struct MaskValue {
 		uint8_t side;
 		uint8_t material_index;
+		// Faces only merge if their corners have the same occlusion
+		uint8_t ao;
 
 		inline bool operator==(const MaskValue &other) const {
-			return side == other.side && material_index == other.material_index;
+			return side == other.side && material_index == other.material_index &&
+					ao == other.ao;
 		}
 
 		inline bool operator!=(const MaskValue &other) const {
-			return side != other.side || material_index != other.material_index;
+			return side != other.side || material_index != other.material_index ||
+					ao != other.ao;
 		}
 	};
 
@@ -494,9 +640,11 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 				reinterpret_cast<Color8 *>(mask_memory_pool.data() + mask_memory_size),
 				0, mask_area);
 
+		const unsigned int first_deck = min_pos[za] - VoxelMesherCubes::PADDING;
+		const unsigned int last_deck = max_pos[za] - 1;
+
 		// For each deck
-		for (unsigned int d = min_pos[za] - VoxelMesherCubes::PADDING;
-				d < (unsigned int)max_pos[za]; ++d) {
+		for (unsigned int d = first_deck; d <= last_deck; ++d) {
 			// For each cell of the deck, gather face info
 			for (unsigned int fy = min_pos[ya]; fy < (unsigned int)max_pos[ya];
 					++fy) {
@@ -523,17 +671,29 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 					const uint8_t ai1 = get_alpha_index(color1);
 
 					MaskValue mv;
+					mv.ao = 0;
 					Color8 color;
 					if (ai0 == ai1) {
 						mv.side = SIDE_NONE;
 					} else if (ai0 > ai1) {
 						color = color0;
 						mv.side = SIDE_BACK;
-						mv.material_index = color.a < 0.999f;
+						mv.material_index = color.a < 255;
+						if (options.bake_occlusion) {
+							mv.ao = get_face_occlusion(voxel_buffer,
+									voxel_index + neighbor_offset_d_lut[za],
+									neighbor_offset_d_lut[xa], neighbor_offset_d_lut[ya],
+									color_func);
+						}
 					} else {
 						color = color1;
 						mv.side = SIDE_FRONT;
-						mv.material_index = color.a < 0.999f;
+						mv.material_index = color.a < 255;
+						if (options.bake_occlusion) {
+							mv.ao = get_face_occlusion(voxel_buffer, voxel_index,
+									neighbor_offset_d_lut[xa], neighbor_offset_d_lut[ya],
+									color_func);
+						}
 					}
 
 					const unsigned int mask_index =
@@ -630,6 +790,14 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 					arrays.normals.push_back(n);
 					arrays.normals.push_back(n);
 
+					if (options.bake_occlusion) {
+						// Colors are in the atlas, vertex colors only carry occlusion
+						for (unsigned int i = 0; i < 4; ++i) {
+							arrays.colors.push_back(get_occluded_color(Color(1, 1, 1), m.ao,
+									i, options.occlusion_darkness));
+						}
+					}
+
 					image_info.size_x = rx - fx;
 					image_info.size_y = ry - fy;
 					image_info.first_color_index = out_greedy_atlas_data.colors.size();
@@ -640,7 +808,7 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 					const unsigned int index_offset = index_offsets[material_index];
 					ERR_FAIL_INDEX(za, 3);
 					ERR_FAIL_INDEX(m.side, 2);
-					const uint8_t *lut = g_indices_lut[za][m.side];
+					const uint8_t *lut = get_quad_indices_lut(za, m.side, m.ao);
 					for (unsigned int i = 0; i < 6; ++i) {
 						arrays.indices.push_back(index_offset + lut[i]);
 					}
@@ -683,6 +851,200 @@ void build_voxel_mesh_as_greedy_cubes_atlased(
 	}
 }
 
+// Adds a skirt face covering a rectangle of voxels. Skirts don't get
+// occlusion, padding voxels are considered empty.
+inline void add_skirt_face(
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
+				&out_arrays_per_material,
+		VoxelMesherCubes::GreedyAtlasData *out_greedy_atlas_data,
+		unsigned int arrays_offset, unsigned int za, uint8_t side, unsigned int d,
+		int vx0, int vy0, int size_x, int size_y, Color8 color,
+		const MeshingOptions &options) {
+	//
+	const unsigned int xa = g_face_axes_lut[za][0];
+	const unsigned int ya = g_face_axes_lut[za][1];
+
+	const uint8_t material_index = color.a < 255;
+	VoxelMesherCubes::Arrays &arrays =
+			out_arrays_per_material[arrays_offset + material_index];
+	const unsigned int index_offset = arrays.positions.size();
+
+	Vector3 v0;
+	v0[xa] = vx0;
+	v0[ya] = vy0;
+	v0[za] = d;
+
+	Vector3 v1;
+	v1[xa] = vx0 + size_x;
+	v1[ya] = vy0;
+	v1[za] = d;
+
+	Vector3 v2;
+	v2[xa] = vx0;
+	v2[ya] = vy0 + size_y;
+	v2[za] = d;
+
+	Vector3 v3;
+	v3[xa] = vx0 + size_x;
+	v3[ya] = vy0 + size_y;
+	v3[za] = d;
+
+	Vector3 n;
+	n[za] = side == SIDE_FRONT ? -1 : 1;
+
+	arrays.positions.push_back(v0);
+	arrays.positions.push_back(v1);
+	arrays.positions.push_back(v2);
+	arrays.positions.push_back(v3);
+
+	arrays.normals.push_back(n);
+	arrays.normals.push_back(n);
+	arrays.normals.push_back(n);
+	arrays.normals.push_back(n);
+
+	if (out_greedy_atlas_data != nullptr) {
+		// The face has a single color, so one pixel of the atlas is enough
+		VoxelMesherCubes::GreedyAtlasData::ImageInfo image_info;
+		image_info.first_vertex_index = arrays.uvs.size();
+		arrays.uvs.resize(arrays.uvs.size() + 4);
+		image_info.size_x = 1;
+		image_info.size_y = 1;
+		image_info.first_color_index = out_greedy_atlas_data->colors.size();
+		image_info.surface_index = arrays_offset + material_index;
+		out_greedy_atlas_data->colors.push_back(color);
+		out_greedy_atlas_data->images.push_back(image_info);
+
+		if (options.bake_occlusion) {
+			for (unsigned int i = 0; i < 4; ++i) {
+				arrays.colors.push_back(Color(1, 1, 1));
+			}
+		}
+	} else {
+		const Color colorf = color;
+		arrays.colors.push_back(colorf);
+		arrays.colors.push_back(colorf);
+		arrays.colors.push_back(colorf);
+		arrays.colors.push_back(colorf);
+	}
+
+	const uint8_t *lut = g_indices_lut[za][side];
+	for (unsigned int i = 0; i < 6; ++i) {
+		arrays.indices.push_back(index_offset + lut[i]);
+	}
+}
+
+// Generates faces on the boundaries of the block as if padding voxels were
+// empty, where regular meshing doesn't already have one. They go to the skirt
+// arrays of the side they are on, so they can be shown only against neighbors
+// meshed at a different LOD.
+template <typename Voxel_T, typename Color_F>
+void build_voxel_mesh_skirts(
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
+				&out_arrays_per_material,
+		VoxelMesherCubes::GreedyAtlasData *out_greedy_atlas_data,
+		const Span<Voxel_T> voxel_buffer, const VoxelVector3i block_size,
+		const MeshingOptions &options, Color_F color_func) {
+	//
+	const VoxelVector3i min_pos = VoxelVector3i(VoxelMesherCubes::PADDING);
+	const VoxelVector3i max_pos =
+			block_size - VoxelVector3i(VoxelMesherCubes::PADDING);
+	const unsigned int row_size = block_size.y;
+	const unsigned int deck_size = block_size.x * row_size;
+
+	// Note: voxel buffers are indexed in ZXY order
+	FixedArray<uint32_t, VoxelVector3i::AXIS_COUNT> neighbor_offset_d_lut;
+	neighbor_offset_d_lut[VoxelVector3i::AXIS_X] = block_size.y;
+	neighbor_offset_d_lut[VoxelVector3i::AXIS_Y] = 1;
+	neighbor_offset_d_lut[VoxelVector3i::AXIS_Z] = block_size.x * block_size.y;
+
+	// For each axis
+	for (unsigned int za = 0; za < VoxelVector3i::AXIS_COUNT; ++za) {
+		const unsigned int xa = g_face_axes_lut[za][0];
+		const unsigned int ya = g_face_axes_lut[za][1];
+
+		// For the first and last deck, which are between padding and voxels
+		for (unsigned int end = 0; end < 2; ++end) {
+			const unsigned int d = end == 0
+					? min_pos[za] - VoxelMesherCubes::PADDING
+					: max_pos[za] - 1;
+			const unsigned int arrays_offset =
+					VoxelMesherCubes::MATERIAL_COUNT * (1 + g_block_side_lut[za][end]);
+			// Faces point out of the block
+			const uint8_t side = end == 0 ? SIDE_FRONT : SIDE_BACK;
+
+			for (unsigned int fy = min_pos[ya]; fy < (unsigned int)max_pos[ya];
+					++fy) {
+				for (unsigned int fx = min_pos[xa]; fx < (unsigned int)max_pos[xa];
+						++fx) {
+					FixedArray<unsigned int, VoxelVector3i::AXIS_COUNT> pos;
+					pos[xa] = fx;
+					pos[ya] = fy;
+					pos[za] = d;
+
+					const unsigned int voxel_index =
+							pos[VoxelVector3i::AXIS_Y] +
+							pos[VoxelVector3i::AXIS_X] * row_size +
+							pos[VoxelVector3i::AXIS_Z] * deck_size;
+					const unsigned int next_voxel_index =
+							voxel_index + neighbor_offset_d_lut[za];
+
+					const Color8 color = color_func(
+							voxel_buffer[end == 0 ? next_voxel_index : voxel_index]);
+					const Color8 padding_color = color_func(
+							voxel_buffer[end == 0 ? voxel_index : next_voxel_index]);
+
+					const uint8_t ai = get_alpha_index(color);
+					// If the voxel is more opaque than the padding one, regular meshing
+					// already made that face
+					if (ai == 0 || ai > get_alpha_index(padding_color)) {
+						continue;
+					}
+
+					add_skirt_face(out_arrays_per_material, out_greedy_atlas_data,
+							arrays_offset, za, side, d, fx - VoxelMesherCubes::PADDING,
+							fy - VoxelMesherCubes::PADDING, 1, 1, color, options);
+				}
+			}
+		}
+	}
+}
+
+// Skirts of a block where all voxels have the same value: one face covering
+// each side of the block, unless the voxels are empty.
+template <typename Color_F>
+void build_uniform_voxel_mesh_skirts(
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
+				&out_arrays_per_material,
+		VoxelMesherCubes::GreedyAtlasData *out_greedy_atlas_data,
+		uint64_t voxel, const VoxelVector3i block_size,
+		const MeshingOptions &options, Color_F color_func) {
+	//
+	const Color8 color = color_func(voxel);
+	if (get_alpha_index(color) == 0) {
+		return;
+	}
+
+	const VoxelVector3i size =
+			block_size - VoxelVector3i(2 * VoxelMesherCubes::PADDING);
+
+	for (unsigned int za = 0; za < VoxelVector3i::AXIS_COUNT; ++za) {
+		const unsigned int xa = g_face_axes_lut[za][0];
+		const unsigned int ya = g_face_axes_lut[za][1];
+
+		for (unsigned int end = 0; end < 2; ++end) {
+			const unsigned int arrays_offset =
+					VoxelMesherCubes::MATERIAL_COUNT * (1 + g_block_side_lut[za][end]);
+			// Faces point out of the block
+			const uint8_t side = end == 0 ? SIDE_FRONT : SIDE_BACK;
+			const unsigned int d = end == 0 ? 0 : size[za];
+
+			add_skirt_face(out_arrays_per_material, out_greedy_atlas_data,
+					arrays_offset, za, side, d, 0, 0, size[xa], size[ya], color,
+					options);
+		}
+	}
+}
+
 static Ref<Image>
 make_greedy_atlas(const VoxelMesherCubes::GreedyAtlasData &atlas_data,
 		Span<VoxelMesherCubes::Arrays> surfaces) {
@@ -775,6 +1137,112 @@ make_greedy_atlas(const VoxelMesherCubes::GreedyAtlasData &atlas_data,
 	return image;
 }
 
+// Picks the meshing algorithm matching the given options.
+// Returns the atlas image if colors were stored in a texture.
+template <typename Voxel_T, typename Color_F>
+static Ref<Image> build_voxel_mesh(
+		FixedArray<VoxelMesherCubes::Arrays, VoxelMesherCubes::ARRAYS_COUNT>
+				&out_arrays_per_material,
+		VoxelMesherCubes::GreedyAtlasData &greedy_atlas_data,
+		std::vector<uint8_t> &mask_memory_pool, const Span<Voxel_T> voxel_buffer,
+		const VoxelVector3i block_size, bool greedy_meshing,
+		bool store_colors_in_texture, const MeshingOptions &options,
+		Color_F color_func) {
+	//
+	if (options.uniform) {
+		// There are no faces inside the block, only skirts
+		if (!options.skirts) {
+			return Ref<Image>();
+		}
+		if (!greedy_meshing || !store_colors_in_texture) {
+			build_uniform_voxel_mesh_skirts(out_arrays_per_material, nullptr,
+					voxel_buffer[0], block_size, options, color_func);
+			return Ref<Image>();
+		}
+		greedy_atlas_data.clear();
+		build_uniform_voxel_mesh_skirts(out_arrays_per_material,
+				&greedy_atlas_data, voxel_buffer[0], block_size, options, color_func);
+		if (greedy_atlas_data.images.size() == 0) {
+			return Ref<Image>();
+		}
+		return make_greedy_atlas(greedy_atlas_data, to_span(out_arrays_per_material));
+	}
+
+	if (!greedy_meshing) {
+		build_voxel_mesh_as_simple_cubes(out_arrays_per_material, voxel_buffer,
+				block_size, options, color_func);
+		if (options.skirts) {
+			build_voxel_mesh_skirts(out_arrays_per_material, nullptr, voxel_buffer,
+					block_size, options, color_func);
+		}
+		return Ref<Image>();
+	}
+
+	if (!store_colors_in_texture) {
+		build_voxel_mesh_as_greedy_cubes(out_arrays_per_material, voxel_buffer,
+				block_size, mask_memory_pool, options, color_func);
+		if (options.skirts) {
+			build_voxel_mesh_skirts(out_arrays_per_material, nullptr, voxel_buffer,
+					block_size, options, color_func);
+		}
+		return Ref<Image>();
+	}
+
+	// Colors go to a texture, so quads can be merged regardless of their colors
+	build_voxel_mesh_as_greedy_cubes_atlased(out_arrays_per_material,
+			greedy_atlas_data, voxel_buffer, block_size, mask_memory_pool, options,
+			color_func);
+	if (options.skirts) {
+		build_voxel_mesh_skirts(out_arrays_per_material, &greedy_atlas_data,
+				voxel_buffer, block_size, options, color_func);
+	}
+	if (greedy_atlas_data.images.size() == 0) {
+		// No visible faces
+		return Ref<Image>();
+	}
+	return make_greedy_atlas(greedy_atlas_data, to_span(out_arrays_per_material));
+}
+
+// Returns an empty array if there is no geometry
+static Array make_surface(const VoxelMesherCubes::Arrays &arrays) {
+	if (arrays.positions.size() == 0) {
+		return Array();
+	}
+
+	Array mesh_arrays;
+	mesh_arrays.resize(Mesh::ARRAY_MAX);
+
+	{
+		Vector<Vector3> positions;
+		Vector<Vector3> normals;
+		Vector<int> indices;
+
+		raw_copy_to(positions, arrays.positions);
+		raw_copy_to(normals, arrays.normals);
+		raw_copy_to(indices, arrays.indices);
+
+		mesh_arrays[Mesh::ARRAY_VERTEX] = positions;
+		mesh_arrays[Mesh::ARRAY_NORMAL] = normals;
+		mesh_arrays[Mesh::ARRAY_INDEX] = indices;
+
+		if (arrays.colors.size() > 0) {
+			Vector<Color> colors;
+			raw_copy_to(colors, arrays.colors);
+			mesh_arrays[Mesh::ARRAY_COLOR] = colors;
+		}
+		if (arrays.uvs.size() > 0) {
+			Vector<Vector2> uvs;
+			raw_copy_to(uvs, arrays.uvs);
+			mesh_arrays[Mesh::ARRAY_TEX_UV] = uvs;
+		}
+	}
+	Ref<SurfaceTool> st;
+	st.instantiate();
+	st->create_from_triangle_arrays(mesh_arrays);
+	st->index();
+	return st->commit_to_arrays();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 thread_local VoxelMesherCubes::Cache VoxelMesherCubes::_cache;
@@ -797,11 +1265,7 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 	}
 
 	const VoxelBuffer &voxels = input.voxels;
-#ifdef TOOLS_ENABLED
-	if (input.lod != 0) {
-		WARN_PRINT("VoxelMesherCubes received lod != 0, it is not supported");
-	}
-#endif
+	ERR_FAIL_COND(input.lod < 0 || input.lod >= 32);
 
 	// Iterate 3D padded data to extract voxel faces.
 	// This is the most intensive job in this class, so all required data should
@@ -811,35 +1275,68 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 	// allocated). That means we can use raw pointers to voxel data inside instead
 	// of using the higher-level getters, and then save a lot of time.
 
+	Parameters params;
+	{
+		RWLockRead rlock(_parameters_lock);
+		params = _parameters;
+	}
+	// Note, we don't lock the palette because its data has fixed-size
+
+	const VoxelVector3i block_size = voxels.get_size();
+	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
+
+	MeshingOptions options;
+	// Neighbor blocks may be meshed at a different LOD, so their surfaces won't
+	// line up. Skirts hide the cracks this would otherwise leave.
+	options.skirts = input.lod > 0 && params.lod_skirts;
+	options.uniform = false;
+
+	Span<uint8_t> raw_channel;
+	// Storage for the value of uniform blocks, so they go through the same code
+	// as others with a buffer of one voxel
+	uint8_t uniform_value_8;
+	uint16_t uniform_value_16;
+
 	if (voxels.get_channel_compression(channel) ==
 			VoxelBuffer::COMPRESSION_UNIFORM) {
 		// All voxels have the same type.
-		// If it's all air, nothing to do. If it's all cubes, nothing to do either.
-		return;
+		// If it's all air, nothing to do. If it's all cubes, only skirts can be seen.
+		if (!options.skirts) {
+			return;
+		}
+		options.uniform = true;
+		const uint64_t value = voxels.get_voxel(0, 0, 0, channel);
+		switch (channel_depth) {
+			case VoxelBuffer::DEPTH_8_BIT:
+				uniform_value_8 = value;
+				raw_channel = Span<uint8_t>(&uniform_value_8, 1);
+				break;
+
+			case VoxelBuffer::DEPTH_16_BIT:
+				uniform_value_16 = value;
+				raw_channel = Span<uint8_t>(
+						reinterpret_cast<uint8_t *>(&uniform_value_16), sizeof(uint16_t));
+				break;
+
+			default:
+				ERR_PRINT("Unsupported voxel depth");
+				return;
+		}
 
 	} else if (voxels.get_channel_compression(channel) !=
 			VoxelBuffer::COMPRESSION_NONE) {
 		// No other form of compression is allowed
 		ERR_PRINT("VoxelMesherCubes received unsupported voxel compression");
 		return;
-	}
 
-	Span<uint8_t> raw_channel;
-	if (!voxels.get_channel_raw(channel, raw_channel)) {
+	} else if (!voxels.get_channel_raw(channel, raw_channel)) {
 		// Case supposedly handled before...
 		ERR_PRINT("Something wrong happened");
 		return;
 	}
 
-	const VoxelVector3i block_size = voxels.get_size();
-	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
-
-	Parameters params;
-	{
-		RWLockRead rlock(_parameters_lock);
-		params = _parameters;
-	}
-	// Note, we don't lock the palette because its data has fixed-size
+	options.bake_occlusion = params.bake_occlusion;
+	options.occlusion_darkness = params.occlusion_darkness / 3.f;
 
 	Ref<Image> atlas_image;
 
@@ -847,28 +1344,19 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 		case COLOR_RAW:
 			switch (channel_depth) {
 				case VoxelBuffer::DEPTH_8_BIT:
-					if (params.greedy_meshing) {
-						build_voxel_mesh_as_greedy_cubes(cache.arrays_per_material, raw_channel,
-								block_size, cache.mask_memory_pool,
-								Color8::from_u8);
-					} else {
-						build_voxel_mesh_as_simple_cubes(cache.arrays_per_material, raw_channel,
-								block_size, Color8::from_u8);
-					}
+					atlas_image = build_voxel_mesh(cache.arrays_per_material,
+							cache.greedy_atlas_data, cache.mask_memory_pool, raw_channel,
+							block_size, params.greedy_meshing,
+							params.store_colors_in_texture, options,
+							Color8::from_u8);
 					break;
 
 				case VoxelBuffer::DEPTH_16_BIT:
-					if (params.greedy_meshing) {
-						build_voxel_mesh_as_greedy_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								cache.mask_memory_pool, Color8::from_u16);
-					} else {
-						build_voxel_mesh_as_simple_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								Color8::from_u16);
-					}
+					atlas_image = build_voxel_mesh(cache.arrays_per_material,
+							cache.greedy_atlas_data, cache.mask_memory_pool,
+							raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
+							params.greedy_meshing, params.store_colors_in_texture,
+							options, Color8::from_u16);
 					break;
 
 				default:
@@ -896,36 +1384,19 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 
 			switch (channel_depth) {
 				case VoxelBuffer::DEPTH_8_BIT:
-					if (params.greedy_meshing) {
-						if (params.store_colors_in_texture) {
-							build_voxel_mesh_as_greedy_cubes_atlased(
-									cache.arrays_per_material, cache.greedy_atlas_data, raw_channel,
-									block_size, cache.mask_memory_pool, get_color_from_palette);
-							atlas_image = make_greedy_atlas(cache.greedy_atlas_data,
-									to_span(cache.arrays_per_material));
-						} else {
-							build_voxel_mesh_as_greedy_cubes(
-									cache.arrays_per_material, raw_channel, block_size,
-									cache.mask_memory_pool, get_color_from_palette);
-						}
-					} else {
-						build_voxel_mesh_as_simple_cubes(cache.arrays_per_material, raw_channel,
-								block_size, get_color_from_palette);
-					}
+					atlas_image = build_voxel_mesh(cache.arrays_per_material,
+							cache.greedy_atlas_data, cache.mask_memory_pool, raw_channel,
+							block_size, params.greedy_meshing,
+							params.store_colors_in_texture, options,
+							get_color_from_palette);
 					break;
 
 				case VoxelBuffer::DEPTH_16_BIT:
-					if (params.greedy_meshing) {
-						build_voxel_mesh_as_greedy_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								cache.mask_memory_pool, get_color_from_palette);
-					} else {
-						build_voxel_mesh_as_simple_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								get_color_from_palette);
-					}
+					atlas_image = build_voxel_mesh(cache.arrays_per_material,
+							cache.greedy_atlas_data, cache.mask_memory_pool,
+							raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
+							params.greedy_meshing, params.store_colors_in_texture,
+							options, get_color_from_palette);
 					break;
 
 				default:
@@ -948,30 +1419,28 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 			};
 			const GetIndexFromPalette get_index_from_palette{ **params.palette };
 
+			// Vertex colors carry indices here, baking occlusion into them would
+			// change which palette entry they point to
+			if (options.bake_occlusion) {
+				WARN_PRINT_ONCE("VoxelMesherCubes can't bake occlusion in shader palette color mode, it will be ignored");
+				options.bake_occlusion = false;
+			}
+
+			// Colors are resolved by the shader, so they can't be stored in a texture
 			switch (channel_depth) {
 				case VoxelBuffer::DEPTH_8_BIT:
-					if (params.greedy_meshing) {
-						build_voxel_mesh_as_greedy_cubes(cache.arrays_per_material, raw_channel,
-								block_size, cache.mask_memory_pool,
-								get_index_from_palette);
-					} else {
-						build_voxel_mesh_as_simple_cubes(cache.arrays_per_material, raw_channel,
-								block_size, get_index_from_palette);
-					}
+					build_voxel_mesh(cache.arrays_per_material, cache.greedy_atlas_data,
+							cache.mask_memory_pool, raw_channel, block_size,
+							params.greedy_meshing, false, options,
+							get_index_from_palette);
 					break;
 
 				case VoxelBuffer::DEPTH_16_BIT:
-					if (params.greedy_meshing) {
-						build_voxel_mesh_as_greedy_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								cache.mask_memory_pool, get_index_from_palette);
-					} else {
-						build_voxel_mesh_as_simple_cubes(
-								cache.arrays_per_material,
-								raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
-								get_index_from_palette);
-					}
+					build_voxel_mesh(cache.arrays_per_material, cache.greedy_atlas_data,
+							cache.mask_memory_pool,
+							raw_channel.reinterpret_cast_to<uint16_t>(), block_size,
+							params.greedy_meshing, false, options,
+							get_index_from_palette);
 					break;
 
 				default:
@@ -985,46 +1454,27 @@ void VoxelMesherCubes::build(VoxelMesher::Output &output,
 			break;
 	}
 
-	for (unsigned int i = 0; i < MATERIAL_COUNT; ++i) {
-		const Arrays &arrays = cache.arrays_per_material[i];
-
-		if (arrays.positions.size() != 0) {
-			Array mesh_arrays;
-			mesh_arrays.resize(Mesh::ARRAY_MAX);
-
-			{
-				Vector<Vector3> positions;
-				Vector<Vector3> normals;
-				Vector<int> indices;
-
-				raw_copy_to(positions, arrays.positions);
-				raw_copy_to(normals, arrays.normals);
-				raw_copy_to(indices, arrays.indices);
+	if (input.lod > 0) {
+		// Voxels of LOD N are 2^N times bigger than those of LOD 0
+		const float lod_scale = 1 << input.lod;
+		for (unsigned int i = 0; i < ARRAYS_COUNT; ++i) {
+			std::vector<Vector3> &positions = cache.arrays_per_material[i].positions;
+			for (unsigned int j = 0; j < positions.size(); ++j) {
+				positions[j] *= lod_scale;
+			}
+		}
+	}
 
-				mesh_arrays[Mesh::ARRAY_VERTEX] = positions;
-				mesh_arrays[Mesh::ARRAY_NORMAL] = normals;
-				mesh_arrays[Mesh::ARRAY_INDEX] = indices;
+	for (unsigned int i = 0; i < MATERIAL_COUNT; ++i) {
+		output.surfaces.push_back(make_surface(cache.arrays_per_material[i]));
+	}
 
-				if (arrays.colors.size() > 0) {
-					Vector<Color> colors;
-					raw_copy_to(colors, arrays.colors);
-					mesh_arrays[Mesh::ARRAY_COLOR] = colors;
-				}
-				if (arrays.uvs.size() > 0) {
-					Vector<Vector2> uvs;
-					raw_copy_to(uvs, arrays.uvs);
-					mesh_arrays[Mesh::ARRAY_TEX_UV] = uvs;
-				}
+	if (options.skirts) {
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			for (unsigned int i = 0; i < MATERIAL_COUNT; ++i) {
+				output.transition_surfaces[side].push_back(
+						make_surface(cache.arrays_per_material[MATERIAL_COUNT * (1 + side) + i]));
 			}
-			Ref<SurfaceTool> st;
-			st.instantiate();
-			st->create_from_triangle_arrays(mesh_arrays);
-			st->index();
-			output.surfaces.push_back(st->commit_to_arrays());
-
-		} else {
-			// Empty
-			output.surfaces.push_back(Array());
 		}
 	}
 
@@ -1073,6 +1523,36 @@ bool VoxelMesherCubes::get_store_colors_in_texture() const {
 	return _parameters.store_colors_in_texture;
 }
 
+void VoxelMesherCubes::set_occlusion_enabled(bool enable) {
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.bake_occlusion = enable;
+}
+
+bool VoxelMesherCubes::get_occlusion_enabled() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.bake_occlusion;
+}
+
+void VoxelMesherCubes::set_occlusion_darkness(float darkness) {
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.occlusion_darkness = clamp(darkness, 0.0f, 1.0f);
+}
+
+float VoxelMesherCubes::get_occlusion_darkness() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.occlusion_darkness;
+}
+
+void VoxelMesherCubes::set_lod_skirts_enabled(bool enable) {
+	RWLockWrite wlock(_parameters_lock);
+	_parameters.lod_skirts = enable;
+}
+
+bool VoxelMesherCubes::is_lod_skirts_enabled() const {
+	RWLockRead rlock(_parameters_lock);
+	return _parameters.lod_skirts;
+}
+
 Ref<Resource> VoxelMesherCubes::duplicate(bool p_subresources) const {
 	Parameters params;
 	{
@@ -1085,10 +1565,38 @@ Ref<Resource> VoxelMesherCubes::duplicate(bool p_subresources) const {
 	}
 	VoxelMesherCubes *d = memnew(VoxelMesherCubes);
 	d->_parameters = params;
+	copy_base_properties_to(*d);
 
 	return d;
 }
 
+uint64_t VoxelMesherCubes::get_parameters_hash() const {
+	Parameters params;
+	{
+		RWLockRead rlock(_parameters_lock);
+		params = _parameters;
+	}
+
+	uint64_t h = hash_value_64(params.color_mode);
+	h = hash_value_64(params.greedy_meshing, h);
+	h = hash_value_64(params.store_colors_in_texture, h);
+	h = hash_value_64(params.lod_skirts, h);
+	h = hash_value_64(params.bake_occlusion, h);
+	h = hash_value_64(params.occlusion_darkness, h);
+
+	if (params.palette.is_valid()) {
+		// Palette contents can change without the mesher knowing
+		FixedArray<Color8, VoxelColorPalette::MAX_COLORS> colors;
+		for (unsigned int i = 0; i < colors.size(); ++i) {
+			colors[i] = params.palette->get_color8(i);
+		}
+		h = hash_buffer_64(colors.data(), colors.size() * sizeof(Color8), h);
+	}
+
+	// Zero means "not cacheable"
+	return h != 0 ? h : 1;
+}
+
 int VoxelMesherCubes::get_used_channels_mask() const {
 	return (1 << VoxelBuffer::CHANNEL_COLOR);
 }
@@ -1108,6 +1616,26 @@ void VoxelMesherCubes::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_color_mode"),
 			&VoxelMesherCubes::get_color_mode);
 
+	ClassDB::bind_method(D_METHOD("set_occlusion_enabled", "enable"),
+			&VoxelMesherCubes::set_occlusion_enabled);
+	ClassDB::bind_method(D_METHOD("get_occlusion_enabled"),
+			&VoxelMesherCubes::get_occlusion_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_occlusion_darkness", "value"),
+			&VoxelMesherCubes::set_occlusion_darkness);
+	ClassDB::bind_method(D_METHOD("get_occlusion_darkness"),
+			&VoxelMesherCubes::get_occlusion_darkness);
+
+	ClassDB::bind_method(D_METHOD("set_lod_skirts_enabled", "enable"),
+			&VoxelMesherCubes::set_lod_skirts_enabled);
+	ClassDB::bind_method(D_METHOD("is_lod_skirts_enabled"),
+			&VoxelMesherCubes::is_lod_skirts_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_store_colors_in_texture", "enable"),
+			&VoxelMesherCubes::set_store_colors_in_texture);
+	ClassDB::bind_method(D_METHOD("get_store_colors_in_texture"),
+			&VoxelMesherCubes::get_store_colors_in_texture);
+
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "greedy_meshing_enabled"),
 			"set_greedy_meshing_enabled", "is_greedy_meshing_enabled");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "color_mode"), "set_color_mode",
@@ -1115,6 +1643,15 @@ void VoxelMesherCubes::_bind_methods() {
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "palette",
 						 PROPERTY_HINT_RESOURCE_TYPE, "VoxelColorPalette"),
 			"set_palette", "get_palette");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "store_colors_in_texture"),
+			"set_store_colors_in_texture", "get_store_colors_in_texture");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "occlusion_enabled"),
+			"set_occlusion_enabled", "get_occlusion_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "occlusion_darkness",
+						 PROPERTY_HINT_RANGE, "0,1,0.01"),
+			"set_occlusion_darkness", "get_occlusion_darkness");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lod_skirts_enabled"),
+			"set_lod_skirts_enabled", "is_lod_skirts_enabled");
 
 	BIND_ENUM_CONSTANT(MATERIAL_OPAQUE);
 	BIND_ENUM_CONSTANT(MATERIAL_TRANSPARENT);
@@ -45,6 +45,10 @@ public:
 		MATERIAL_TRANSPARENT,
 		MATERIAL_COUNT };
 
+	// Arrays of regular surfaces, one per material, followed by those of skirts
+	// for each side of the block
+	static const unsigned int ARRAYS_COUNT = MATERIAL_COUNT * (1 + Cube::SIDE_COUNT);
+
 	enum ColorMode {
 		// The voxel value will be treated as an RGBA color with components of equal
 		// bit depth
@@ -78,10 +82,30 @@ public:
 	Ref<Resource> duplicate(bool p_subresources = false) const override;
 	int get_used_channels_mask() const override;
 
+	// When greedy meshing is enabled, stores voxel colors in an atlas texture
+	// instead of vertices, so faces of different colors can merge into the same
+	// quads. Works with raw and mesher palette modes.
 	void set_store_colors_in_texture(bool enable);
 	bool get_store_colors_in_texture() const;
 
-	bool supports_lod() const override { return false; }
+	// Bakes ambient occlusion into vertex colors. Greedy meshing only merges
+	// faces having the same occlusion, so it produces more quads.
+	void set_occlusion_enabled(bool enable);
+	bool get_occlusion_enabled() const;
+
+	void set_occlusion_darkness(float darkness);
+	float get_occlusion_darkness() const;
+
+	// Input voxels at LOD N are expected to be downscaled by 2^N. Geometry is
+	// scaled back up so it matches LOD 0 coordinates.
+	bool supports_lod() const override { return true; }
+
+	// When meshing with LOD > 0, generates faces on the boundaries of the block
+	// as if padding voxels were empty. They go to the transition surfaces of the
+	// output, one per side, so only sides facing a neighbor meshed at a
+	// different LOD show them. This hides cracks between those blocks.
+	void set_lod_skirts_enabled(bool enable);
+	bool is_lod_skirts_enabled() const;
 
 	// Using std::vector because they make this mesher twice as fast than Godot
 	// Vectors. See why: https://github.com/godotengine/godot/issues/24731
@@ -121,16 +145,21 @@ public:
 protected:
 	static void _bind_methods();
 
+	uint64_t get_parameters_hash() const override;
+
 private:
 	struct Parameters {
 		ColorMode color_mode = COLOR_RAW;
 		Ref<VoxelColorPalette> palette;
 		bool greedy_meshing = true;
 		bool store_colors_in_texture = false;
+		bool lod_skirts = true;
+		bool bake_occlusion = false;
+		float occlusion_darkness = 0.8f;
 	};
 
 	struct Cache {
-		FixedArray<Arrays, MATERIAL_COUNT> arrays_per_material;
+		FixedArray<Arrays, ARRAYS_COUNT> arrays_per_material;
 		std::vector<uint8_t> mask_memory_pool;
 		GreedyAtlasData greedy_atlas_data;
 	};
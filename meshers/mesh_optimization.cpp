@@ -0,0 +1,292 @@
+/**************************************************************************/
+/*  mesh_optimization.cpp                                                 */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             GODOT ENGINE                               */
+/*                        https://godotengine.org                         */
+/**************************************************************************/
+/* Copyright (c) 2014-present Godot Engine contributors (see AUTHORS.md). */
+/* Copyright (c) 2007-2014 Juan Linietsky, Ariel Manzur.                  */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "mesh_optimization.h"
+#include "../util/profiling.h"
+
+#include "modules/modules_enabled.gen.h" // For meshoptimizer.
+#include <scene/resources/mesh.h>
+#include <vector>
+
+#ifdef MODULE_MESHOPTIMIZER_ENABLED
+// Uses the engine's copy, compiled by its meshoptimizer module
+#include <thirdparty/meshoptimizer/meshoptimizer.h>
+
+namespace {
+
+// Overdraw optimization is allowed to make vertex cache efficiency this much worse
+const float OVERDRAW_CACHE_THRESHOLD = 1.05f;
+
+template <typename PackedArray_T>
+void remap_vertex_array(Array &surface, int array_index, const std::vector<unsigned int> &remap,
+		unsigned int vertex_count, unsigned int unique_vertex_count) {
+	const PackedArray_T src = surface[array_index];
+	// Some arrays have several components per vertex, like tangents
+	const unsigned int components = src.size() / vertex_count;
+	ERR_FAIL_COND(components * vertex_count != static_cast<unsigned int>(src.size()));
+
+	PackedArray_T dst;
+	dst.resize(unique_vertex_count * components);
+	meshopt_remapVertexBuffer(dst.ptrw(), src.ptr(), vertex_count, sizeof(src.ptr()[0]) * components,
+			remap.data());
+	surface[array_index] = dst;
+}
+
+void remap_vertex_arrays(Array &surface, const std::vector<unsigned int> &remap, unsigned int vertex_count,
+		unsigned int unique_vertex_count) {
+	for (int i = 0; i < surface.size(); ++i) {
+		if (i == Mesh::ARRAY_INDEX) {
+			continue;
+		}
+		switch (surface[i].get_type()) {
+			case Variant::NIL:
+				break;
+			case Variant::PACKED_VECTOR3_ARRAY:
+				remap_vertex_array<PackedVector3Array>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_VECTOR2_ARRAY:
+				remap_vertex_array<PackedVector2Array>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_COLOR_ARRAY:
+				remap_vertex_array<PackedColorArray>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_FLOAT32_ARRAY:
+				remap_vertex_array<PackedFloat32Array>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_FLOAT64_ARRAY:
+				remap_vertex_array<PackedFloat64Array>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_INT32_ARRAY:
+				remap_vertex_array<PackedInt32Array>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			case Variant::PACKED_BYTE_ARRAY:
+				remap_vertex_array<PackedByteArray>(surface, i, remap, vertex_count, unique_vertex_count);
+				break;
+			default:
+				ERR_PRINT("Unexpected array type in surface");
+				break;
+		}
+	}
+}
+
+template <typename PackedArray_T>
+void add_vertex_stream(const Array &surface, int array_index, unsigned int vertex_count,
+		std::vector<meshopt_Stream> &streams) {
+	const PackedArray_T src = surface[array_index];
+	const size_t size = sizeof(src.ptr()[0]) * (src.size() / vertex_count);
+	// The array is kept alive by the surface
+	streams.push_back(meshopt_Stream{ src.ptr(), size, size });
+}
+
+// Merges vertices having all their attributes equal. Meshers emit separate
+// vertices for each quad, and simplification can only collapse edges between
+// triangles sharing vertices. Vertices differing in any attribute, like UVs at
+// atlas tile seams, stay separate.
+unsigned int weld_vertices(Array &surface, PackedInt32Array &indices, unsigned int vertex_count) {
+	std::vector<meshopt_Stream> streams;
+	for (int i = 0; i < surface.size(); ++i) {
+		switch (i == Mesh::ARRAY_INDEX ? Variant::NIL : surface[i].get_type()) {
+			case Variant::NIL:
+				break;
+			case Variant::PACKED_VECTOR3_ARRAY:
+				add_vertex_stream<PackedVector3Array>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_VECTOR2_ARRAY:
+				add_vertex_stream<PackedVector2Array>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_COLOR_ARRAY:
+				add_vertex_stream<PackedColorArray>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_FLOAT32_ARRAY:
+				add_vertex_stream<PackedFloat32Array>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_FLOAT64_ARRAY:
+				add_vertex_stream<PackedFloat64Array>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_INT32_ARRAY:
+				add_vertex_stream<PackedInt32Array>(surface, i, vertex_count, streams);
+				break;
+			case Variant::PACKED_BYTE_ARRAY:
+				add_vertex_stream<PackedByteArray>(surface, i, vertex_count, streams);
+				break;
+			default:
+				// Can't compare it, so nothing gets welded
+				return vertex_count;
+		}
+	}
+
+	unsigned int *indices_ptr = reinterpret_cast<unsigned int *>(indices.ptrw());
+	std::vector<unsigned int> remap;
+	remap.resize(vertex_count);
+	const unsigned int unique_vertex_count = meshopt_generateVertexRemapMulti(
+			remap.data(), indices_ptr, indices.size(), vertex_count, streams.data(), streams.size());
+	if (unique_vertex_count == vertex_count) {
+		return vertex_count;
+	}
+
+	meshopt_remapIndexBuffer(indices_ptr, indices_ptr, indices.size(), remap.data());
+	remap_vertex_arrays(surface, remap, vertex_count, unique_vertex_count);
+	return unique_vertex_count;
+}
+
+} // namespace
+
+void optimize_surface(Array &surface, Dictionary &out_lods, const MeshOptimizationParams &params) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(surface.size() != Mesh::ARRAY_MAX);
+
+	if (!params.optimize && params.lod_count <= 0) {
+		return;
+	}
+
+	PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+	const unsigned int index_count = indices.size();
+	if (index_count < 3) {
+		return;
+	}
+	ERR_FAIL_COND(index_count % 3 != 0);
+
+	unsigned int vertex_count = PackedVector3Array(surface[Mesh::ARRAY_VERTEX]).size();
+	if (vertex_count == 0) {
+		return;
+	}
+	{
+		VOXEL_PROFILE_SCOPE_NAMED("Weld");
+		vertex_count = weld_vertices(surface, indices, vertex_count);
+	}
+	// Read after welding, which may have replaced it
+	PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+
+	// meshoptimizer works with floats
+#ifdef REAL_T_IS_DOUBLE
+	std::vector<float> positions_f;
+	positions_f.resize(vertex_count * 3);
+	for (unsigned int i = 0; i < vertex_count; ++i) {
+		const Vector3 p = positions[i];
+		positions_f[i * 3] = p.x;
+		positions_f[i * 3 + 1] = p.y;
+		positions_f[i * 3 + 2] = p.z;
+	}
+	const float *positions_ptr = positions_f.data();
+	const size_t positions_stride = 3 * sizeof(float);
+#else
+	const float *positions_ptr = reinterpret_cast<const float *>(positions.ptr());
+	const size_t positions_stride = sizeof(Vector3);
+#endif
+
+	static_assert(sizeof(int32_t) == sizeof(unsigned int), "Indices are reinterpreted as unsigned");
+	unsigned int *indices_ptr = reinterpret_cast<unsigned int *>(indices.ptrw());
+
+	if (params.optimize) {
+		VOXEL_PROFILE_SCOPE_NAMED("Vertex cache and overdraw");
+		meshopt_optimizeVertexCache(indices_ptr, indices_ptr, index_count, vertex_count);
+		meshopt_optimizeOverdraw(indices_ptr, indices_ptr, index_count, positions_ptr, vertex_count,
+				positions_stride, OVERDRAW_CACHE_THRESHOLD);
+	}
+
+	std::vector<PackedInt32Array> lod_indices;
+	std::vector<float> lod_errors;
+
+	if (params.lod_count > 0) {
+		VOXEL_PROFILE_SCOPE_NAMED("Simplification");
+		// Errors returned by meshoptimizer are relative, LODs want them in mesh units
+		const float scale = meshopt_simplifyScale(positions_ptr, vertex_count, positions_stride);
+
+		const unsigned int *prev_indices = indices_ptr;
+		unsigned int prev_index_count = index_count;
+
+		for (int lod_index = 0; lod_index < params.lod_count; ++lod_index) {
+			const unsigned int target_index_count = (prev_index_count / 6) * 3;
+			if (target_index_count < 3) {
+				break;
+			}
+
+			PackedInt32Array dst;
+			dst.resize(prev_index_count);
+			unsigned int *dst_ptr = reinterpret_cast<unsigned int *>(dst.ptrw());
+			float error = 0.f;
+			// Open edges are left in place. These are the outline of the mesh, and
+			// seams where attributes like atlas UVs are discontinuous.
+			const size_t dst_count = meshopt_simplify(dst_ptr, prev_indices, prev_index_count, positions_ptr,
+					vertex_count, positions_stride, target_index_count, params.lod_error,
+					meshopt_SimplifyLockBorder, &error);
+
+			if (dst_count == 0 || dst_count >= prev_index_count) {
+				// Can't simplify further within the allowed error
+				break;
+			}
+
+			meshopt_optimizeVertexCache(dst_ptr, dst_ptr, dst_count, vertex_count);
+			dst.resize(dst_count);
+
+			lod_indices.push_back(dst);
+			// Keys must be increasing and strictly positive
+			const float prev_error = lod_errors.size() > 0 ? lod_errors.back() : 0.f;
+			lod_errors.push_back(MAX(error * scale, prev_error + CMP_EPSILON));
+
+			prev_indices = reinterpret_cast<const unsigned int *>(lod_indices.back().ptr());
+			prev_index_count = dst_count;
+		}
+	}
+
+	if (params.optimize) {
+		VOXEL_PROFILE_SCOPE_NAMED("Vertex fetch");
+		std::vector<unsigned int> remap;
+		remap.resize(vertex_count);
+		const unsigned int unique_vertex_count =
+				meshopt_optimizeVertexFetchRemap(remap.data(), indices_ptr, index_count, vertex_count);
+
+		meshopt_remapIndexBuffer(indices_ptr, indices_ptr, index_count, remap.data());
+		// LODs only reference vertices used by the full-detail indices, so they can be remapped the same way
+		for (unsigned int i = 0; i < lod_indices.size(); ++i) {
+			PackedInt32Array &lod = lod_indices[i];
+			unsigned int *lod_ptr = reinterpret_cast<unsigned int *>(lod.ptrw());
+			meshopt_remapIndexBuffer(lod_ptr, lod_ptr, lod.size(), remap.data());
+		}
+
+		remap_vertex_arrays(surface, remap, vertex_count, unique_vertex_count);
+	}
+
+	surface[Mesh::ARRAY_INDEX] = indices;
+
+	for (unsigned int i = 0; i < lod_indices.size(); ++i) {
+		out_lods[lod_errors[i]] = lod_indices[i];
+	}
+}
+
+#else // MODULE_MESHOPTIMIZER_ENABLED
+
+void optimize_surface(Array &surface, Dictionary &out_lods, const MeshOptimizationParams &params) {
+	if (params.optimize || params.lod_count > 0) {
+		WARN_PRINT_ONCE("Mesh optimization requires the meshoptimizer module, which is disabled in this build");
+	}
+}
+
+#endif // MODULE_MESHOPTIMIZER_ENABLED
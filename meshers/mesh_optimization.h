@@ -0,0 +1,54 @@
+/**************************************************************************/
+/*  mesh_optimization.h                                                   */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             GODOT ENGINE                               */
+/*                        https://godotengine.org                         */
+/**************************************************************************/
+/* Copyright (c) 2014-present Godot Engine contributors (see AUTHORS.md). */
+/* Copyright (c) 2007-2014 Juan Linietsky, Ariel Manzur.                  */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef VOXEL_MESH_OPTIMIZATION_H
+#define VOXEL_MESH_OPTIMIZATION_H
+
+#include <core/variant/array.h>
+#include <core/variant/dictionary.h>
+
+struct MeshOptimizationParams {
+	// Reorders indices for the vertex cache, then to reduce overdraw, and reorders
+	// vertices for fetch locality. Does not change the appearance of the mesh.
+	bool optimize = false;
+	// How many simplified index buffers to generate after the full-detail one.
+	// Each level targets half the triangles of the previous one.
+	int lod_count = 0;
+	// Maximum error allowed when simplifying, relative to the size of the mesh.
+	float lod_error = 0.01f;
+};
+
+// Post-processes a triangle surface in the format of `Mesh::add_surface_from_arrays`.
+// All per-vertex arrays are remapped if vertices get reordered.
+// Simplified LODs are written into `out_lods`, in the format expected by the
+// `p_lods` argument of `ArrayMesh::add_surface_from_arrays`.
+void optimize_surface(Array &surface, Dictionary &out_lods, const MeshOptimizationParams &params);
+
+#endif // VOXEL_MESH_OPTIMIZATION_H
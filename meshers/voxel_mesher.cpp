@@ -30,14 +30,18 @@
 
 #include "voxel_mesher.h"
 #include "../storage/voxel_buffer.h"
+#include "../util/funcs.h"
 #include "../util/godot/funcs.h"
+#include "../util/math/funcs.h"
+#include "../util/profiling.h"
+#include <scene/resources/concave_polygon_shape_3d.h>
 
 Ref<Mesh> VoxelMesher::build_mesh(Ref<VoxelBuffer> voxels, Array materials) {
 	ERR_FAIL_COND_V(voxels.is_null(), Ref<ArrayMesh>());
 
 	Output output;
 	Input input = { **voxels, 0 };
-	build(output, input);
+	build_cached(output, input);
 
 	if (output.surfaces.is_empty()) {
 		return Ref<ArrayMesh>();
@@ -58,7 +62,12 @@ Ref<Mesh> VoxelMesher::build_mesh(Ref<VoxelBuffer> voxels, Array materials) {
 			continue;
 		}
 
-		mesh->add_surface_from_arrays(output.primitive_type, surface, Array());
+		Dictionary lods;
+		if (i < output.surfaces_lods.size()) {
+			lods = output.surfaces_lods[i];
+		}
+
+		mesh->add_surface_from_arrays(output.primitive_type, surface, Array(), lods);
 		if (i < materials.size()) {
 			mesh->surface_set_material(surface_index, materials[i]);
 		}
@@ -68,10 +77,240 @@ Ref<Mesh> VoxelMesher::build_mesh(Ref<VoxelBuffer> voxels, Array materials) {
 	return mesh;
 }
 
+Ref<ConcavePolygonShape3D> VoxelMesher::build_collision_shape(Ref<VoxelBuffer> voxels,
+		uint32_t collision_mask) {
+	ERR_FAIL_COND_V(voxels.is_null(), Ref<ConcavePolygonShape3D>());
+
+	CollisionOutput output;
+	Input input = { **voxels, 0 };
+	build_collision(output, input, collision_mask);
+
+	return create_concave_polygon_shape(output.positions, output.indices);
+}
+
 void VoxelMesher::build(Output &output, const Input &input) {
 	ERR_PRINT("Not implemented");
 }
 
+void VoxelMesher::build_collision(CollisionOutput &output, const Input &input,
+		uint32_t collision_mask) {
+	Output visual_output;
+	build(visual_output, input);
+
+	ERR_FAIL_COND(visual_output.primitive_type != Mesh::PRIMITIVE_TRIANGLES);
+
+	// Merge all surfaces into one, only keeping what physics needs
+	int vertex_count = 0;
+	int index_count = 0;
+	for (int i = 0; i < visual_output.surfaces.size(); ++i) {
+		const Array &surface = visual_output.surfaces[i];
+		if (surface.is_empty()) {
+			continue;
+		}
+		const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+		const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+		vertex_count += positions.size();
+		index_count += indices.size();
+	}
+
+	output.positions.resize(vertex_count);
+	output.indices.resize(index_count);
+	Vector3 *positions_w = output.positions.ptrw();
+	int *indices_w = output.indices.ptrw();
+	int vertex_offset = 0;
+
+	for (int i = 0; i < visual_output.surfaces.size(); ++i) {
+		const Array &surface = visual_output.surfaces[i];
+		if (surface.is_empty()) {
+			continue;
+		}
+		const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+		const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+
+		memcpy(positions_w, positions.ptr(), positions.size() * sizeof(Vector3));
+		positions_w += positions.size();
+
+		for (int j = 0; j < indices.size(); ++j) {
+			indices_w[j] = vertex_offset + indices[j];
+		}
+		indices_w += indices.size();
+		vertex_offset += positions.size();
+	}
+}
+
+void VoxelMesher::post_process(Output &output) const {
+	MeshOptimizationParams params;
+	{
+		RWLockRead rlock(_optimization_params_lock);
+		params = _optimization_params;
+	}
+
+	if (!params.optimize && params.lod_count <= 0) {
+		return;
+	}
+	if (output.primitive_type != Mesh::PRIMITIVE_TRIANGLES) {
+		return;
+	}
+
+	VOXEL_PROFILE_SCOPE();
+
+	output.surfaces_lods.resize(output.surfaces.size());
+
+	for (int i = 0; i < output.surfaces.size(); ++i) {
+		Array surface = output.surfaces[i];
+		if (surface.is_empty() || !is_surface_triangulated(surface)) {
+			continue;
+		}
+		MeshOptimizationParams surface_params = params;
+		if (i < 64 && (output.ordered_surfaces_mask & (uint64_t(1) << i))) {
+			// Vertex cache and overdraw optimizations would undo the sorting
+			surface_params.optimize = false;
+		}
+		// Arrays are shared by reference, so the output gets modified
+		Dictionary lods;
+		optimize_surface(surface, lods, surface_params);
+		output.surfaces_lods.write[i] = lods;
+	}
+}
+
+uint64_t VoxelMesher::get_output_settings_hash() const {
+	const uint64_t parameters_hash = get_parameters_hash();
+	if (parameters_hash == 0) {
+		return 0;
+	}
+
+	MeshOptimizationParams optimization_params;
+	{
+		RWLockRead rlock(_optimization_params_lock);
+		optimization_params = _optimization_params;
+	}
+
+	uint64_t h = hash_value_64(parameters_hash);
+	h = hash_value_64(get_used_channels_mask(), h);
+	h = hash_value_64(optimization_params.optimize, h);
+	h = hash_value_64(optimization_params.lod_count, h);
+	h = hash_value_64(optimization_params.lod_error, h);
+	return h != 0 ? h : 1;
+}
+
+// Arrays, dictionaries and images are shared by reference when an output is
+// copied. Outputs in the cache must not change if the caller modifies its own,
+// and the other way around.
+static void copy_output_deep(const VoxelMesher::Output &src, VoxelMesher::Output &dst) {
+	VOXEL_PROFILE_SCOPE();
+	dst = src;
+	for (int i = 0; i < dst.surfaces.size(); ++i) {
+		dst.surfaces.write[i] = src.surfaces[i].duplicate(true);
+	}
+	for (unsigned int side = 0; side < dst.transition_surfaces.size(); ++side) {
+		Vector<Array> &surfaces = dst.transition_surfaces[side];
+		for (int i = 0; i < surfaces.size(); ++i) {
+			surfaces.write[i] = src.transition_surfaces[side][i].duplicate(true);
+		}
+	}
+	for (int i = 0; i < dst.surfaces_lods.size(); ++i) {
+		dst.surfaces_lods.write[i] = src.surfaces_lods[i].duplicate(true);
+	}
+	if (src.atlas_image.is_valid()) {
+		dst.atlas_image = src.atlas_image->duplicate();
+	}
+}
+
+void VoxelMesher::build_cached(Output &output, const Input &input) {
+	const uint64_t settings_hash = get_output_settings_hash();
+	if (settings_hash == 0 || get_mesh_cache_capacity() == 0) {
+		build(output, input);
+		post_process(output);
+		return;
+	}
+
+	uint64_t key;
+	{
+		VOXEL_PROFILE_SCOPE_NAMED("Mesh cache key");
+		key = input.voxels.get_content_hash(get_used_channels_mask());
+		key = hash_value_64(settings_hash, key);
+		key = hash_value_64(input.lod, key);
+	}
+
+	Output cached_output;
+	bool found;
+	{
+		MutexLock lock(_mesh_cache_mutex);
+		found = _mesh_cache.try_get(key, cached_output);
+	}
+	// Cached outputs are never modified, so they can be copied without locking
+	if (found) {
+		copy_output_deep(cached_output, output);
+		return;
+	}
+
+	// Not locking while building, the mesher is thread-safe
+	build(output, input);
+	post_process(output);
+	copy_output_deep(output, cached_output);
+
+	MutexLock lock(_mesh_cache_mutex);
+	_mesh_cache.put(key, cached_output);
+}
+
+void VoxelMesher::set_mesh_cache_capacity(int capacity) {
+	ERR_FAIL_COND(capacity < 0);
+	MutexLock lock(_mesh_cache_mutex);
+	_mesh_cache.set_capacity(capacity);
+}
+
+int VoxelMesher::get_mesh_cache_capacity() const {
+	MutexLock lock(_mesh_cache_mutex);
+	return _mesh_cache.get_capacity();
+}
+
+void VoxelMesher::clear_mesh_cache() {
+	MutexLock lock(_mesh_cache_mutex);
+	_mesh_cache.clear();
+}
+
+void VoxelMesher::set_mesh_optimization_enabled(bool enable) {
+	RWLockWrite wlock(_optimization_params_lock);
+	_optimization_params.optimize = enable;
+}
+
+bool VoxelMesher::is_mesh_optimization_enabled() const {
+	RWLockRead rlock(_optimization_params_lock);
+	return _optimization_params.optimize;
+}
+
+void VoxelMesher::set_simplification_lod_count(int count) {
+	ERR_FAIL_COND(count < 0);
+	RWLockWrite wlock(_optimization_params_lock);
+	_optimization_params.lod_count = count;
+}
+
+int VoxelMesher::get_simplification_lod_count() const {
+	RWLockRead rlock(_optimization_params_lock);
+	return _optimization_params.lod_count;
+}
+
+void VoxelMesher::set_simplification_error(float error) {
+	RWLockWrite wlock(_optimization_params_lock);
+	_optimization_params.lod_error = clamp(error, 0.f, 1.f);
+}
+
+float VoxelMesher::get_simplification_error() const {
+	RWLockRead rlock(_optimization_params_lock);
+	return _optimization_params.lod_error;
+}
+
+void VoxelMesher::copy_base_properties_to(VoxelMesher &dst) const {
+	dst.set_mesh_cache_capacity(get_mesh_cache_capacity());
+	MeshOptimizationParams params;
+	{
+		RWLockRead rlock(_optimization_params_lock);
+		params = _optimization_params;
+	}
+	RWLockWrite wlock(dst._optimization_params_lock);
+	dst._optimization_params = params;
+}
+
 unsigned int VoxelMesher::get_minimum_padding() const {
 	return _minimum_padding;
 }
@@ -92,8 +331,42 @@ void VoxelMesher::_bind_methods() {
 	// voxels. Useful for testing the different meshers.
 	ClassDB::bind_method(D_METHOD("build_mesh", "voxel_buffer", "materials"),
 			&VoxelMesher::build_mesh);
+	ClassDB::bind_method(D_METHOD("build_collision_shape", "voxel_buffer", "collision_mask"),
+			&VoxelMesher::build_collision_shape, DEFVAL(0xffffffff));
 	ClassDB::bind_method(D_METHOD("get_minimum_padding"),
 			&VoxelMesher::get_minimum_padding);
 	ClassDB::bind_method(D_METHOD("get_maximum_padding"),
 			&VoxelMesher::get_maximum_padding);
+
+	ClassDB::bind_method(D_METHOD("set_mesh_cache_capacity", "capacity"),
+			&VoxelMesher::set_mesh_cache_capacity);
+	ClassDB::bind_method(D_METHOD("get_mesh_cache_capacity"),
+			&VoxelMesher::get_mesh_cache_capacity);
+	ClassDB::bind_method(D_METHOD("clear_mesh_cache"),
+			&VoxelMesher::clear_mesh_cache);
+
+	ClassDB::bind_method(D_METHOD("set_mesh_optimization_enabled", "enable"),
+			&VoxelMesher::set_mesh_optimization_enabled);
+	ClassDB::bind_method(D_METHOD("is_mesh_optimization_enabled"),
+			&VoxelMesher::is_mesh_optimization_enabled);
+	ClassDB::bind_method(D_METHOD("set_simplification_lod_count", "count"),
+			&VoxelMesher::set_simplification_lod_count);
+	ClassDB::bind_method(D_METHOD("get_simplification_lod_count"),
+			&VoxelMesher::get_simplification_lod_count);
+	ClassDB::bind_method(D_METHOD("set_simplification_error", "error"),
+			&VoxelMesher::set_simplification_error);
+	ClassDB::bind_method(D_METHOD("get_simplification_error"),
+			&VoxelMesher::get_simplification_error);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "mesh_cache_capacity",
+						 PROPERTY_HINT_RANGE, "0,1024,1,or_greater"),
+			"set_mesh_cache_capacity", "get_mesh_cache_capacity");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "mesh_optimization_enabled"),
+			"set_mesh_optimization_enabled", "is_mesh_optimization_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "simplification_lod_count",
+						 PROPERTY_HINT_RANGE, "0,8,1"),
+			"set_simplification_lod_count", "get_simplification_lod_count");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "simplification_error",
+						 PROPERTY_HINT_RANGE, "0,1,0.001"),
+			"set_simplification_error", "get_simplification_error");
 }
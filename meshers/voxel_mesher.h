@@ -33,10 +33,15 @@
 
 #include "../constants/cube_tables.h"
 #include "../util/fixed_array.h"
+#include "../util/lru_cache.h"
+#include "mesh_optimization.h"
 #include <core/io/resource.h>
+#include <core/os/mutex.h>
+#include <core/os/rw_lock.h>
 #include <scene/resources/mesh.h>
 
 class VoxelBuffer;
+class ConcavePolygonShape3D;
 
 class VoxelMesher : public Resource {
 	GDCLASS(VoxelMesher, Resource)
@@ -52,16 +57,76 @@ public:
 		FixedArray<Vector<Array>, Cube::SIDE_COUNT> transition_surfaces;
 		Mesh::PrimitiveType primitive_type = Mesh::PRIMITIVE_TRIANGLES;
 		Ref<Image> atlas_image;
+		// Simplified index arrays for each surface, filled by `post_process`.
+		// Can be passed as the `p_lods` argument of `ArrayMesh::add_surface_from_arrays`.
+		Vector<Dictionary> surfaces_lods;
+		// Bit N is set if triangles of surface N were sorted on purpose, in which
+		// case `post_process` must not reorder them.
+		uint64_t ordered_surfaces_mask = 0;
+	};
+
+	// Geometry only meant for physics
+	struct CollisionOutput {
+		Vector<Vector3> positions;
+		Vector<int> indices;
 	};
 
 	// This can be called from multiple threads at once. Make sure member vars are
 	// protected or thread-local.
 	virtual void build(Output &output, const Input &voxels);
 
+	// Builds only what is needed for physics, which is cheaper than `build` when
+	// the mesher supports it. Voxels not sharing any bit with `collision_mask` are
+	// skipped, if the mesher has a notion of it.
+	// The default implementation extracts positions from the visual mesh.
+	// This can be called from multiple threads at once.
+	virtual void build_collision(CollisionOutput &output, const Input &input,
+			uint32_t collision_mask);
+
+	// Applies optional optimizations on the surfaces of an output, such as
+	// reordering for the GPU vertex cache and generating simplified LODs.
+	// Does nothing if none are enabled.
+	void post_process(Output &output) const;
+
+	// Same as `build` followed by `post_process`, but if the same voxels were
+	// meshed before with the same parameters, returns the previous output
+	// instead. Caching has no effect if the mesh cache capacity is zero, or if
+	// the mesher does not support it.
+	// Voxels used by the mesher are hashed on every call, so this is only
+	// worth it if identical content is expected to be meshed repeatedly.
+	// The cache keeps its own copy of outputs, so the returned one can be
+	// modified.
+	void build_cached(Output &output, const Input &input);
+
+	// Gets a hash of all settings affecting outputs of `build_cached`, besides
+	// the voxels and the LOD index. Returns 0 if the mesher can't provide one,
+	// in which case outputs must not be cached.
+	uint64_t get_output_settings_hash() const;
+
+	// Sets how many outputs can be kept in the mesh cache. Least recently used
+	// outputs are evicted first.
+	void set_mesh_cache_capacity(int capacity);
+	int get_mesh_cache_capacity() const;
+
+	void clear_mesh_cache();
+
+	void set_mesh_optimization_enabled(bool enable);
+	bool is_mesh_optimization_enabled() const;
+
+	void set_simplification_lod_count(int count);
+	int get_simplification_lod_count() const;
+
+	void set_simplification_error(float error);
+	float get_simplification_error() const;
+
 	// Builds a mesh from the given voxels. This function is simplified to be used
 	// by the script API.
 	Ref<Mesh> build_mesh(Ref<VoxelBuffer> voxels, Array materials);
 
+	// Builds a collision shape from the given voxels, for use by the script API.
+	Ref<ConcavePolygonShape3D> build_collision_shape(Ref<VoxelBuffer> voxels,
+			uint32_t collision_mask);
+
 	// Gets how many neighbor voxels need to be accessed around the meshed area,
 	// toward negative axes. If this is not respected, the mesher might produce
 	// seams at the edges, or an error
@@ -90,10 +155,23 @@ protected:
 
 	void set_padding(int minimum, int maximum);
 
+	// Gets a hash of all parameters affecting the result of `build`.
+	// Meshers returning 0 don't use the mesh cache.
+	virtual uint64_t get_parameters_hash() const { return 0; }
+
+	// Copies properties common to all meshers, for use in `duplicate`
+	void copy_base_properties_to(VoxelMesher &dst) const;
+
 private:
 	// Set in constructor and never changed after.
 	unsigned int _minimum_padding = 0;
 	unsigned int _maximum_padding = 0;
+
+	LruCache<uint64_t, Output> _mesh_cache;
+	Mutex _mesh_cache_mutex;
+
+	MeshOptimizationParams _optimization_params;
+	RWLock _optimization_params_lock;
 };
 
 #endif // VOXEL_MESHER_H
@@ -742,6 +742,29 @@ bool VoxelBuffer::equals(const VoxelBuffer &p_other) const {
 	return true;
 }
 
+uint64_t VoxelBuffer::get_content_hash(uint32_t channels_mask) const {
+	VOXEL_PROFILE_SCOPE();
+	uint64_t h = hash_value_64(_size);
+
+	for (unsigned int channel_index = 0; channel_index < MAX_CHANNELS;
+			++channel_index) {
+		if ((channels_mask & (1 << channel_index)) == 0) {
+			continue;
+		}
+		const Channel &channel = _channels[channel_index];
+		h = hash_value_64(channel_index, h);
+		h = hash_value_64(channel.depth, h);
+
+		if (channel.data == nullptr) {
+			h = hash_value_64(channel.defval, h);
+		} else {
+			h = hash_buffer_64(channel.data, channel.size_in_bytes, h);
+		}
+	}
+
+	return h;
+}
+
 void VoxelBuffer::set_channel_depth(unsigned int channel_index,
 		Depth new_depth) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
@@ -951,6 +974,8 @@ void VoxelBuffer::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("is_uniform", "channel"),
 			&VoxelBuffer::is_uniform);
+	ClassDB::bind_method(D_METHOD("get_content_hash", "channels_mask"),
+			&VoxelBuffer::_b_get_content_hash);
 	// TODO Rename `compress_uniform_channels`
 	ClassDB::bind_method(D_METHOD("optimize"),
 			&VoxelBuffer::compress_uniform_channels);
@@ -439,6 +439,11 @@ public:
 
 	bool equals(const VoxelBuffer &p_other) const;
 
+	// Computes a hash of the size and voxels of the channels selected by the
+	// bitmask. Uniform channels are cheap to hash. Note, a uniform channel will
+	// not hash the same as an uncompressed channel filled with the same value.
+	uint64_t get_content_hash(uint32_t channels_mask) const;
+
 	void set_channel_depth(unsigned int channel_index, Depth new_depth);
 	Depth get_channel_depth(unsigned int channel_index) const;
 	static uint32_t get_depth_bit_count(Depth d);
@@ -525,6 +530,9 @@ private:
 		set_voxel(value, x, y, z, channel);
 	}
 	void _b_copy_channel_from(Ref<VoxelBuffer> other, unsigned int channel);
+	int64_t _b_get_content_hash(int channels_mask) const {
+		return get_content_hash(channels_mask);
+	}
 	void _b_copy_channel_from_area(Ref<VoxelBuffer> other, Vector3 src_min,
 			Vector3 src_max, Vector3 dst_min,
 			unsigned int channel);
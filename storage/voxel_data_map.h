@@ -103,6 +103,8 @@ public:
 	// Moves the given buffer into a block of the map. The buffer is referenced,
 	// no copy is made.
 	VoxelDataBlock *set_block_buffer(VoxelVector3i bpos, Ref<VoxelBuffer> buffer);
+	// Creates a block filled with default voxels if there is none at this position
+	VoxelDataBlock *get_or_create_block_at_voxel_pos(VoxelVector3i pos);
 
 	struct NoAction {
 		inline void operator()(VoxelDataBlock *block) {}
@@ -193,7 +195,6 @@ public:
 
 private:
 	void set_block(VoxelVector3i bpos, VoxelDataBlock *block);
-	VoxelDataBlock *get_or_create_block_at_voxel_pos(VoxelVector3i pos);
 	VoxelDataBlock *create_default_block(VoxelVector3i bpos);
 	void remove_block_internal(VoxelVector3i bpos, unsigned int index);
 
@@ -29,7 +29,9 @@
 /**************************************************************************/
 
 #include "vox_data.h"
+#include "../util/funcs.h"
 #include "../util/macros.h"
+#include "../util/serialization.h"
 
 #include <core/io/file_access.h>
 #include <core/variant/variant.h>
@@ -84,29 +86,31 @@ uint32_t g_default_palette[PALETTE_SIZE] = {
 	0xff555555, 0xff444444, 0xff222222, 0xff111111
 };
 
-static Error parse_string(Ref<FileAccess> f, String &s) {
-	ERR_FAIL_NULL_V(f, FAILED);
-	const int size = f->get_32();
+using VoxelUtility::MemoryReader;
+
+static Error parse_string(MemoryReader &r, String &s) {
+	const int size = r.get_32();
 
 	// Sanity checks
 	ERR_FAIL_COND_V(size < 0, ERR_INVALID_DATA);
 	ERR_FAIL_COND_V(size > 4096, ERR_INVALID_DATA);
-
-	static thread_local std::vector<char> bytes;
-	bytes.resize(size);
-	ERR_FAIL_COND_V(f->get_buffer((uint8_t *)bytes.data(), bytes.size()) !=
-					bytes.size(),
+	ERR_FAIL_COND_V(static_cast<size_t>(size) > r.get_remaining_size(),
 			ERR_PARSE_ERROR);
 
+	// Decoded straight from the file buffer, no intermediary copy
+	const Span<const uint8_t> bytes = r.get_span(size);
+
 	s.clear();
-	ERR_FAIL_COND_V(s.parse_utf8(bytes.data(), bytes.size()), ERR_PARSE_ERROR);
+	ERR_FAIL_COND_V(s.parse_utf8(reinterpret_cast<const char *>(bytes.data()),
+							bytes.size()),
+			ERR_PARSE_ERROR);
 
 	return OK;
 }
 
-static Error parse_dictionary(Ref<FileAccess> f,
+static Error parse_dictionary(MemoryReader &r,
 		std::unordered_map<String, String> &dict) {
-	const int item_count = f->get_32();
+	const int item_count = r.get_32();
 
 	// Sanity checks
 	ERR_FAIL_COND_V(item_count < 0, ERR_INVALID_DATA);
@@ -116,11 +120,11 @@ static Error parse_dictionary(Ref<FileAccess> f,
 
 	for (int i = 0; i < item_count; ++i) {
 		String key;
-		Error key_err = parse_string(f, key);
+		Error key_err = parse_string(r, key);
 		ERR_FAIL_COND_V(key_err != OK, key_err);
 
 		String value;
-		Error value_err = parse_string(f, value);
+		Error value_err = parse_string(r, value);
 		ERR_FAIL_COND_V(value_err != OK, value_err);
 
 		dict[key] = value;
@@ -208,17 +212,17 @@ static Basis parse_basis(uint8_t data) {
 }
 
 Error parse_node_common_header(
-		Node &node, Ref<FileAccess> f,
+		Node &node, MemoryReader &r,
 		const std::unordered_map<int, std::unique_ptr<Node>> &scene_graph) {
 	//
-	const int node_id = f->get_32();
+	const int node_id = r.get_32();
 	ERR_FAIL_COND_V_MSG(
 			scene_graph.find(node_id) != scene_graph.end(), ERR_INVALID_DATA,
 			String("Node with ID {0} already exists").format(varray(node_id)));
 
 	node.id = node_id;
 
-	const Error attributes_err = parse_dictionary(f, node.attributes);
+	const Error attributes_err = parse_dictionary(r, node.attributes);
 	ERR_FAIL_COND_V(attributes_err != OK, attributes_err);
 
 	return OK;
@@ -226,6 +230,135 @@ Error parse_node_common_header(
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+uint8_t Model::get_color_index(VoxelVector3i pos) const {
+	ERR_FAIL_COND_V(pos.x < 0 || pos.y < 0 || pos.z < 0, 0);
+	ERR_FAIL_COND_V(pos.x >= size.x || pos.y >= size.y || pos.z >= size.z, 0);
+	const VoxelVector3i bpos(pos.x >> BRICK_SIZE_PO2, pos.y >> BRICK_SIZE_PO2,
+			pos.z >> BRICK_SIZE_PO2);
+	const unsigned int brick_index = bpos.get_zxy_index(get_brick_count());
+	uint8_t color_index = 0;
+	// Later voxels win, like when they are scattered into a grid
+	for (uint32_t i = brick_offsets[brick_index]; i < brick_offsets[brick_index + 1]; ++i) {
+		const Voxel &v = voxels[i];
+		if (v.x == pos.x && v.y == pos.y && v.z == pos.z) {
+			color_index = v.color_index;
+		}
+	}
+	return color_index;
+}
+
+void Model::build_bricks() {
+	const VoxelVector3i brick_count = get_brick_count();
+	brick_offsets.clear();
+	brick_offsets.resize(brick_count.volume() + 1, 0);
+
+	static thread_local std::vector<uint32_t> voxel_bricks;
+	voxel_bricks.resize(voxels.size());
+
+	// Counting sort, which keeps the order of voxels within bricks
+	for (size_t i = 0; i < voxels.size(); ++i) {
+		const Voxel &v = voxels[i];
+		const VoxelVector3i bpos(v.x >> BRICK_SIZE_PO2, v.y >> BRICK_SIZE_PO2,
+				v.z >> BRICK_SIZE_PO2);
+		const uint32_t brick_index = bpos.get_zxy_index(brick_count);
+		voxel_bricks[i] = brick_index;
+		++brick_offsets[brick_index + 1];
+	}
+	for (size_t i = 1; i < brick_offsets.size(); ++i) {
+		brick_offsets[i] += brick_offsets[i - 1];
+	}
+
+	static thread_local std::vector<uint32_t> write_offsets;
+	write_offsets.assign(brick_offsets.begin(), brick_offsets.end() - 1);
+	std::vector<Voxel> sorted_voxels;
+	sorted_voxels.resize(voxels.size());
+	for (size_t i = 0; i < voxels.size(); ++i) {
+		sorted_voxels[write_offsets[voxel_bricks[i]]++] = voxels[i];
+	}
+	voxels = std::move(sorted_voxels);
+}
+
+void Model::downsample(Model &dst) const {
+	dst.size = VoxelVector3i((size.x + 1) >> 1, (size.y + 1) >> 1, (size.z + 1) >> 1);
+	dst.voxels.clear();
+
+	// Bricks have an even size, so each of them covers whole voxels of the
+	// result and can be processed on its own
+	static const unsigned int HALF_BRICK_SIZE = BRICK_SIZE / 2;
+	FixedArray<uint8_t, BRICK_SIZE * BRICK_SIZE * BRICK_SIZE> brick_colors;
+	const VoxelVector3i brick_count = get_brick_count();
+	const unsigned int brick_volume = brick_count.volume();
+
+	for (unsigned int brick_index = 0; brick_index < brick_volume; ++brick_index) {
+		if (is_brick_empty(brick_index)) {
+			continue;
+		}
+		const VoxelVector3i bpos = VoxelVector3i::from_zxy_index(brick_index, brick_count);
+		const VoxelVector3i origin(bpos.x * BRICK_SIZE, bpos.y * BRICK_SIZE,
+				bpos.z * BRICK_SIZE);
+
+		// Local ZXY grid of the brick
+		brick_colors.fill(0);
+		for (uint32_t i = brick_offsets[brick_index]; i < brick_offsets[brick_index + 1]; ++i) {
+			const Voxel &v = voxels[i];
+			const unsigned int lx = v.x - origin.x;
+			const unsigned int ly = v.y - origin.y;
+			const unsigned int lz = v.z - origin.z;
+			brick_colors[ly + BRICK_SIZE * (lx + BRICK_SIZE * lz)] = v.color_index;
+		}
+
+		for (unsigned int cz = 0; cz < HALF_BRICK_SIZE; ++cz) {
+			for (unsigned int cx = 0; cx < HALF_BRICK_SIZE; ++cx) {
+				for (unsigned int cy = 0; cy < HALF_BRICK_SIZE; ++cy) {
+					uint8_t colors[8];
+					unsigned int color_count = 0;
+					for (unsigned int j = 0; j < 8; ++j) {
+						const unsigned int lx = cx * 2 + (j & 1);
+						const unsigned int ly = cy * 2 + ((j >> 1) & 1);
+						const unsigned int lz = cz * 2 + ((j >> 2) & 1);
+						const uint8_t c = brick_colors[ly + BRICK_SIZE * (lx + BRICK_SIZE * lz)];
+						if (c != 0) {
+							colors[color_count++] = c;
+						}
+					}
+					if (color_count == 0) {
+						continue;
+					}
+
+					uint8_t best_color = colors[0];
+					unsigned int best_count = 0;
+					for (unsigned int a = 0; a < color_count; ++a) {
+						unsigned int count = 0;
+						for (unsigned int b = 0; b < color_count; ++b) {
+							count += (colors[a] == colors[b]);
+						}
+						if (count > best_count) {
+							best_count = count;
+							best_color = colors[a];
+						}
+					}
+
+					Voxel v;
+					v.x = (origin.x >> 1) + cx;
+					v.y = (origin.y >> 1) + cy;
+					v.z = (origin.z >> 1) + cz;
+					v.color_index = best_color;
+					dst.voxels.push_back(v);
+				}
+			}
+		}
+	}
+
+	dst.build_bricks();
+}
+
+uint64_t Model::get_content_hash() const {
+	uint64_t h = hash_value_64(size);
+	return hash_buffer_64(voxels.data(), voxels.size() * sizeof(Voxel), h);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void Data::clear() {
 	_models.clear();
 	_scene_graph.clear();
@@ -234,98 +367,151 @@ void Data::clear() {
 }
 
 Error Data::load_from_file(String fpath) {
-	const Error err = _load_from_file(fpath);
+	PRINT_VERBOSE(String("Loading ") + fpath);
+
+	Error open_err;
+	Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::READ, &open_err);
+	if (f.is_null()) {
+		return open_err;
+	}
+
+	// The whole file is read at once, chunks are then decoded from memory.
+	// Reading voxels one by one from FileAccess was much slower than the I/O.
+	static thread_local std::vector<uint8_t> file_data;
+	file_data.resize(f->get_length());
+	ERR_FAIL_COND_V(f->get_buffer(file_data.data(), file_data.size()) !=
+					file_data.size(),
+			ERR_FILE_CANT_READ);
+	f.unref();
+
+	const Error err = load_from_memory(to_span_const(file_data));
+	// Don't keep big files around
+	if (file_data.size() > 1024 * 1024) {
+		file_data = std::vector<uint8_t>();
+	}
+
+	if (err == OK) {
+		PRINT_VERBOSE(String("Done loading ") + fpath);
+	}
+	return err;
+}
+
+Error Data::load_from_memory(Span<const uint8_t> data) {
+	const Error err = _load_from_memory(data);
 	if (err != OK) {
 		clear();
 	}
 	return err;
 }
 
-Error Data::_load_from_file(String fpath) {
+// Decodes voxels of an XYZI chunk into a sparse model
+static Error parse_xyzi(Span<const uint8_t> xyzi, Model &model) {
+	// Voxels are in MagicaVoxel coordinates, where X, Y and Z map to Z, X and Y
+	// in OpenGL coordinates
+	const unsigned int mx_max = model.size.z;
+	const unsigned int my_max = model.size.x;
+	const unsigned int mz_max = model.size.y;
+
+	model.voxels.resize(xyzi.size() / 4);
+
+	Model::Voxel *dst = model.voxels.data();
+	const uint8_t *src = xyzi.data();
+	const uint8_t *src_end = src + xyzi.size();
+
+	for (; src != src_end; src += 4, ++dst) {
+		const unsigned int mx = src[0];
+		const unsigned int my = src[1];
+		const unsigned int mz = src[2];
+		ERR_FAIL_COND_V(mx >= mx_max || my >= my_max || mz >= mz_max,
+				ERR_PARSE_ERROR);
+		dst->x = my;
+		dst->y = mz;
+		dst->z = mx;
+		dst->color_index = src[3];
+	}
+
+	model.build_bricks();
+
+	return OK;
+}
+
+Error Data::_load_from_memory(Span<const uint8_t> data) {
 	// https://github.com/ephtracy/voxel-model/blob/master/MagicaVoxel-file-format-vox.txt
 	// https://github.com/ephtracy/voxel-model/blob/master/MagicaVoxel-file-format-vox-extension.txt
 
-	PRINT_VERBOSE(String("Loading ") + fpath);
-
-	Error open_err;
-	Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::READ, &open_err);
-	if (f.is_null()) {
-		return open_err;
-	}
+	MemoryReader f(data, VoxelUtility::ENDIANESS_LITTLE_ENDIAN);
 
-	char magic[5] = { 0 };
-	ERR_FAIL_COND_V(f->get_buffer((uint8_t *)magic, 4) != 4, ERR_PARSE_ERROR);
-	ERR_FAIL_COND_V(strcmp(magic, "VOX ") != 0, ERR_PARSE_ERROR);
+	ERR_FAIL_COND_V(f.get_remaining_size() < 8, ERR_PARSE_ERROR);
+	const Span<const uint8_t> magic = f.get_span(4);
+	ERR_FAIL_COND_V(memcmp(magic.data(), "VOX ", 4) != 0, ERR_PARSE_ERROR);
 
-	const uint32_t version = f->get_32();
+	const uint32_t version = f.get_32();
 	ERR_FAIL_COND_V(version != 150, ERR_PARSE_ERROR);
 
-	const size_t file_length = f->get_length();
-
 	VoxelVector3i last_size;
 
 	clear();
 
-	while (f->get_position() < file_length) {
+	while (f.get_remaining_size() > 0) {
+		ERR_FAIL_COND_V(f.get_remaining_size() < 12, ERR_PARSE_ERROR);
+
 		char chunk_id[5] = { 0 };
-		ERR_FAIL_COND_V(f->get_buffer((uint8_t *)chunk_id, 4) != 4, ERR_PARSE_ERROR);
+		memcpy(chunk_id, f.get_span(4).data(), 4);
 
-		const uint32_t chunk_size = f->get_32();
-		f->get_32(); // child_chunks_size
+		const uint32_t chunk_size = f.get_32();
+		f.get_32(); // child_chunks_size
 
 		PRINT_VERBOSE(String("Reading chunk {0} at {1}, size={2}")
-							  .format(varray(chunk_id, f->get_position(), chunk_size)));
+							  .format(varray(chunk_id, (int64_t)f.pos, chunk_size)));
+
+		// Child chunks are not part of the content, they follow it like regular
+		// chunks. Content gets its own reader, so a chunk can't read further than
+		// its declared size.
+		ERR_FAIL_COND_V(chunk_size > f.get_remaining_size(), ERR_PARSE_ERROR);
+		MemoryReader r(f.get_span(chunk_size), VoxelUtility::ENDIANESS_LITTLE_ENDIAN);
 
 		if (strcmp(chunk_id, "SIZE") == 0) {
+			ERR_FAIL_COND_V(r.get_remaining_size() < 12, ERR_PARSE_ERROR);
 			VoxelVector3i size;
-			size.x = f->get_32();
-			size.y = f->get_32();
-			size.z = f->get_32();
-			ERR_FAIL_COND_V(size.x > 256, ERR_PARSE_ERROR);
-			ERR_FAIL_COND_V(size.y > 256, ERR_PARSE_ERROR);
-			ERR_FAIL_COND_V(size.z > 256, ERR_PARSE_ERROR);
+			size.x = r.get_32();
+			size.y = r.get_32();
+			size.z = r.get_32();
+			ERR_FAIL_COND_V(size.x > 256 || size.x < 0, ERR_PARSE_ERROR);
+			ERR_FAIL_COND_V(size.y > 256 || size.y < 0, ERR_PARSE_ERROR);
+			ERR_FAIL_COND_V(size.z > 256 || size.z < 0, ERR_PARSE_ERROR);
 			last_size = magica_to_opengl(size);
 
 		} else if (strcmp(chunk_id, "XYZI") == 0) {
 			std::unique_ptr<Model> model = std::make_unique<Model>();
-			model->color_indexes.resize(last_size.x * last_size.y * last_size.z, 0);
 			model->size = last_size;
 
-			const uint32_t num_voxels = f->get_32();
-
-			for (uint32_t i = 0; i < num_voxels; ++i) {
-				VoxelVector3i pos;
-				pos.x = f->get_8();
-				pos.y = f->get_8();
-				pos.z = f->get_8();
-				const uint32_t c = f->get_8();
-				pos = magica_to_opengl(pos);
-				ERR_FAIL_COND_V(pos.x >= model->size.x || pos.x < 0, ERR_PARSE_ERROR);
-				ERR_FAIL_COND_V(pos.y >= model->size.y || pos.y < 0, ERR_PARSE_ERROR);
-				ERR_FAIL_COND_V(pos.z >= model->size.z || pos.z < 0, ERR_PARSE_ERROR);
-				model->color_indexes[pos.get_zxy_index(model->size)] = c;
-			}
+			ERR_FAIL_COND_V(r.get_remaining_size() < 4, ERR_PARSE_ERROR);
+			const uint32_t num_voxels = r.get_32();
+			ERR_FAIL_COND_V(num_voxels > r.get_remaining_size() / 4, ERR_PARSE_ERROR);
+
+			const Error xyzi_err = parse_xyzi(r.get_span(num_voxels * 4), *model);
+			ERR_FAIL_COND_V(xyzi_err != OK, xyzi_err);
 
 			_models.push_back(std::move(model));
 
 		} else if (strcmp(chunk_id, "RGBA") == 0) {
+			ERR_FAIL_COND_V(r.get_remaining_size() < _palette.size() * 4,
+					ERR_PARSE_ERROR);
+			// Colors are shifted by one, index 0 is always empty and the last color
+			// of the chunk is unused
+			const uint8_t *src = r.get_span(_palette.size() * 4).data();
 			_palette[0] = Color8{ 0, 0, 0, 0 };
 			for (uint32_t i = 1; i < _palette.size(); ++i) {
-				Color8 c;
-				c.r = f->get_8();
-				c.g = f->get_8();
-				c.b = f->get_8();
-				c.a = f->get_8();
-				_palette[i] = c;
+				const uint8_t *c = src + (i - 1) * 4;
+				_palette[i] = Color8{ c[0], c[1], c[2], c[3] };
 			}
-			f->get_32();
 
 		} else if (strcmp(chunk_id, "nTRN") == 0) {
 			std::unique_ptr<TransformNode> node_ptr =
 					std::make_unique<TransformNode>();
 			TransformNode &node = *node_ptr;
 
-			Error header_err = parse_node_common_header(node, f, _scene_graph);
+			Error header_err = parse_node_common_header(node, r, _scene_graph);
 			ERR_FAIL_COND_V(header_err != OK, header_err);
 
 			auto name_it = node.attributes.find("_name");
@@ -340,19 +526,19 @@ Error Data::_load_from_file(String fpath) {
 				node.hidden = false;
 			}
 
-			node.child_node_id = f->get_32();
+			node.child_node_id = r.get_32();
 
-			const int reserved_id = f->get_32();
+			const int reserved_id = r.get_32();
 			ERR_FAIL_COND_V(reserved_id != -1, ERR_INVALID_DATA);
 
-			node.layer_id = f->get_32();
+			node.layer_id = r.get_32();
 
-			const int frame_count = f->get_32();
+			const int frame_count = r.get_32();
 			ERR_FAIL_COND_V(frame_count != 1, ERR_INVALID_DATA);
 
 			// for (int frame_index = 0; frame_index < frame_count; ++frame_index) {
 			std::unordered_map<String, String> frame;
-			const Error frame_err = parse_dictionary(f, frame);
+			const Error frame_err = parse_dictionary(r, frame);
 			ERR_FAIL_COND_V(frame_err != OK, frame_err);
 
 			auto t_it = frame.find("_t");
@@ -383,16 +569,16 @@ Error Data::_load_from_file(String fpath) {
 			std::unique_ptr<GroupNode> node_ptr = std::make_unique<GroupNode>();
 			GroupNode &node = *node_ptr;
 
-			Error header_err = parse_node_common_header(node, f, _scene_graph);
+			Error header_err = parse_node_common_header(node, r, _scene_graph);
 			ERR_FAIL_COND_V(header_err != OK, header_err);
 
-			const unsigned int child_count = f->get_32();
+			const unsigned int child_count = r.get_32();
 			// Sanity check
 			ERR_FAIL_COND_V(child_count > 65536, ERR_INVALID_DATA);
 			node.child_node_ids.resize(child_count);
 
 			for (unsigned int i = 0; i < child_count; ++i) {
-				node.child_node_ids[i] = f->get_32();
+				node.child_node_ids[i] = r.get_32();
 			}
 
 			_scene_graph[node.id] = std::move(node_ptr);
@@ -401,18 +587,18 @@ Error Data::_load_from_file(String fpath) {
 			std::unique_ptr<ShapeNode> node_ptr = std::make_unique<ShapeNode>();
 			ShapeNode &node = *node_ptr;
 
-			Error header_err = parse_node_common_header(node, f, _scene_graph);
+			Error header_err = parse_node_common_header(node, r, _scene_graph);
 			ERR_FAIL_COND_V(header_err != OK, header_err);
 
-			const unsigned int model_count = f->get_32();
+			const unsigned int model_count = r.get_32();
 			ERR_FAIL_COND_V(model_count != 1, ERR_INVALID_DATA);
 
 			// for (unsigned int i = 0; i < model_count; ++i) {
-			node.model_id = f->get_32();
+			node.model_id = r.get_32();
 			ERR_FAIL_COND_V(node.model_id > 65536, ERR_INVALID_DATA);
 			ERR_FAIL_COND_V(node.model_id < 0, ERR_INVALID_DATA);
 
-			Error model_attributes_err = parse_dictionary(f, node.model_attributes);
+			Error model_attributes_err = parse_dictionary(r, node.model_attributes);
 			ERR_FAIL_COND_V(model_attributes_err != OK, model_attributes_err);
 
 			//}
@@ -423,7 +609,7 @@ Error Data::_load_from_file(String fpath) {
 			std::unique_ptr<Layer> layer_ptr = std::make_unique<Layer>();
 			Layer &layer = *layer_ptr;
 
-			const int layer_id = f->get_32();
+			const int layer_id = r.get_32();
 			for (unsigned int i = 0; i < _layers.size(); ++i) {
 				const Layer *existing_layer = _layers[i].get();
 				CRASH_COND(existing_layer == nullptr);
@@ -433,7 +619,7 @@ Error Data::_load_from_file(String fpath) {
 			}
 			layer.id = layer_id;
 
-			Error attributes_err = parse_dictionary(f, layer.attributes);
+			Error attributes_err = parse_dictionary(r, layer.attributes);
 			ERR_FAIL_COND_V(attributes_err != OK, attributes_err);
 
 			auto name_it = layer.attributes.find("_name");
@@ -448,7 +634,7 @@ Error Data::_load_from_file(String fpath) {
 				layer.hidden = false;
 			}
 
-			const int reserved_id = f->get_32();
+			const int reserved_id = r.get_32();
 			ERR_FAIL_COND_V(reserved_id != -1, ERR_INVALID_DATA);
 
 			_layers.push_back(std::move(layer_ptr));
@@ -457,7 +643,7 @@ Error Data::_load_from_file(String fpath) {
 			std::unique_ptr<Material> material_ptr = std::make_unique<Material>();
 			Material &material = *material_ptr;
 
-			const int material_id = f->get_32();
+			const int material_id = r.get_32();
 			ERR_FAIL_COND_V(material_id < 0 ||
 							material_id > static_cast<int>(_palette.size()),
 					ERR_INVALID_DATA);
@@ -467,7 +653,7 @@ Error Data::_load_from_file(String fpath) {
 			material.id = material_id;
 
 			std::unordered_map<String, String> attributes;
-			Error attributes_err = parse_dictionary(f, attributes);
+			Error attributes_err = parse_dictionary(r, attributes);
 			ERR_FAIL_COND_V(attributes_err != OK, attributes_err);
 
 			auto type_it = attributes.find("_type");
@@ -523,8 +709,7 @@ Error Data::_load_from_file(String fpath) {
 
 		} else {
 			PRINT_VERBOSE(String("Skipping chunk ") + chunk_id);
-			// Ignore chunk
-			f->seek(f->get_position() + chunk_size);
+			// Ignore chunk, its content was already skipped
 		}
 	}
 
@@ -614,8 +799,6 @@ Error Data::_load_from_file(String fpath) {
 				"Root node not found");
 	}
 
-	PRINT_VERBOSE(String("Done loading ") + fpath);
-
 	return OK;
 }
 
@@ -642,6 +825,55 @@ int Data::get_root_node_id() const {
 	return _root_node_id;
 }
 
+Error Data::get_shape_instances(std::vector<ShapeInstance> &instances) const {
+	instances.clear();
+	if (_root_node_id == -1) {
+		return OK;
+	}
+	return _get_shape_instances(_root_node_id, Transform3D(), 0, instances);
+}
+
+Error Data::_get_shape_instances(int node_id, const Transform3D &parent_transform,
+		int depth, std::vector<ShapeInstance> &instances) const {
+	ERR_FAIL_COND_V(depth > 10, ERR_INVALID_DATA);
+	const Node *node = get_node(node_id);
+
+	switch (node->type) {
+		case Node::TYPE_TRANSFORM: {
+			const TransformNode *transform_node =
+					reinterpret_cast<const TransformNode *>(node);
+			const Transform3D transform = parent_transform *
+					Transform3D(transform_node->rotation.basis,
+							transform_node->position.to_vec3());
+			return _get_shape_instances(transform_node->child_node_id, transform,
+					depth + 1, instances);
+		}
+
+		case Node::TYPE_GROUP: {
+			const GroupNode *group_node = reinterpret_cast<const GroupNode *>(node);
+			for (size_t i = 0; i < group_node->child_node_ids.size(); ++i) {
+				const Error err = _get_shape_instances(group_node->child_node_ids[i],
+						parent_transform, depth + 1, instances);
+				ERR_FAIL_COND_V(err != OK, err);
+			}
+		} break;
+
+		case Node::TYPE_SHAPE: {
+			const ShapeNode *shape_node = reinterpret_cast<const ShapeNode *>(node);
+			ShapeInstance instance;
+			instance.model_id = shape_node->model_id;
+			instance.transform = parent_transform;
+			instances.push_back(instance);
+		} break;
+
+		default:
+			ERR_FAIL_V(ERR_INVALID_DATA);
+			break;
+	}
+
+	return OK;
+}
+
 unsigned int Data::get_layer_count() const {
 	return _layers.size();
 }
@@ -34,9 +34,12 @@
 #include "../util/fixed_array.h"
 #include "../util/math/color8.h"
 #include "../util/math/voxel_vector3i.h"
+#include "../util/span.h"
 
 #include <core/math/basis.h>
+#include <core/math/transform_3d.h>
 #include <core/string/ustring.h>
+#include <cstring>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -50,12 +53,74 @@ struct hash<String> {
 
 namespace vox {
 struct Model {
+	// Voxels are grouped in cubic bricks of this size
+	static const unsigned int BRICK_SIZE_PO2 = 3;
+	static const unsigned int BRICK_SIZE = 1 << BRICK_SIZE_PO2;
+
+	// Position is in OpenGL coordinates, like `size`
+	struct Voxel {
+		uint8_t x;
+		uint8_t y;
+		uint8_t z;
+		uint8_t color_index;
+	};
+
 	VoxelVector3i size;
-	// TODO Optimization: implement lazy loading/streaming to reduce intermediary
-	// memory allocations? Loading a full 256^3 model needs 16 megabytes, but a
-	// lot of areas might actually be uniform, and we might not need the actual
-	// model immediately
-	std::vector<uint8_t> color_indexes;
+	// Only voxels present in the file are stored. A dense 256^3 model would take
+	// 16 megabytes, while most of it is usually empty. Voxels are sorted by brick,
+	// in ZXY order of bricks, and keep the order of the file within a brick.
+	std::vector<Voxel> voxels;
+	// Index of the first voxel of each brick in `voxels`, followed by the total
+	// count of voxels. A brick is empty if its offset equals the next one.
+	std::vector<uint32_t> brick_offsets;
+
+	inline VoxelVector3i get_brick_count() const {
+		return VoxelVector3i(
+				(size.x + BRICK_SIZE - 1) >> BRICK_SIZE_PO2,
+				(size.y + BRICK_SIZE - 1) >> BRICK_SIZE_PO2,
+				(size.z + BRICK_SIZE - 1) >> BRICK_SIZE_PO2);
+	}
+
+	inline bool is_brick_empty(unsigned int brick_index) const {
+		return brick_offsets[brick_index] == brick_offsets[brick_index + 1];
+	}
+
+	// Returns 0 if there is no voxel at this position
+	uint8_t get_color_index(VoxelVector3i pos) const;
+
+	// Groups voxels by brick. `voxels` must contain positions within `size`.
+	void build_bricks();
+
+	// Halves the resolution of the model. Each voxel of `dst` gets the most
+	// common color of the voxels it covers, and is empty only if all of them are.
+	void downsample(Model &dst) const;
+
+	// Models with the same voxels in the same order have the same hash
+	uint64_t get_content_hash() const;
+
+	inline bool has_same_content(const Model &other) const {
+		return size == other.size && voxels.size() == other.voxels.size() &&
+				memcmp(voxels.data(), other.voxels.data(),
+						voxels.size() * sizeof(Voxel)) == 0;
+	}
+
+	// Writes converted color indexes of voxels into a dense ZXY grid, with the
+	// origin of the model at `dst_min`. Cells without voxels are left untouched.
+	template <typename T, typename Convert_F>
+	void scatter_zxy(Span<T> dst, VoxelVector3i dst_size, VoxelVector3i dst_min,
+			Convert_F convert) const {
+		CRASH_COND(dst_size.x < dst_min.x + size.x);
+		CRASH_COND(dst_size.y < dst_min.y + size.y);
+		CRASH_COND(dst_size.z < dst_min.z + size.z);
+		CRASH_COND(dst.size() != static_cast<size_t>(dst_size.volume()));
+		const unsigned int x_stride = dst_size.y;
+		const unsigned int z_stride = dst_size.y * dst_size.x;
+		T *dst_origin = dst.data() + dst_min.get_zxy_index(dst_size);
+		for (auto it = voxels.begin(); it != voxels.end(); ++it) {
+			const Voxel v = *it;
+			dst_origin[v.y + v.x * x_stride + v.z * z_stride] = convert(v.color_index);
+		}
+	}
 };
 
 struct Node {
@@ -130,10 +195,19 @@ struct Material {
 	// TODO WTF is `_plastic`?
 };
 
+// Shape of the scene graph, with the transform of all its parents combined.
+// The center of the model is at the origin of that transform.
+struct ShapeInstance {
+	int model_id;
+	Transform3D transform;
+};
+
 class Data {
 public:
 	void clear();
 	Error load_from_file(String fpath);
+	// Same as `load_from_file`, with the contents of a file already in memory
+	Error load_from_memory(Span<const uint8_t> data);
 
 	unsigned int get_model_count() const;
 	const Model &get_model(unsigned int index) const;
@@ -142,6 +216,10 @@ public:
 	int get_root_node_id() const;
 	const Node *get_node(int id) const;
 
+	// Flattens the scene graph into the list of shapes it contains.
+	// Leaves the list empty if there is no scene graph.
+	Error get_shape_instances(std::vector<ShapeInstance> &instances) const;
+
 	unsigned int get_layer_count() const;
 	const Layer &get_layer_by_index(unsigned int index) const;
 
@@ -151,7 +229,9 @@ public:
 	inline const FixedArray<Color8, 256> &get_palette() const { return _palette; }
 
 private:
-	Error _load_from_file(String fpath);
+	Error _load_from_memory(Span<const uint8_t> data);
+	Error _get_shape_instances(int node_id, const Transform3D &parent_transform,
+			int depth, std::vector<ShapeInstance> &instances) const;
 
 	std::vector<std::unique_ptr<Model>> _models;
 	std::vector<std::unique_ptr<Layer>> _layers;
@@ -31,8 +31,99 @@
 #include "vox_loader.h"
 #include "../meshers/cubes/voxel_color_palette.h"
 #include "../storage/voxel_buffer.h"
+#include "../storage/voxel_data_map.h"
 #include "vox_data.h"
 
+namespace {
+// Values to store for each color index, so remapping voxels is a single table
+// lookup. Either the index itself if a palette is used, or the packed color.
+struct PaletteLut {
+	FixedArray<uint8_t, 256> values_8;
+	FixedArray<uint16_t, 256> values_16;
+
+	PaletteLut(Span<const Color8> src_palette, bool indexed) {
+		for (unsigned int i = 0; i < src_palette.size(); ++i) {
+			values_8[i] = indexed ? i : src_palette[i].to_u8();
+			values_16[i] = indexed ? i : src_palette[i].to_u16();
+		}
+	}
+};
+
+// Writes voxels of a model transformed by a rotation and a translation. Both are
+// made of integers, so voxels map to exactly one voxel each.
+struct ModelPlacement {
+	VoxelVector3i x_axis;
+	VoxelVector3i y_axis;
+	VoxelVector3i z_axis;
+	VoxelVector3i origin;
+
+	ModelPlacement(const vox::Model &model, const Transform3D &instance_transform) {
+		// Models are centered on their instance, like the importer does. Voxel
+		// centers are transformed, so their cell can be found with a floor.
+		const Vector3 pivot = (model.size / VoxelVector3i(2, 2, 2)).to_vec3();
+		const Transform3D t =
+				instance_transform * Transform3D(Basis(), Vector3(0.5, 0.5, 0.5) - pivot);
+		const Vector3 bx = t.basis.get_column(0);
+		const Vector3 by = t.basis.get_column(1);
+		const Vector3 bz = t.basis.get_column(2);
+		x_axis = VoxelVector3i(Math::round(bx.x), Math::round(bx.y), Math::round(bx.z));
+		y_axis = VoxelVector3i(Math::round(by.x), Math::round(by.y), Math::round(by.z));
+		z_axis = VoxelVector3i(Math::round(bz.x), Math::round(bz.y), Math::round(bz.z));
+		origin = VoxelVector3i(Math::floor(t.origin.x), Math::floor(t.origin.y),
+				Math::floor(t.origin.z));
+	}
+
+	inline VoxelVector3i xform(const vox::Model::Voxel &v) const {
+		return VoxelVector3i(
+				origin.x + x_axis.x * v.x + y_axis.x * v.y + z_axis.x * v.z,
+				origin.y + x_axis.y * v.x + y_axis.y * v.y + z_axis.y * v.z,
+				origin.z + x_axis.z * v.x + y_axis.z * v.y + z_axis.z * v.z);
+	}
+};
+
+// Remembers the last block written to, since consecutive voxels of a brick
+// almost always end up in the same one
+struct BlockWriter {
+	VoxelDataMap &map;
+	const PaletteLut &lut;
+	const VoxelBuffer::ChannelId channel;
+	VoxelDataBlock *block = nullptr;
+	VoxelVector3i block_pos;
+	VoxelBuffer::Depth depth;
+	Span<uint8_t> raw;
+
+	BlockWriter(VoxelDataMap &p_map, const PaletteLut &p_lut,
+			VoxelBuffer::ChannelId p_channel) :
+			map(p_map), lut(p_lut), channel(p_channel) {}
+
+	inline bool write(VoxelVector3i pos, uint8_t color_index) {
+		const VoxelVector3i bpos = map.voxel_to_block(pos);
+		if (block == nullptr || bpos != block_pos) {
+			block = map.get_or_create_block_at_voxel_pos(pos);
+			ERR_FAIL_COND_V(block == nullptr, false);
+			block_pos = bpos;
+			Ref<VoxelBuffer> voxels = block->voxels;
+			voxels->decompress_channel(channel);
+			depth = voxels->get_channel_depth(channel);
+			ERR_FAIL_COND_V(!voxels->get_channel_raw(channel, raw), false);
+		}
+		const unsigned int i =
+				map.to_local(pos).get_zxy_index(VoxelVector3i(map.get_block_size()));
+		switch (depth) {
+			case VoxelBuffer::DEPTH_8_BIT:
+				raw[i] = lut.values_8[color_index];
+				break;
+			case VoxelBuffer::DEPTH_16_BIT:
+				reinterpret_cast<uint16_t *>(raw.data())[i] = lut.values_16[color_index];
+				break;
+			default:
+				ERR_FAIL_V_MSG(false, "Unsupported depth");
+		}
+		return true;
+	}
+};
+} // namespace
+
 Error VoxelVoxLoader::load_from_file(String fpath, Ref<VoxelBuffer> voxels,
 		Ref<VoxelColorPalette> palette) {
 	ERR_FAIL_COND_V(voxels.is_null(), ERR_INVALID_PARAMETER);
@@ -50,6 +141,9 @@ Error VoxelVoxLoader::load_from_file(String fpath, Ref<VoxelBuffer> voxels,
 
 	Span<uint8_t> dst_raw;
 	voxels->create(model.size);
+	// Only voxels of the model get written, other cells must be empty.
+	// Color index 0 is empty, and so is its color.
+	voxels->clear_channel(channel, 0);
 	voxels->decompress_channel(channel);
 	CRASH_COND(!voxels->get_channel_raw(channel, dst_raw));
 
@@ -57,49 +151,76 @@ Error VoxelVoxLoader::load_from_file(String fpath, Ref<VoxelBuffer> voxels,
 		for (size_t i = 0; i < src_palette.size(); ++i) {
 			palette->set_color8(i, src_palette[i]);
 		}
+	}
+	const PaletteLut lut(src_palette, palette.is_valid());
 
-		switch (depth) {
-			case VoxelBuffer::DEPTH_8_BIT: {
-				memcpy(dst_raw.data(), model.color_indexes.data(),
-						model.color_indexes.size());
-			} break;
-
-			case VoxelBuffer::DEPTH_16_BIT: {
-				Span<uint16_t> dst = dst_raw.reinterpret_cast_to<uint16_t>();
-				for (size_t i = 0; i < dst.size(); ++i) {
-					dst[i] = model.color_indexes[i];
-				}
-			} break;
+	switch (depth) {
+		case VoxelBuffer::DEPTH_8_BIT: {
+			model.scatter_zxy(dst_raw, model.size, VoxelVector3i(),
+					[&lut](uint8_t ci) { return lut.values_8[ci]; });
+		} break;
 
-			default:
-				ERR_FAIL_V_MSG(ERR_INVALID_PARAMETER, "Unsupported depth");
-				break;
+		case VoxelBuffer::DEPTH_16_BIT: {
+			Span<uint16_t> dst = dst_raw.reinterpret_cast_to<uint16_t>();
+			model.scatter_zxy(dst, model.size, VoxelVector3i(),
+					[&lut](uint8_t ci) { return lut.values_16[ci]; });
+		} break;
+
+		default:
+			ERR_FAIL_V_MSG(ERR_INVALID_PARAMETER, "Unsupported depth");
+			break;
+	}
+
+	return load_err;
+}
+
+Error VoxelVoxLoader::load_scene_from_file(String fpath, VoxelDataMap &map,
+		Ref<VoxelColorPalette> palette) {
+	vox::Data data;
+	const Error load_err = data.load_from_file(fpath);
+	ERR_FAIL_COND_V(load_err != OK, load_err);
+	return load_scene(data, map, palette);
+}
+
+Error VoxelVoxLoader::load_scene(const vox::Data &data, VoxelDataMap &map,
+		Ref<VoxelColorPalette> palette) {
+	Span<const Color8> src_palette = to_span_const(data.get_palette());
+	if (palette.is_valid()) {
+		for (size_t i = 0; i < src_palette.size(); ++i) {
+			palette->set_color8(i, src_palette[i]);
 		}
+	}
+	const PaletteLut lut(src_palette, palette.is_valid());
 
-	} else {
-		switch (depth) {
-			case VoxelBuffer::DEPTH_8_BIT: {
-				for (size_t i = 0; i < dst_raw.size(); ++i) {
-					const uint8_t ci = model.color_indexes[i];
-					dst_raw[i] = src_palette[ci].to_u8();
-				}
-			} break;
-
-			case VoxelBuffer::DEPTH_16_BIT: {
-				Span<uint16_t> dst = dst_raw.reinterpret_cast_to<uint16_t>();
-				for (size_t i = 0; i < dst.size(); ++i) {
-					const uint8_t ci = model.color_indexes[i];
-					dst[i] = src_palette[ci].to_u16();
-				}
-			} break;
+	std::vector<vox::ShapeInstance> instances;
+	const Error err = data.get_shape_instances(instances);
+	ERR_FAIL_COND_V(err != OK, err);
 
-			default:
-				ERR_FAIL_V_MSG(ERR_INVALID_PARAMETER, "Unsupported depth");
-				break;
+	if (instances.size() == 0 && data.get_model_count() > 0) {
+		// Without scene graph, there is only one model. Its lower corner goes at
+		// the origin, like `load_from_file` does.
+		const vox::Model &model = data.get_model(0);
+		vox::ShapeInstance instance;
+		instance.model_id = 0;
+		instance.transform.origin = (model.size / VoxelVector3i(2, 2, 2)).to_vec3();
+		instances.push_back(instance);
+	}
+
+	BlockWriter writer(map, lut, VoxelBuffer::CHANNEL_COLOR);
+
+	// Voxels are written straight into blocks of the map, so memory only grows
+	// with the blocks the scene actually touches
+	for (size_t instance_index = 0; instance_index < instances.size(); ++instance_index) {
+		const vox::ShapeInstance &instance = instances[instance_index];
+		const vox::Model &model = data.get_model(instance.model_id);
+		const ModelPlacement placement(model, instance.transform);
+
+		for (auto it = model.voxels.begin(); it != model.voxels.end(); ++it) {
+			ERR_FAIL_COND_V(!writer.write(placement.xform(*it), it->color_index), ERR_BUG);
 		}
 	}
 
-	return load_err;
+	return OK;
 }
 
 void VoxelVoxLoader::_bind_methods() {
@@ -35,6 +35,11 @@
 
 class VoxelBuffer;
 class VoxelColorPalette;
+class VoxelDataMap;
+
+namespace vox {
+class Data;
+} // namespace vox
 
 // Simple loader for MagicaVoxel
 class VoxelVoxLoader : public RefCounted {
@@ -42,9 +47,20 @@ class VoxelVoxLoader : public RefCounted {
 	;
 
 public:
+	// Loads the first model of the file into a buffer
 	Error load_from_file(String fpath, Ref<VoxelBuffer> voxels,
 			Ref<VoxelColorPalette> palette);
-	// TODO Have chunked loading for better memory usage
+
+	// Loads all shapes of the scene into the color channel of a map, with their
+	// transforms applied. Only blocks containing voxels are created, and no
+	// buffer covering the whole scene is allocated. If a palette is given,
+	// voxels store color indexes and the palette gets filled, otherwise they
+	// store packed colors. The map must not be in use by other threads.
+	static Error load_scene_from_file(String fpath, VoxelDataMap &map,
+			Ref<VoxelColorPalette> palette);
+	static Error load_scene(const vox::Data &data, VoxelDataMap &map,
+			Ref<VoxelColorPalette> palette);
+
 	// TODO Saving
 
 private:
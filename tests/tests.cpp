@@ -29,12 +29,22 @@
 /**************************************************************************/
 
 #include "tests.h"
+#include "../meshers/blocky/voxel_mesher_blocky.h"
+#include "../meshers/cubes/voxel_color_palette.h"
+#include "../meshers/cubes/voxel_mesher_cubes.h"
+#include "../meshers/mesh_optimization.h"
 #include "../storage/voxel_data_map.h"
+#include "../streams/vox_data.h"
+#include "../streams/vox_loader.h"
 #include "../util/island_finder.h"
+#include "../util/lru_cache.h"
 #include "../util/math/box3i.h"
+#include "../util/serialization.h"
 
+#include "modules/modules_enabled.gen.h" // For meshoptimizer.
 #include <core/string/print_string.h>
 #include <core/templates/hash_map.h>
+#include <scene/resources/mesh.h>
 
 void test_voxel_data_map_paste_fill() {
 	static const int voxel_value = 1;
@@ -301,6 +311,1136 @@ void test_unordered_remove_if() {
 	}
 }
 
+void test_voxel_buffer_content_hash() {
+	static const int channel = VoxelBuffer::CHANNEL_TYPE;
+
+	Ref<VoxelBuffer> a;
+	a.instantiate();
+	a->create(16, 16, 16);
+	a->decompress_channel(channel);
+	a->set_voxel(1, 2, 3, 4, channel);
+
+	Ref<VoxelBuffer> b;
+	b.instantiate();
+	b->create(16, 16, 16);
+	b->decompress_channel(channel);
+	b->set_voxel(1, 2, 3, 4, channel);
+
+	const uint32_t mask = (1 << channel);
+
+	// Same content
+	ERR_FAIL_COND(a->get_content_hash(mask) != b->get_content_hash(mask));
+
+	// Different voxel
+	b->set_voxel(2, 2, 3, 4, channel);
+	ERR_FAIL_COND(a->get_content_hash(mask) == b->get_content_hash(mask));
+
+	// Channels outside of the mask don't matter
+	b->set_voxel(1, 2, 3, 4, channel);
+	b->set_voxel(42, 0, 0, 0, VoxelBuffer::CHANNEL_COLOR);
+	ERR_FAIL_COND(a->get_content_hash(mask) != b->get_content_hash(mask));
+
+	// Uniform channels
+	a->fill(3, channel);
+	b->fill(3, channel);
+	ERR_FAIL_COND(a->get_content_hash(mask) != b->get_content_hash(mask));
+	b->fill(4, channel);
+	ERR_FAIL_COND(a->get_content_hash(mask) == b->get_content_hash(mask));
+
+	// Different size
+	b->create(16, 16, 15);
+	b->fill(3, channel);
+	ERR_FAIL_COND(a->get_content_hash(mask) == b->get_content_hash(mask));
+}
+
+void test_lru_cache() {
+	LruCache<int, int> cache;
+	cache.set_capacity(2);
+	cache.put(1, 10);
+	cache.put(2, 20);
+
+	int value = 0;
+	ERR_FAIL_COND(!cache.try_get(1, value));
+	ERR_FAIL_COND(value != 10);
+
+	// 2 is the least recently used, so it gets evicted
+	cache.put(3, 30);
+	ERR_FAIL_COND(cache.get_size() != 2);
+	ERR_FAIL_COND(!cache.has(1));
+	ERR_FAIL_COND(cache.has(2));
+	ERR_FAIL_COND(!cache.has(3));
+
+	// Replacing a value doesn't evict anything
+	cache.put(1, 11);
+	ERR_FAIL_COND(cache.get_size() != 2);
+	ERR_FAIL_COND(!cache.try_get(1, value));
+	ERR_FAIL_COND(value != 11);
+
+	cache.set_capacity(1);
+	ERR_FAIL_COND(cache.get_size() != 1);
+	ERR_FAIL_COND(!cache.has(1));
+
+	cache.clear();
+	ERR_FAIL_COND(cache.get_size() != 0);
+}
+
+#ifdef MODULE_MESHOPTIMIZER_ENABLED
+void test_mesh_optimization() {
+	// Flat grid with shared vertices, which can be simplified without error
+	static const int grid_size = 8;
+	static const int row_size = grid_size + 1;
+
+	PackedVector3Array positions;
+	PackedColorArray colors;
+	PackedInt32Array indices;
+	for (int z = 0; z < row_size; ++z) {
+		for (int x = 0; x < row_size; ++x) {
+			positions.push_back(Vector3(x, 0, z));
+			// Encode position in another attribute, to check it gets remapped along
+			colors.push_back(Color(x, 0, z));
+		}
+	}
+	for (int z = 0; z < grid_size; ++z) {
+		for (int x = 0; x < grid_size; ++x) {
+			const int i = x + z * row_size;
+			indices.push_back(i);
+			indices.push_back(i + row_size);
+			indices.push_back(i + 1);
+			indices.push_back(i + 1);
+			indices.push_back(i + row_size);
+			indices.push_back(i + row_size + 1);
+		}
+	}
+
+	Array surface;
+	surface.resize(Mesh::ARRAY_MAX);
+	surface[Mesh::ARRAY_VERTEX] = positions;
+	surface[Mesh::ARRAY_COLOR] = colors;
+	surface[Mesh::ARRAY_INDEX] = indices;
+
+	MeshOptimizationParams params;
+	params.optimize = true;
+	params.lod_count = 2;
+	params.lod_error = 0.01f;
+
+	Dictionary lods;
+	optimize_surface(surface, lods, params);
+
+	const PackedVector3Array dst_positions = surface[Mesh::ARRAY_VERTEX];
+	const PackedColorArray dst_colors = surface[Mesh::ARRAY_COLOR];
+	const PackedInt32Array dst_indices = surface[Mesh::ARRAY_INDEX];
+
+	// Optimizing doesn't change geometry
+	ERR_FAIL_COND(dst_indices.size() != indices.size());
+	ERR_FAIL_COND(dst_positions.size() != positions.size());
+	ERR_FAIL_COND(dst_colors.size() != dst_positions.size());
+	for (int i = 0; i < dst_positions.size(); ++i) {
+		const Vector3 p = dst_positions[i];
+		const Color c = dst_colors[i];
+		ERR_FAIL_COND(p != Vector3(c.r, c.g, c.b));
+	}
+	for (int i = 0; i < dst_indices.size(); ++i) {
+		ERR_FAIL_COND(dst_indices[i] < 0 || dst_indices[i] >= dst_positions.size());
+	}
+
+	// A flat grid can be simplified
+	ERR_FAIL_COND(lods.size() == 0);
+	const Array lod_errors = lods.keys();
+	int prev_index_count = dst_indices.size();
+	for (int i = 0; i < lod_errors.size(); ++i) {
+		const PackedInt32Array lod_indices = lods[lod_errors[i]];
+		ERR_FAIL_COND(lod_indices.size() == 0);
+		ERR_FAIL_COND(lod_indices.size() % 3 != 0);
+		ERR_FAIL_COND(lod_indices.size() >= prev_index_count);
+		std::vector<uint8_t> used_vertices;
+		used_vertices.resize(dst_positions.size(), 0);
+		for (int j = 0; j < lod_indices.size(); ++j) {
+			ERR_FAIL_COND(lod_indices[j] < 0 || lod_indices[j] >= dst_positions.size());
+			used_vertices[lod_indices[j]] = 1;
+		}
+		// The outline is locked, so all vertices along it are still there
+		for (int j = 0; j < dst_positions.size(); ++j) {
+			const Vector3 p = dst_positions[j];
+			if (p.x == 0 || p.z == 0 || p.x == grid_size || p.z == grid_size) {
+				ERR_FAIL_COND(used_vertices[j] == 0);
+			}
+		}
+		prev_index_count = lod_indices.size();
+	}
+}
+
+void test_mesh_optimization_weld() {
+	// Two quads sharing an edge, but with separate vertices like meshers output.
+	// Vertices of the shared edge are equal, except one having another UV.
+	PackedVector3Array positions;
+	PackedVector2Array uvs;
+	PackedInt32Array indices;
+	for (int quad = 0; quad < 2; ++quad) {
+		const int i0 = positions.size();
+		positions.push_back(Vector3(quad, 0, 0));
+		positions.push_back(Vector3(quad, 0, 1));
+		positions.push_back(Vector3(quad + 1, 0, 0));
+		positions.push_back(Vector3(quad + 1, 0, 1));
+		for (int i = 0; i < 4; ++i) {
+			uvs.push_back(Vector2());
+		}
+		indices.push_back(i0);
+		indices.push_back(i0 + 1);
+		indices.push_back(i0 + 2);
+		indices.push_back(i0 + 2);
+		indices.push_back(i0 + 1);
+		indices.push_back(i0 + 3);
+	}
+	// First vertex of the second quad is at a seam
+	uvs.set(4, Vector2(1, 0));
+
+	Array surface;
+	surface.resize(Mesh::ARRAY_MAX);
+	surface[Mesh::ARRAY_VERTEX] = positions;
+	surface[Mesh::ARRAY_TEX_UV] = uvs;
+	surface[Mesh::ARRAY_INDEX] = indices;
+
+	MeshOptimizationParams params;
+	params.optimize = true;
+	Dictionary lods;
+	optimize_surface(surface, lods, params);
+
+	const PackedVector3Array dst_positions = surface[Mesh::ARRAY_VERTEX];
+	const PackedVector2Array dst_uvs = surface[Mesh::ARRAY_TEX_UV];
+	const PackedInt32Array dst_indices = surface[Mesh::ARRAY_INDEX];
+	// Only the vertex with the same UV got merged
+	ERR_FAIL_COND(dst_positions.size() != 7);
+	ERR_FAIL_COND(dst_uvs.size() != 7);
+	ERR_FAIL_COND(dst_indices.size() != indices.size());
+	for (int i = 0; i < dst_indices.size(); ++i) {
+		const int src_i = indices[i];
+		const int dst_i = dst_indices[i];
+		ERR_FAIL_COND(dst_positions[dst_i] != positions[src_i]);
+		ERR_FAIL_COND(dst_uvs[dst_i] != uvs[src_i]);
+	}
+}
+#endif // MODULE_MESHOPTIMIZER_ENABLED
+
+// Common setup of blocky mesher tests: the default library, a mesher using it
+// and an empty dense buffer. More voxel types can be added to the library
+// before building.
+struct BlockyMesherTest {
+	static const int channel = VoxelBuffer::CHANNEL_TYPE;
+
+	Ref<VoxelLibrary> library;
+	Ref<VoxelMesherBlocky> mesher;
+	Ref<VoxelBuffer> voxels;
+
+	BlockyMesherTest(const VoxelVector3i buffer_size, unsigned int voxel_count = 2,
+			VoxelBuffer::Depth depth = VoxelBuffer::DEPTH_8_BIT) {
+		library.instantiate();
+		library->load_default();
+		library->set_voxel_count(MAX(voxel_count, library->get_voxel_count()));
+
+		mesher.instantiate();
+		mesher->set_library(library);
+
+		voxels.instantiate();
+		voxels->create(buffer_size);
+		voxels->set_channel_depth(channel, depth);
+		voxels->decompress_channel(channel);
+	}
+
+	Ref<Voxel> add_cube(unsigned int id, const String &name) {
+		Ref<Voxel> voxel = library->create_voxel(id, name);
+		voxel->set_geometry_type(Voxel::GEOMETRY_CUBE);
+		return voxel;
+	}
+
+	void set_voxel(uint64_t value, int x, int y, int z) {
+		voxels->set_voxel(value, x, y, z, channel);
+	}
+
+	void build(VoxelMesher::Output &output) {
+		library->bake();
+		const VoxelMesher::Input input = { **voxels, 0 };
+		mesher->build(output, input);
+	}
+
+	// Returns an empty array if the surface has no geometry
+	Array build_surface(unsigned int surface_index = 0) {
+		VoxelMesher::Output output;
+		build(output);
+		if (static_cast<int>(surface_index) >= output.surfaces.size()) {
+			return Array();
+		}
+		return output.surfaces[surface_index];
+	}
+
+	void build_collision(VoxelMesher::CollisionOutput &output, uint32_t collision_mask) {
+		library->bake();
+		const VoxelMesher::Input input = { **voxels, 0 };
+		mesher->build_collision(output, input, collision_mask);
+	}
+
+	// The blocky mesher outputs each quad as 4 consecutive vertices
+	static Vector3 get_quad_center(const PackedVector3Array &positions, int first_vertex) {
+		return (positions[first_vertex] + positions[first_vertex + 1] + positions[first_vertex + 2] +
+					   positions[first_vertex + 3]) *
+				0.25f;
+	}
+
+	static int find_quad(const PackedVector3Array &positions, const Vector3 center) {
+		for (int i = 0; i + 3 < positions.size(); i += 4) {
+			if (get_quad_center(positions, i) == center) {
+				return i;
+			}
+		}
+		return -1;
+	}
+};
+
+void test_voxel_mesher_blocky_culling() {
+	BlockyMesherTest test(VoxelVector3i(5, 5, 5));
+	test.mesher->set_occlusion_enabled(true);
+	// Cube A, cube B next to it along X, and cube C on top of B
+	const VoxelVector3i cubes[] = { VoxelVector3i(1, 1, 1), VoxelVector3i(2, 1, 1), VoxelVector3i(2, 2, 1) };
+	for (unsigned int i = 0; i < 3; ++i) {
+		test.set_voxel(1, cubes[i].x, cubes[i].y, cubes[i].z);
+	}
+
+	const Array surface = test.build_surface();
+	ERR_FAIL_COND(surface.is_empty());
+	const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+	const PackedColorArray colors = surface[Mesh::ARRAY_COLOR];
+	const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+
+	// 3 cubes with 2 pairs of touching faces
+	const int face_count = 3 * 6 - 2 * 2;
+	ERR_FAIL_COND(positions.size() != face_count * 4);
+	ERR_FAIL_COND(indices.size() != face_count * 6);
+
+	// Exactly the faces not touching another cube
+	for (unsigned int i = 0; i < 3; ++i) {
+		// Buffer coordinates include padding
+		const Vector3 cube_center = (cubes[i] - VoxelVector3i(1, 1, 1)).to_vec3() + Vector3(0.5, 0.5, 0.5);
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			const VoxelVector3i normal = Cube::g_side_normals[side];
+			bool touching = false;
+			for (unsigned int j = 0; j < 3; ++j) {
+				touching |= cubes[i] + normal == cubes[j];
+			}
+			const int quad = BlockyMesherTest::find_quad(positions, cube_center + normal.to_vec3() * 0.5f);
+			ERR_FAIL_COND((quad == -1) != touching);
+		}
+	}
+
+	// C occludes the top face of A along the edge A shares with B
+	const int top_quad = BlockyMesherTest::find_quad(positions, Vector3(0.5, 1, 0.5));
+	ERR_FAIL_COND(top_quad == -1);
+	for (int i = top_quad; i < top_quad + 4; ++i) {
+		const bool occluded = colors[i].r < 1.f;
+		ERR_FAIL_COND(occluded != (positions[i].x == 1.f));
+	}
+}
+
+void test_voxel_mesher_blocky_greedy_meshing() {
+	// Flat slab of 4x1x4 cubes, surrounded by air padding
+	BlockyMesherTest test(VoxelVector3i(6, 3, 6));
+	test.mesher->set_occlusion_enabled(false);
+	test.mesher->set_greedy_meshing_enabled(true);
+	for (int z = 1; z < 5; ++z) {
+		for (int x = 1; x < 5; ++x) {
+			test.set_voxel(1, x, 1, z);
+		}
+	}
+
+	const Array surface = test.build_surface();
+	ERR_FAIL_COND(surface.is_empty());
+	const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+	const PackedVector2Array uv2s = surface[Mesh::ARRAY_TEX_UV2];
+
+	// Each side of the slab becomes a single quad covering all of it
+	const Vector3 slab_size(4, 1, 4);
+	ERR_FAIL_COND(positions.size() != 6 * 4);
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		const Vector3 normal = Cube::g_side_normals[side].to_vec3();
+		const Vector3 center = slab_size * 0.5f + normal * slab_size * 0.5f;
+		const int quad = BlockyMesherTest::find_quad(positions, center);
+		ERR_FAIL_COND(quad == -1);
+		for (int i = quad; i < quad + 4; ++i) {
+			const Vector3 p = positions[i];
+			for (unsigned int axis = 0; axis < VoxelVector3i::AXIS_COUNT; ++axis) {
+				ERR_FAIL_COND(p[axis] != 0.f && p[axis] != slab_size[axis]);
+			}
+		}
+	}
+
+	ERR_FAIL_COND(uv2s.size() != positions.size());
+	for (int i = 0; i < uv2s.size(); ++i) {
+		ERR_FAIL_COND(uv2s[i].x < 0.f);
+	}
+}
+
+void test_voxel_mesher_blocky_depths() {
+	const VoxelBuffer::Depth depths[] = {
+		VoxelBuffer::DEPTH_8_BIT, VoxelBuffer::DEPTH_16_BIT, VoxelBuffer::DEPTH_32_BIT
+	};
+
+	Array reference_surface;
+
+	for (unsigned int depth_index = 0; depth_index < 3; ++depth_index) {
+		BlockyMesherTest test(VoxelVector3i(8, 8, 8), 2, depths[depth_index]);
+		test.mesher->set_occlusion_enabled(true);
+		// Some arbitrary shape, including values out of the library
+		for (int z = 1; z < 7; ++z) {
+			for (int x = 1; x < 7; ++x) {
+				for (int y = 1; y < 7; ++y) {
+					const int v = (x * 3 + y * 5 + z * 7) % 4;
+					test.set_voxel(v == 3 ? 200 : (v != 0 ? 1 : 0), x, y, z);
+				}
+			}
+		}
+
+		const Array surface = test.build_surface();
+		ERR_FAIL_COND(surface.is_empty());
+
+		if (depth_index == 0) {
+			reference_surface = surface;
+			continue;
+		}
+
+		// All depths must produce the same mesh
+		for (int array_index = 0; array_index < Mesh::ARRAY_MAX; ++array_index) {
+			ERR_FAIL_COND(surface[array_index] != reference_surface[array_index]);
+		}
+	}
+}
+
+void test_voxel_mesher_blocky_large_ids() {
+	// ID needing more bits than a 16-bit channel has, and more than greedy
+	// masks used to reserve for IDs
+	static const unsigned int large_id = 200000;
+	// Row of two cubes with a different type, so they can't merge with each other
+	BlockyMesherTest test(VoxelVector3i(4, 3, 3), large_id + 1, VoxelBuffer::DEPTH_32_BIT);
+	test.add_cube(large_id, "large")->set_color(Color(1, 0, 0));
+	test.mesher->set_occlusion_enabled(true);
+	test.mesher->set_greedy_meshing_enabled(true);
+	test.set_voxel(1, 1, 1, 1);
+	test.set_voxel(large_id, 2, 1, 1);
+
+	const Array surface = test.build_surface();
+	ERR_FAIL_COND(surface.is_empty());
+	const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+	const PackedColorArray colors = surface[Mesh::ARRAY_COLOR];
+
+	// 5 faces per cube, none of them merged across types
+	ERR_FAIL_COND(positions.size() != 2 * 5 * 4);
+	ERR_FAIL_COND(colors.size() != positions.size());
+	// Faces of the second cube must have its color, not the first cube's, which
+	// would be the case if its ID got truncated
+	int large_id_face_count = 0;
+	for (int i = 0; i < positions.size(); i += 4) {
+		const bool red = colors[i].g == 0.f;
+		ERR_FAIL_COND(red != (BlockyMesherTest::get_quad_center(positions, i).x > 1));
+		if (red) {
+			++large_id_face_count;
+		}
+	}
+	ERR_FAIL_COND(large_id_face_count != 5);
+}
+
+void test_voxel_mesher_blocky_transparent_surfaces() {
+	// One opaque cube, followed by a row of glass along Z
+	BlockyMesherTest test(VoxelVector3i(3, 3, 6), 3);
+	test.add_cube(2, "glass")->set_transparency_index(1);
+	test.mesher->set_transparent_surfaces_enabled(true);
+	test.mesher->set_transparent_sorting(VoxelMesherBlocky::TRANSPARENT_SORTING_DIRECTION);
+	test.mesher->set_transparent_sort_direction(Vector3(0, 0, -1));
+	test.set_voxel(1, 1, 1, 1);
+	for (int z = 2; z < 5; ++z) {
+		test.set_voxel(2, 1, 1, z);
+	}
+
+	VoxelMesher::Output output;
+	test.build(output);
+
+	ERR_FAIL_COND(output.surfaces.size() != VoxelMesherBlocky::MAX_SURFACES);
+	ERR_FAIL_COND(output.ordered_surfaces_mask != (uint64_t(1) << VoxelMesherBlocky::MAX_MATERIALS));
+
+	// Opaque cube, with the face touching glass still visible
+	const Array opaque_surface = output.surfaces[0];
+	ERR_FAIL_COND(opaque_surface.is_empty());
+	const PackedVector3Array opaque_positions = opaque_surface[Mesh::ARRAY_VERTEX];
+	const PackedInt32Array opaque_indices = opaque_surface[Mesh::ARRAY_INDEX];
+	ERR_FAIL_COND(opaque_indices.size() != 6 * 6);
+	ERR_FAIL_COND(BlockyMesherTest::find_quad(opaque_positions, Vector3(0.5, 0.5, 1)) == -1);
+
+	// Glass, without faces between glass voxels nor the one hidden by the cube,
+	// sorted back to front
+	const Array transparent_surface = output.surfaces[VoxelMesherBlocky::MAX_MATERIALS];
+	ERR_FAIL_COND(transparent_surface.is_empty());
+	const PackedVector3Array positions = transparent_surface[Mesh::ARRAY_VERTEX];
+	const PackedInt32Array indices = transparent_surface[Mesh::ARRAY_INDEX];
+	ERR_FAIL_COND(indices.size() != (3 * 6 - 2 * 2 - 1) * 6);
+	for (int z = 1; z < 4; ++z) {
+		ERR_FAIL_COND(BlockyMesherTest::find_quad(positions, Vector3(0.5, 0.5, z)) != -1);
+	}
+
+	real_t prev_z = -1.0;
+	for (int i = 0; i < indices.size(); i += 3) {
+		const real_t z = positions[indices[i]].z + positions[indices[i + 1]].z + positions[indices[i + 2]].z;
+		ERR_FAIL_COND(z < prev_z);
+		prev_z = z;
+	}
+}
+
+void test_voxel_mesher_blocky_collision() {
+	// Slab of 4x2x4 cubes, and a cube on a different layer on top of it
+	BlockyMesherTest test(VoxelVector3i(6, 5, 6), 3);
+	test.add_cube(2, "ghost")->set_collision_mask(2);
+	for (int z = 1; z < 5; ++z) {
+		for (int x = 1; x < 5; ++x) {
+			for (int y = 1; y < 3; ++y) {
+				test.set_voxel(1, x, y, z);
+			}
+		}
+	}
+	test.set_voxel(2, 2, 3, 2);
+
+	struct L {
+		static bool is_on_box_sides(const Vector3 p, const Vector3 box_min, const Vector3 box_max) {
+			bool on_side = false;
+			for (unsigned int axis = 0; axis < VoxelVector3i::AXIS_COUNT; ++axis) {
+				if (p[axis] < box_min[axis] || p[axis] > box_max[axis]) {
+					return false;
+				}
+				on_side |= p[axis] == box_min[axis] || p[axis] == box_max[axis];
+			}
+			return on_side;
+		}
+	};
+
+	VoxelMesher::CollisionOutput output;
+	test.build_collision(output, 1);
+
+	// The slab becomes a box, not hiding anything under the other cube
+	ERR_FAIL_COND(output.positions.size() != 6 * 4);
+	ERR_FAIL_COND(output.indices.size() != 6 * 6);
+	for (int i = 0; i < output.indices.size(); ++i) {
+		ERR_FAIL_COND(output.indices[i] < 0 || output.indices[i] >= output.positions.size());
+	}
+	for (int i = 0; i < output.positions.size(); ++i) {
+		const Vector3 p = output.positions[i];
+		ERR_FAIL_COND(p.x != 0.f && p.x != 4.f);
+		ERR_FAIL_COND(p.y != 0.f && p.y != 2.f);
+		ERR_FAIL_COND(p.z != 0.f && p.z != 4.f);
+	}
+
+	// Only the other cube
+	VoxelMesher::CollisionOutput output2;
+	test.build_collision(output2, 2);
+	ERR_FAIL_COND(output2.positions.size() != 6 * 4);
+	for (int i = 0; i < output2.positions.size(); ++i) {
+		ERR_FAIL_COND(!L::is_on_box_sides(output2.positions[i], Vector3(1, 2, 1), Vector3(2, 3, 2)));
+	}
+}
+
+// Unit cube with a quad inside, crossing it along X
+Ref<Mesh> make_cube_mesh_with_inner_quad() {
+	PackedVector3Array positions;
+	PackedVector3Array normals;
+	PackedVector2Array uvs;
+	PackedInt32Array indices;
+
+	const Vector2 quad_corners[4] = { Vector2(0, 0), Vector2(1, 0), Vector2(1, 1), Vector2(0, 1) };
+
+	struct L {
+		static void add_quad(PackedVector3Array &positions, PackedVector3Array &normals, PackedVector2Array &uvs,
+				PackedInt32Array &indices, const Vector3 corners[4], const Vector3 normal) {
+			const int first_index = positions.size();
+			for (int i = 0; i < 4; ++i) {
+				positions.push_back(corners[i]);
+				normals.push_back(normal);
+			}
+			uvs.push_back(Vector2(0, 0));
+			uvs.push_back(Vector2(1, 0));
+			uvs.push_back(Vector2(1, 1));
+			uvs.push_back(Vector2(0, 1));
+			indices.push_back(first_index);
+			indices.push_back(first_index + 1);
+			indices.push_back(first_index + 2);
+			indices.push_back(first_index);
+			indices.push_back(first_index + 2);
+			indices.push_back(first_index + 3);
+		}
+	};
+
+	for (int axis = 0; axis < 3; ++axis) {
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		for (int side = 0; side < 2; ++side) {
+			Vector3 corners[4];
+			for (int i = 0; i < 4; ++i) {
+				corners[i][axis] = side;
+				corners[i][u] = quad_corners[i].x;
+				corners[i][v] = quad_corners[i].y;
+			}
+			Vector3 normal;
+			normal[axis] = side == 0 ? -1 : 1;
+			L::add_quad(positions, normals, uvs, indices, corners, normal);
+		}
+	}
+
+	Vector3 inner_corners[4];
+	for (int i = 0; i < 4; ++i) {
+		inner_corners[i] = Vector3(0.5, 0.25 + 0.5 * quad_corners[i].x, 0.25 + 0.5 * quad_corners[i].y);
+	}
+	L::add_quad(positions, normals, uvs, indices, inner_corners, Vector3(1, 0, 0));
+
+	Array arrays;
+	arrays.resize(Mesh::ARRAY_MAX);
+	arrays[Mesh::ARRAY_VERTEX] = positions;
+	arrays[Mesh::ARRAY_NORMAL] = normals;
+	arrays[Mesh::ARRAY_TEX_UV] = uvs;
+	arrays[Mesh::ARRAY_INDEX] = indices;
+
+	Ref<ArrayMesh> mesh;
+	mesh.instantiate();
+	mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, arrays);
+	return mesh;
+}
+
+void test_voxel_mesher_blocky_buried_inner_geometry() {
+	// A model occluding all its sides, but with geometry inside, must not be
+	// skipped when its neighbors hide all its sides
+	struct L {
+		static void make_library(BlockyMesherTest &test) {
+			Ref<Voxel> crate = test.library->create_voxel(2, "crate");
+			crate->set_geometry_type(Voxel::GEOMETRY_CUSTOM_MESH);
+			crate->set_custom_mesh(make_cube_mesh_with_inner_quad());
+			test.mesher->set_occlusion_enabled(false);
+		}
+		// Inner quads are the only ones not lying on voxel boundaries
+		static bool is_inner_quad(const PackedVector3Array &positions, int first_vertex) {
+			for (int i = first_vertex; i < first_vertex + 4; ++i) {
+				if (Math::fposmod(positions[i].x, real_t(1.0)) != real_t(0.5)) {
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	// Uniform block: only the inner quad of the only meshed voxel remains
+	{
+		BlockyMesherTest test(VoxelVector3i(3, 3, 3), 3);
+		L::make_library(test);
+		test.voxels->clear_channel(BlockyMesherTest::channel, 2);
+
+		const Array surface = test.build_surface();
+		ERR_FAIL_COND(surface.is_empty());
+		const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+		ERR_FAIL_COND(positions.size() != 4);
+		ERR_FAIL_COND(!L::is_inner_quad(positions, 0));
+		ERR_FAIL_COND(BlockyMesherTest::get_quad_center(positions, 0) != Vector3(0.5, 0.5, 0.5));
+	}
+
+	// Block where most decks are buried: only one padding corner is air, and
+	// it touches no meshed voxel by a side
+	{
+		BlockyMesherTest test(VoxelVector3i(5, 5, 5), 3);
+		L::make_library(test);
+		test.voxels->fill(2, BlockyMesherTest::channel);
+		test.set_voxel(0, 0, 0, 0);
+
+		const Array surface = test.build_surface();
+		ERR_FAIL_COND(surface.is_empty());
+		const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+		// One inner quad in the middle of each of the 3x3x3 meshed voxels, and no side
+		ERR_FAIL_COND(positions.size() != 3 * 3 * 3 * 4);
+		for (int z = 0; z < 3; ++z) {
+			for (int y = 0; y < 3; ++y) {
+				for (int x = 0; x < 3; ++x) {
+					const int quad = BlockyMesherTest::find_quad(positions, Vector3(x, y, z) + Vector3(0.5, 0.5, 0.5));
+					ERR_FAIL_COND(quad == -1);
+					ERR_FAIL_COND(!L::is_inner_quad(positions, quad));
+				}
+			}
+		}
+	}
+}
+
+void test_voxel_mesher_cubes_occlusion_diagonal() {
+	// A cube with another one touching only the corner above it. The top face
+	// of the first cube gets a single occluded vertex, and must be split along
+	// the diagonal going through that vertex.
+	static const int channel = VoxelBuffer::CHANNEL_COLOR;
+	Ref<VoxelBuffer> voxels;
+	voxels.instantiate();
+	voxels->create(5, 5, 5);
+	voxels->set_channel_depth(channel, VoxelBuffer::DEPTH_16_BIT);
+	voxels->decompress_channel(channel);
+	voxels->set_voxel(0xffff, 1, 1, 1, channel);
+	voxels->set_voxel(0xffff, 2, 2, 2, channel);
+
+	for (int greedy = 0; greedy < 2; ++greedy) {
+		Ref<VoxelMesherCubes> mesher;
+		mesher.instantiate();
+		mesher->set_color_mode(VoxelMesherCubes::COLOR_RAW);
+		mesher->set_greedy_meshing_enabled(greedy == 1);
+		mesher->set_occlusion_enabled(true);
+
+		VoxelMesher::Output output;
+		const VoxelMesher::Input input = { **voxels, 0 };
+		mesher->build(output, input);
+
+		// Triangles of the top face of the first cube
+		std::vector<int> face_indices;
+		Array face_surface;
+		for (int surface_index = 0; surface_index < output.surfaces.size(); ++surface_index) {
+			const Array surface = output.surfaces[surface_index];
+			if (surface.is_empty()) {
+				continue;
+			}
+			const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+			const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+			for (int i = 0; i < indices.size(); i += 3) {
+				bool in_face = true;
+				for (int j = 0; j < 3; ++j) {
+					const Vector3 p = positions[indices[i + j]];
+					in_face &= p.y == 1.f && p.x <= 1.f && p.z <= 1.f;
+				}
+				if (in_face) {
+					face_surface = surface;
+					face_indices.push_back(indices[i]);
+					face_indices.push_back(indices[i + 1]);
+					face_indices.push_back(indices[i + 2]);
+				}
+			}
+		}
+		ERR_FAIL_COND(face_indices.size() != 6);
+
+		const PackedVector3Array positions = face_surface[Mesh::ARRAY_VERTEX];
+		const PackedColorArray colors = face_surface[Mesh::ARRAY_COLOR];
+		ERR_FAIL_COND(colors.size() != positions.size());
+
+		// Only the vertex under the other cube is occluded
+		float unoccluded_r = 0.f;
+		for (unsigned int i = 0; i < face_indices.size(); ++i) {
+			unoccluded_r = MAX(unoccluded_r, colors[face_indices[i]].r);
+		}
+		int occluded_index = -1;
+		for (unsigned int i = 0; i < face_indices.size(); ++i) {
+			const int vi = face_indices[i];
+			if (colors[vi].r < unoccluded_r) {
+				ERR_FAIL_COND(positions[vi] != Vector3(1, 1, 1));
+				occluded_index = vi;
+			}
+		}
+		ERR_FAIL_COND(occluded_index == -1);
+
+		// The diagonal is the edge shared by both triangles
+		int shared_count = 0;
+		bool diagonal_has_occluded_vertex = false;
+		for (unsigned int i = 0; i < 3; ++i) {
+			for (unsigned int j = 3; j < 6; ++j) {
+				if (positions[face_indices[i]] == positions[face_indices[j]]) {
+					++shared_count;
+					diagonal_has_occluded_vertex |= positions[face_indices[i]] == Vector3(1, 1, 1);
+				}
+			}
+		}
+		ERR_FAIL_COND(shared_count != 2);
+		ERR_FAIL_COND(!diagonal_has_occluded_vertex);
+	}
+}
+
+void test_voxel_mesher_cubes_shader_palette_occlusion() {
+	// Cubes touching by edges and corners, so they occlude each other. Their
+	// vertex colors must still hold their palette indices.
+	static const int channel = VoxelBuffer::CHANNEL_COLOR;
+	Ref<VoxelBuffer> voxels;
+	voxels.instantiate();
+	voxels->create(5, 5, 5);
+	voxels->set_channel_depth(channel, VoxelBuffer::DEPTH_8_BIT);
+	voxels->decompress_channel(channel);
+	// Indices far enough apart that a darkened one can't match another
+	const uint8_t indices[3] = { 10, 20, 30 };
+	voxels->set_voxel(indices[0], 1, 1, 1, channel);
+	voxels->set_voxel(indices[1], 2, 2, 2, channel);
+	voxels->set_voxel(indices[2], 2, 1, 2, channel);
+
+	Ref<VoxelColorPalette> palette;
+	palette.instantiate();
+	for (int i = 0; i < 3; ++i) {
+		palette->set_color8(indices[i], Color8(255, 255, 255, 255));
+	}
+
+	Ref<VoxelMesherCubes> mesher;
+	mesher.instantiate();
+	mesher->set_color_mode(VoxelMesherCubes::COLOR_SHADER_PALETTE);
+	mesher->set_palette(palette);
+	mesher->set_occlusion_enabled(true);
+
+	VoxelMesher::Output output;
+	const VoxelMesher::Input input = { **voxels, 0 };
+	mesher->build(output, input);
+
+	ERR_FAIL_COND(output.surfaces.size() == 0);
+	const Array surface = output.surfaces[VoxelMesherCubes::MATERIAL_OPAQUE];
+	ERR_FAIL_COND(surface.is_empty());
+	const PackedColorArray colors = surface[Mesh::ARRAY_COLOR];
+	ERR_FAIL_COND(colors.size() == 0);
+
+	FixedArray<int, 3> vertex_count_per_index(0);
+	for (int i = 0; i < colors.size(); ++i) {
+		const Color c = colors[i];
+		const int index = Math::round(c.r * 255.f);
+		ERR_FAIL_COND(index % 10 != 0 || index < 10 || index > 30);
+		ERR_FAIL_COND(c.g != 0.f || c.b != 0.f || c.a != 1.f);
+		++vertex_count_per_index[index / 10 - 1];
+	}
+	for (int i = 0; i < 3; ++i) {
+		ERR_FAIL_COND(vertex_count_per_index[i] == 0);
+	}
+}
+
+void test_voxel_mesher_cubes_lod_skirts() {
+	// Block of 2x2x2 cubes surrounded by cubes, with a hole in the last voxel
+	static const int channel = VoxelBuffer::CHANNEL_COLOR;
+	Ref<VoxelBuffer> voxels;
+	voxels.instantiate();
+	voxels->create(4, 4, 4);
+	voxels->set_channel_depth(channel, VoxelBuffer::DEPTH_16_BIT);
+	voxels->fill(0xffff, channel);
+	voxels->set_voxel(0, 2, 2, 2, channel);
+
+	struct L {
+		static int get_quad_count(const Vector<Array> &surfaces) {
+			int count = 0;
+			for (int i = 0; i < surfaces.size(); ++i) {
+				const Array surface = surfaces[i];
+				if (!surface.is_empty()) {
+					const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+					count += indices.size() / 6;
+				}
+			}
+			return count;
+		}
+	};
+
+	for (int greedy = 0; greedy < 2; ++greedy) {
+		Ref<VoxelMesherCubes> mesher;
+		mesher.instantiate();
+		mesher->set_color_mode(VoxelMesherCubes::COLOR_RAW);
+		mesher->set_greedy_meshing_enabled(greedy == 1);
+
+		// No skirts at LOD 0
+		{
+			VoxelMesher::Output output;
+			const VoxelMesher::Input input = { **voxels, 0 };
+			mesher->build(output, input);
+			// Faces around the hole
+			ERR_FAIL_COND(L::get_quad_count(output.surfaces) != 6);
+			for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+				ERR_FAIL_COND(L::get_quad_count(output.transition_surfaces[side]) != 0);
+			}
+		}
+
+		VoxelMesher::Output output;
+		const VoxelMesher::Input input = { **voxels, 1 };
+		mesher->build(output, input);
+
+		// Regular surfaces don't change
+		ERR_FAIL_COND(L::get_quad_count(output.surfaces) != 6);
+
+		// Skirts only cover voxels on each side of the block, pointing outwards.
+		// Sides touching the hole have one less voxel.
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			const Vector3 normal = Cube::g_side_normals[side].to_vec3();
+			const bool positive = normal.x + normal.y + normal.z > 0;
+			const int axis = normal.x != 0 ? 0 : (normal.y != 0 ? 1 : 2);
+
+			const Vector<Array> &surfaces = output.transition_surfaces[side];
+			ERR_FAIL_COND(L::get_quad_count(surfaces) != (positive ? 3 : 4));
+
+			for (int i = 0; i < surfaces.size(); ++i) {
+				const Array surface = surfaces[i];
+				if (surface.is_empty()) {
+					continue;
+				}
+				const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+				const PackedVector3Array normals = surface[Mesh::ARRAY_NORMAL];
+				for (int j = 0; j < positions.size(); ++j) {
+					// LOD 1 geometry is scaled up to LOD 0 coordinates
+					ERR_FAIL_COND(positions[j][axis] != (positive ? 4.f : 0.f));
+					ERR_FAIL_COND(normals[j] != normal);
+				}
+			}
+		}
+	}
+
+	// Uniform block of cubes: nothing at LOD 0, and a single skirt face covering
+	// each side at LOD 1
+	Ref<VoxelBuffer> uniform_voxels;
+	uniform_voxels.instantiate();
+	uniform_voxels->create(4, 4, 4);
+	uniform_voxels->set_channel_depth(channel, VoxelBuffer::DEPTH_16_BIT);
+	uniform_voxels->clear_channel(channel, 0xffff);
+
+	for (int greedy = 0; greedy < 2; ++greedy) {
+		Ref<VoxelMesherCubes> mesher;
+		mesher.instantiate();
+		mesher->set_color_mode(VoxelMesherCubes::COLOR_RAW);
+		mesher->set_greedy_meshing_enabled(greedy == 1);
+
+		{
+			VoxelMesher::Output output;
+			const VoxelMesher::Input input = { **uniform_voxels, 0 };
+			mesher->build(output, input);
+			ERR_FAIL_COND(L::get_quad_count(output.surfaces) != 0);
+			for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+				ERR_FAIL_COND(L::get_quad_count(output.transition_surfaces[side]) != 0);
+			}
+		}
+
+		VoxelMesher::Output output;
+		const VoxelMesher::Input input = { **uniform_voxels, 1 };
+		mesher->build(output, input);
+		ERR_FAIL_COND(L::get_quad_count(output.surfaces) != 0);
+
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			const Vector3 normal = Cube::g_side_normals[side].to_vec3();
+			const bool positive = normal.x + normal.y + normal.z > 0;
+			const int axis = normal.x != 0 ? 0 : (normal.y != 0 ? 1 : 2);
+
+			const Vector<Array> &surfaces = output.transition_surfaces[side];
+			ERR_FAIL_COND(L::get_quad_count(surfaces) != 1);
+
+			// Raw 16-bit colors aren't scaled up, so their alpha below 255 puts them
+			// in the transparent surface
+			const Array surface = surfaces[VoxelMesherCubes::MATERIAL_TRANSPARENT];
+			ERR_FAIL_COND(surface.is_empty());
+			const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+			ERR_FAIL_COND(positions.size() != 4);
+			AABB box(positions[0], Vector3());
+			for (int j = 0; j < positions.size(); ++j) {
+				ERR_FAIL_COND(positions[j][axis] != (positive ? 4.f : 0.f));
+				box.expand_to(positions[j]);
+			}
+			Vector3 expected_size(4, 4, 4);
+			expected_size[axis] = 0;
+			ERR_FAIL_COND(box.size != expected_size);
+		}
+	}
+}
+
+void test_voxel_mesher_build_cached_copy() {
+	BlockyMesherTest test(VoxelVector3i(3, 3, 3));
+	test.set_voxel(1, 1, 1, 1);
+	test.library->bake();
+	Ref<VoxelMesherBlocky> mesher = test.mesher;
+	mesher->set_mesh_cache_capacity(4);
+	const VoxelMesher::Input input = { **test.voxels, 0 };
+
+	VoxelMesher::Output output;
+	mesher->build_cached(output, input);
+	ERR_FAIL_COND(output.surfaces.size() == 0);
+	Array surface = output.surfaces[0];
+	ERR_FAIL_COND(surface.is_empty());
+	const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+	ERR_FAIL_COND(positions.size() != 6 * 4);
+
+	// Modifying the output must not modify the one in the cache
+	surface[Mesh::ARRAY_VERTEX] = PackedVector3Array();
+
+	VoxelMesher::Output output2;
+	mesher->build_cached(output2, input);
+	ERR_FAIL_COND(output2.surfaces.size() == 0);
+	Array surface2 = output2.surfaces[0];
+	ERR_FAIL_COND(surface2.is_empty());
+	const PackedVector3Array positions2 = surface2[Mesh::ARRAY_VERTEX];
+	ERR_FAIL_COND(positions2.size() != 6 * 4);
+
+	// Each hit gets its own copy
+	surface2[Mesh::ARRAY_VERTEX] = PackedVector3Array();
+	VoxelMesher::Output output3;
+	mesher->build_cached(output3, input);
+	const Array surface3 = output3.surfaces[0];
+	const PackedVector3Array positions3 = surface3[Mesh::ARRAY_VERTEX];
+	ERR_FAIL_COND(positions3.size() != 6 * 4);
+}
+
+void test_voxel_library_bake_voxel() {
+	// Library with only empty voxels, which then gets a cube incrementally.
+	// That cube introduces a new side pattern, so the culling matrix has to grow.
+	Ref<VoxelLibrary> library;
+	library.instantiate();
+	library->set_voxel_count(3);
+	library->create_voxel(0, "air");
+	Ref<Voxel> voxel = library->create_voxel(1, "a");
+	library->create_voxel(2, "b");
+	library->bake();
+	voxel->set_geometry_type(Voxel::GEOMETRY_CUBE);
+	library->bake_voxel(1);
+
+	// Same library baked fully
+	Ref<VoxelLibrary> reference;
+	reference.instantiate();
+	reference->set_voxel_count(3);
+	reference->create_voxel(0, "air");
+	Ref<Voxel> reference_voxel = reference->create_voxel(1, "a");
+	reference_voxel->set_geometry_type(Voxel::GEOMETRY_CUBE);
+	reference->create_voxel(2, "b");
+	reference->bake();
+
+	const VoxelLibrary::BakedData &baked = *library->get_baked_data();
+	const VoxelLibrary::BakedData &expected = *reference->get_baked_data();
+
+	ERR_FAIL_COND(baked.voxel_flags != expected.voxel_flags);
+	ERR_FAIL_COND(baked.full_side_pattern_index == VoxelLibrary::NULL_INDEX);
+
+	// Pattern indices may differ, but not which side occludes which
+	for (unsigned int a = 0; a < 3; ++a) {
+		for (unsigned int b = 0; b < 3; ++b) {
+			for (unsigned int side_a = 0; side_a < Cube::SIDE_COUNT; ++side_a) {
+				for (unsigned int side_b = 0; side_b < Cube::SIDE_COUNT; ++side_b) {
+					const bool occlusion = baked.get_side_pattern_occlusion(
+							baked.models[a].model.side_pattern_indices[side_a],
+							baked.models[b].model.side_pattern_indices[side_b]);
+					const bool expected_occlusion = expected.get_side_pattern_occlusion(
+							expected.models[a].model.side_pattern_indices[side_a],
+							expected.models[b].model.side_pattern_indices[side_b]);
+					ERR_FAIL_COND(occlusion != expected_occlusion);
+				}
+			}
+		}
+	}
+
+	// Turning the cube back into an empty voxel leaves its patterns unused, so
+	// they are removed
+	const unsigned int cube_pattern_count = reference->get_baked_data()->side_pattern_count;
+	voxel->set_geometry_type(Voxel::GEOMETRY_NONE);
+	library->bake_voxel(1);
+	reference_voxel->set_geometry_type(Voxel::GEOMETRY_NONE);
+	reference->bake();
+	const VoxelLibrary::BakedData &baked_none = *library->get_baked_data();
+	ERR_FAIL_COND(baked_none.side_pattern_count != reference->get_baked_data()->side_pattern_count);
+	ERR_FAIL_COND(baked_none.side_pattern_count >= cube_pattern_count);
+	ERR_FAIL_COND(baked_none.full_side_pattern_index != VoxelLibrary::NULL_INDEX);
+	ERR_FAIL_COND(baked_none.voxel_flags != reference->get_baked_data()->voxel_flags);
+}
+
+// A .vox file with a 3x2x4 model containing two voxels, and no scene graph
+void make_test_vox_file(std::vector<uint8_t> &bytes) {
+	VoxelUtility::MemoryWriter w(bytes, VoxelUtility::ENDIANESS_LITTLE_ENDIAN);
+	const char *ids[] = { "VOX ", "MAIN", "SIZE", "XYZI" };
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		w.store_8(ids[0][i]);
+	}
+	w.store_32(150);
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		w.store_8(ids[1][i]);
+	}
+	w.store_32(0);
+	w.store_32(2 * 12 + 12 + 4 + 2 * 4);
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		w.store_8(ids[2][i]);
+	}
+	w.store_32(12);
+	w.store_32(0);
+	w.store_32(2);
+	w.store_32(3);
+	w.store_32(4);
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		w.store_8(ids[3][i]);
+	}
+	w.store_32(4 + 2 * 4);
+	w.store_32(0);
+	w.store_32(2);
+	// X, Y, Z, color index
+	w.store_32(0x07030201);
+	w.store_32(0x09000000);
+}
+
+void test_vox_data_load_from_memory() {
+	std::vector<uint8_t> bytes;
+	make_test_vox_file(bytes);
+
+	vox::Data data;
+	ERR_FAIL_COND(data.load_from_memory(to_span_const(bytes)) != OK);
+	ERR_FAIL_COND(data.get_model_count() != 1);
+
+	// MagicaVoxel is Z-up
+	const vox::Model &model = data.get_model(0);
+	ERR_FAIL_COND(model.size != VoxelVector3i(3, 4, 2));
+	ERR_FAIL_COND(model.voxels.size() != 2);
+	ERR_FAIL_COND(model.get_color_index(VoxelVector3i(2, 3, 1)) != 7);
+	ERR_FAIL_COND(model.get_color_index(VoxelVector3i(0, 0, 0)) != 9);
+	ERR_FAIL_COND(model.get_color_index(VoxelVector3i(1, 1, 1)) != 0);
+
+	// Voxels are scattered into a dense grid only when needed
+	std::vector<uint8_t> dense;
+	dense.resize(model.size.volume(), 0);
+	model.scatter_zxy(to_span(dense), model.size, VoxelVector3i(),
+			[](uint8_t color_index) { return color_index; });
+	ERR_FAIL_COND(dense[VoxelVector3i(2, 3, 1).get_zxy_index(model.size)] != 7);
+	unsigned int count = 0;
+	for (size_t i = 0; i < dense.size(); ++i) {
+		if (dense[i] != 0) {
+			++count;
+		}
+	}
+	ERR_FAIL_COND(count != 2);
+
+	// Truncated voxels must not be read past the end of the data
+	bytes.resize(bytes.size() - 2);
+	ERR_FAIL_COND(data.load_from_memory(to_span_const(bytes)) == OK);
+	ERR_FAIL_COND(data.get_model_count() != 0);
+}
+
+void test_vox_loader_load_scene() {
+	std::vector<uint8_t> bytes;
+	make_test_vox_file(bytes);
+	vox::Data data;
+	ERR_FAIL_COND(data.load_from_memory(to_span_const(bytes)) != OK);
+
+	const VoxelBuffer::ChannelId channel = VoxelBuffer::CHANNEL_COLOR;
+	VoxelDataMap map;
+	map.create(1, 0);
+	Ref<VoxelColorPalette> palette;
+	palette.instantiate();
+	ERR_FAIL_COND(VoxelVoxLoader::load_scene(data, map, palette) != OK);
+
+	// Without scene graph, the model has its lower corner at the origin.
+	// Only the two blocks containing voxels get created.
+	ERR_FAIL_COND(map.get_block_count() != 2);
+	ERR_FAIL_COND(map.get_voxel(VoxelVector3i(2, 3, 1), channel) != 7);
+	ERR_FAIL_COND(map.get_voxel(VoxelVector3i(0, 0, 0), channel) != 9);
+	ERR_FAIL_COND(map.get_voxel(VoxelVector3i(1, 1, 1), channel) != 0);
+	ERR_FAIL_COND(palette->get_color8(7).to_u32() != data.get_palette()[7].to_u32());
+}
+
+void test_vox_model_downsample() {
+	vox::Model model;
+	model.size = VoxelVector3i(10, 4, 3);
+	// One cell of the result covering two colors, where the most common wins
+	model.voxels.push_back({ 0, 0, 0, 5 });
+	model.voxels.push_back({ 1, 0, 0, 6 });
+	model.voxels.push_back({ 1, 1, 1, 6 });
+	// Alone in a cell of the result, across a brick boundary
+	model.voxels.push_back({ 9, 3, 2, 7 });
+	model.build_bricks();
+	ERR_FAIL_COND(model.get_color_index(VoxelVector3i(9, 3, 2)) != 7);
+
+	vox::Model half;
+	model.downsample(half);
+	ERR_FAIL_COND(half.size != VoxelVector3i(5, 2, 2));
+	ERR_FAIL_COND(half.voxels.size() != 2);
+	ERR_FAIL_COND(half.get_color_index(VoxelVector3i(0, 0, 0)) != 6);
+	ERR_FAIL_COND(half.get_color_index(VoxelVector3i(4, 1, 1)) != 7);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #define VOXEL_TEST(fname)                                     \
@@ -316,6 +1456,27 @@ void run_voxel_tests() {
 	VOXEL_TEST(test_encode_weights_packed_u16);
 	VOXEL_TEST(test_copy_3d_region_zxy);
 	VOXEL_TEST(test_unordered_remove_if);
+	VOXEL_TEST(test_voxel_buffer_content_hash);
+	VOXEL_TEST(test_lru_cache);
+#ifdef MODULE_MESHOPTIMIZER_ENABLED
+	VOXEL_TEST(test_mesh_optimization);
+	VOXEL_TEST(test_mesh_optimization_weld);
+#endif
+	VOXEL_TEST(test_voxel_mesher_blocky_culling);
+	VOXEL_TEST(test_voxel_mesher_blocky_greedy_meshing);
+	VOXEL_TEST(test_voxel_mesher_blocky_depths);
+	VOXEL_TEST(test_voxel_mesher_blocky_large_ids);
+	VOXEL_TEST(test_voxel_mesher_blocky_transparent_surfaces);
+	VOXEL_TEST(test_voxel_mesher_blocky_collision);
+	VOXEL_TEST(test_voxel_mesher_blocky_buried_inner_geometry);
+	VOXEL_TEST(test_voxel_mesher_cubes_occlusion_diagonal);
+	VOXEL_TEST(test_voxel_mesher_cubes_shader_palette_occlusion);
+	VOXEL_TEST(test_voxel_mesher_cubes_lod_skirts);
+	VOXEL_TEST(test_voxel_mesher_build_cached_copy);
+	VOXEL_TEST(test_voxel_library_bake_voxel);
+	VOXEL_TEST(test_vox_data_load_from_memory);
+	VOXEL_TEST(test_vox_loader_load_scene);
+	VOXEL_TEST(test_vox_model_downsample);
 
 	print_line("------------ Voxel tests end -------------");
 }
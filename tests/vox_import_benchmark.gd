@@ -0,0 +1,56 @@
+# Imports every .vox file of a directory without the editor, and prints timings,
+# geometry counts and static memory usage, including its peak, as JSON.
+# Requires an editor build of Godot.
+#
+# Usage:
+#   godot --headless -s tests/vox_import_benchmark.gd -- <directory> [options.json]
+#
+# Options are the same as in the import dock, like `{"vox/scene_mode": 1}`.
+# The mesh cache is off unless options turn it on, so every run meshes again.
+
+extends SceneTree
+
+
+func _init():
+	var args := OS.get_cmdline_user_args()
+	if args.size() < 1:
+		printerr("Usage: godot --headless -s vox_import_benchmark.gd -- <directory> [options.json]")
+		quit(1)
+		return
+
+	var dir_path : String = args[0]
+	var options := { "vox/use_mesh_cache": false }
+	if args.size() >= 2:
+		var parsed = JSON.parse_string(FileAccess.get_file_as_string(args[1]))
+		if typeof(parsed) != TYPE_DICTIONARY:
+			printerr("Could not parse options from ", args[1])
+			quit(1)
+			return
+		options.merge(parsed, true)
+
+	var file_names := DirAccess.get_files_at(dir_path)
+	if file_names.is_empty() and DirAccess.open(dir_path) == null:
+		printerr("Could not open ", dir_path)
+		quit(1)
+		return
+
+	var importer := VoxelVoxImporter.new()
+	var results := []
+	var start_time := Time.get_ticks_usec()
+
+	for file_name in file_names:
+		if file_name.get_extension().to_lower() != "vox":
+			continue
+		results.append(importer.benchmark_import(dir_path.path_join(file_name), options))
+
+	var report := {
+		"engine_version": Engine.get_version_info()["string"],
+		"processor_count": OS.get_processor_count(),
+		"options": options,
+		"total_usec": Time.get_ticks_usec() - start_time,
+		"static_memory": OS.get_static_memory_usage(),
+		"peak_memory": OS.get_static_memory_peak_usage(),
+		"files": results
+	}
+	print(JSON.stringify(report, "\t"))
+	quit(0)
@@ -224,4 +224,62 @@ inline bool is_uniform(const Item_T *p_data, uint32_t item_count) {
 	return true;
 }
 
+// Fast non-cryptographic 64-bit hash of a buffer (MurmurHash64A, public
+// domain). Good enough for cache keys, not suitable for security.
+inline uint64_t hash_buffer_64(const void *p_data, size_t size,
+		uint64_t seed = 0) {
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+
+	uint64_t h = seed ^ (size * m);
+
+	const uint8_t *data = static_cast<const uint8_t *>(p_data);
+	const size_t block_count = size / 8;
+	for (size_t i = 0; i < block_count; ++i) {
+		uint64_t k;
+		// memcpy handles unaligned reads and compiles to a single load
+		memcpy(&k, data + i * 8, sizeof(uint64_t));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	const uint8_t *tail = data + block_count * 8;
+	switch (size & 7) {
+		case 7:
+			h ^= uint64_t(tail[6]) << 48;
+			[[fallthrough]];
+		case 6:
+			h ^= uint64_t(tail[5]) << 40;
+			[[fallthrough]];
+		case 5:
+			h ^= uint64_t(tail[4]) << 32;
+			[[fallthrough]];
+		case 4:
+			h ^= uint64_t(tail[3]) << 24;
+			[[fallthrough]];
+		case 3:
+			h ^= uint64_t(tail[2]) << 16;
+			[[fallthrough]];
+		case 2:
+			h ^= uint64_t(tail[1]) << 8;
+			[[fallthrough]];
+		case 1:
+			h ^= uint64_t(tail[0]);
+			h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+template <typename T>
+inline uint64_t hash_value_64(const T &v, uint64_t seed = 0) {
+	return hash_buffer_64(&v, sizeof(T), seed);
+}
+
 #endif // HEADER_VOXEL_UTILITY_H
@@ -145,6 +145,33 @@ create_concave_polygon_shape(Vector<Array> surfaces) {
 	return shape;
 }
 
+// Same, for indexed triangles without surfaces
+Ref<ConcavePolygonShape3D> create_concave_polygon_shape(const Vector<Vector3> &positions,
+		const Vector<int> &indices) {
+	VOXEL_PROFILE_SCOPE();
+
+	if (indices.size() < 3) {
+		return Ref<ConcavePolygonShape3D>();
+	}
+	ERR_FAIL_COND_V(indices.size() % 3 != 0, Ref<ConcavePolygonShape3D>());
+
+	Vector<Vector3> face_points;
+	face_points.resize(indices.size());
+	Vector3 *w = face_points.ptrw();
+	const Vector3 *src_positions = positions.ptr();
+	const int *src_indices = indices.ptr();
+
+	for (int i = 0; i < indices.size(); ++i) {
+		const int index = src_indices[i];
+		ERR_FAIL_INDEX_V(index, positions.size(), Ref<ConcavePolygonShape3D>());
+		w[i] = src_positions[index];
+	}
+
+	Ref<ConcavePolygonShape3D> shape = memnew(ConcavePolygonShape3D);
+	shape->set_faces(face_points);
+	return shape;
+}
+
 int get_visible_instance_count(const MultiMesh &mm) {
 	int visible_count = mm.get_visible_instance_count();
 	if (visible_count == -1) {
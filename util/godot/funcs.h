@@ -52,6 +52,8 @@ inline bool try_call_script(const Object *obj, StringName method_name,
 }
 
 Ref<ConcavePolygonShape3D> create_concave_polygon_shape(Vector<Array> surfaces);
+Ref<ConcavePolygonShape3D> create_concave_polygon_shape(const Vector<Vector3> &positions,
+		const Vector<int> &indices);
 
 // This API can be confusing so I made a wrapper
 int get_visible_instance_count(const MultiMesh &mm);
@@ -0,0 +1,110 @@
+/**************************************************************************/
+/*  lru_cache.h                                                           */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             GODOT ENGINE                               */
+/*                        https://godotengine.org                         */
+/**************************************************************************/
+/* Copyright (c) 2014-present Godot Engine contributors (see AUTHORS.md). */
+/* Copyright (c) 2007-2014 Juan Linietsky, Ariel Manzur.                  */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef VOXEL_LRU_CACHE_H
+#define VOXEL_LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+
+// Associative cache holding a limited number of items. When full, the least
+// recently used item gets evicted to make room for new ones.
+// Not thread-safe.
+template <typename K, typename V, typename Hasher = std::hash<K>>
+class LruCache {
+public:
+	void set_capacity(unsigned int capacity) {
+		_capacity = capacity;
+		while (_items.size() > _capacity) {
+			evict_oldest();
+		}
+	}
+
+	unsigned int get_capacity() const {
+		return _capacity;
+	}
+
+	size_t get_size() const {
+		return _items.size();
+	}
+
+	// Copies the value associated to the key into `out_value` and marks it as
+	// recently used. Returns false if the key is not present.
+	bool try_get(const K &key, V &out_value) {
+		auto it = _map.find(key);
+		if (it == _map.end()) {
+			return false;
+		}
+		// Move to front
+		_items.splice(_items.begin(), _items, it->second);
+		out_value = it->second->second;
+		return true;
+	}
+
+	bool has(const K &key) const {
+		return _map.find(key) != _map.end();
+	}
+
+	void put(const K &key, const V &value) {
+		if (_capacity == 0) {
+			return;
+		}
+		auto it = _map.find(key);
+		if (it != _map.end()) {
+			it->second->second = value;
+			_items.splice(_items.begin(), _items, it->second);
+			return;
+		}
+		while (_items.size() >= _capacity) {
+			evict_oldest();
+		}
+		_items.emplace_front(key, value);
+		_map[key] = _items.begin();
+	}
+
+	void clear() {
+		_items.clear();
+		_map.clear();
+	}
+
+private:
+	void evict_oldest() {
+		_map.erase(_items.back().first);
+		_items.pop_back();
+	}
+
+	// Most recently used items come first
+	std::list<std::pair<K, V>> _items;
+	std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator, Hasher>
+			_map;
+	unsigned int _capacity = 0;
+};
+
+#endif // VOXEL_LRU_CACHE_H
@@ -147,6 +147,19 @@ struct MemoryReader {
 		m.i = get_32();
 		return m.f;
 	}
+
+	inline size_t get_remaining_size() const {
+		return data.size() - pos;
+	}
+
+	// Returns a view of the next `size` bytes and moves past them, so they can
+	// be decoded in bulk
+	inline Span<const uint8_t> get_span(size_t size) {
+		ERR_FAIL_COND_V(size > get_remaining_size(), Span<const uint8_t>());
+		const Span<const uint8_t> s(data.data() + pos, size);
+		pos += size;
+		return s;
+	}
 };
 } // namespace VoxelUtility
 
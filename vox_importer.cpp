@@ -36,15 +36,28 @@
 #include "scene/resources/material.h"
 #include "storage/voxel_buffer.h"
 #include "streams/vox_data.h"
+#include "util/funcs.h"
+#include "util/godot/direct_multimesh_instance.h"
 #include "util/godot/funcs.h"
+#include "util/profiling_clock.h"
 
 #include "scene/3d/importer_mesh_instance_3d.h"
 #include "scene/resources/importer_mesh.h"
+#include <core/config/project_settings.h>
+#include <core/io/dir_access.h>
 #include <core/io/file_access.h>
+#include <core/math/geometry_2d.h>
+#include <core/object/worker_thread_pool.h>
+#include <core/os/thread.h>
+#include <core/templates/hash_map.h>
 #include <scene/3d/mesh_instance_3d.h>
+#include <scene/3d/multimesh_instance_3d.h>
 #include <scene/3d/node_3d.h>
 #include <scene/resources/mesh.h>
 #include <scene/resources/packed_scene.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
 
 Error VoxelVoxImporter::process_scene_node_recursively(const vox::Data &data, int node_id,
 		Node3D *parent_node,
@@ -88,8 +101,7 @@ Error VoxelVoxImporter::process_scene_node_recursively(const vox::Data &data, in
 					reinterpret_cast<const vox::ShapeNode *>(vox_node);
 			const VoxMesh &mesh_data = meshes[vox_shape_node->model_id];
 			ERR_FAIL_COND_V(mesh_data.mesh.is_null(), ERR_BUG);
-			const Vector3 offset = -mesh_data.pivot;
-			add_mesh_instance(mesh_data.mesh, parent_node, root_node, offset);
+			add_mesh_instances(mesh_data, parent_node, root_node);
 		} break;
 
 		default:
@@ -100,14 +112,566 @@ Error VoxelVoxImporter::process_scene_node_recursively(const vox::Data &data, in
 	return OK;
 }
 
+namespace {
+// Increment when meshing or the format of cached outputs changes
+const uint32_t MESH_CACHE_VERSION = 2;
+// Oldest entries are removed after an import when the cache gets larger
+const uint64_t MESH_CACHE_MAX_SIZE = 256 * 1024 * 1024;
+
+// What a cached output was built from. The file name is a hash of it, and it
+// is also stored in the file, so that entries with colliding names are not
+// mistaken for each other.
+struct MeshCacheKey {
+	VoxelVector3i model_size;
+	uint64_t content_hash;
+	uint64_t settings_hash;
+	uint32_t lod_index;
+
+	uint64_t get_hash() const {
+		uint64_t h = hash_value_64(content_hash);
+		h = hash_value_64(model_size.x, h);
+		h = hash_value_64(model_size.y, h);
+		h = hash_value_64(model_size.z, h);
+		h = hash_value_64(settings_hash, h);
+		return hash_value_64(lod_index, h);
+	}
+
+	void store(FileAccess &f) const {
+		f.store_32(model_size.x);
+		f.store_32(model_size.y);
+		f.store_32(model_size.z);
+		f.store_64(content_hash);
+		f.store_64(settings_hash);
+		f.store_32(lod_index);
+	}
+
+	bool matches(FileAccess &f) const {
+		// Reading everything before comparing, some fields could be truncated
+		const int x = f.get_32();
+		const int y = f.get_32();
+		const int z = f.get_32();
+		const uint64_t file_content_hash = f.get_64();
+		const uint64_t file_settings_hash = f.get_64();
+		const uint32_t file_lod_index = f.get_32();
+		return model_size == VoxelVector3i(x, y, z) && content_hash == file_content_hash &&
+				settings_hash == file_settings_hash && lod_index == file_lod_index;
+	}
+};
+
+// Mesher outputs are stored as a dictionary of variants, with the atlas as raw
+// data since images are objects
+bool load_cached_output(String fpath, const MeshCacheKey &key, VoxelMesher::Output &output) {
+	Ref<FileAccess> f = FileAccess::open(fpath, FileAccess::READ);
+	if (f.is_null()) {
+		return false;
+	}
+	if (f->get_32() != MESH_CACHE_VERSION || !key.matches(**f)) {
+		return false;
+	}
+	const Dictionary d = f->get_var(false);
+	if (f->get_error() != OK || !d.has("surfaces")) {
+		return false;
+	}
+
+	const Array surfaces = d["surfaces"];
+	const Array surfaces_lods = d["surfaces_lods"];
+	output.surfaces.resize(surfaces.size());
+	for (int i = 0; i < surfaces.size(); ++i) {
+		output.surfaces.write[i] = surfaces[i];
+	}
+	output.surfaces_lods.resize(surfaces_lods.size());
+	for (int i = 0; i < surfaces_lods.size(); ++i) {
+		output.surfaces_lods.write[i] = surfaces_lods[i];
+	}
+	output.primitive_type = Mesh::PrimitiveType(int(d["primitive_type"]));
+	output.ordered_surfaces_mask = uint64_t(d["ordered_surfaces_mask"]);
+
+	const PackedByteArray atlas_data = d["atlas_data"];
+	if (atlas_data.size() > 0) {
+		output.atlas_image = Image::create_from_data(d["atlas_width"],
+				d["atlas_height"], false, Image::Format(int(d["atlas_format"])),
+				atlas_data);
+	}
+	return true;
+}
+
+void save_cached_output(String fpath, const MeshCacheKey &key,
+		const VoxelMesher::Output &output) {
+	Array surfaces;
+	for (int i = 0; i < output.surfaces.size(); ++i) {
+		surfaces.push_back(output.surfaces[i]);
+	}
+	Array surfaces_lods;
+	for (int i = 0; i < output.surfaces_lods.size(); ++i) {
+		surfaces_lods.push_back(output.surfaces_lods[i]);
+	}
+
+	Dictionary d;
+	d["surfaces"] = surfaces;
+	d["surfaces_lods"] = surfaces_lods;
+	d["primitive_type"] = int(output.primitive_type);
+	d["ordered_surfaces_mask"] = output.ordered_surfaces_mask;
+	if (output.atlas_image.is_valid()) {
+		d["atlas_width"] = output.atlas_image->get_width();
+		d["atlas_height"] = output.atlas_image->get_height();
+		d["atlas_format"] = int(output.atlas_image->get_format());
+		d["atlas_data"] = output.atlas_image->get_data();
+	}
+
+	// Written under another name first, so that other imports never see a
+	// partially written file. Names are unique per thread, since the same
+	// model can be meshed by several imports at once.
+	const String temp_path =
+			fpath + "." + String::num_uint64(Thread::get_caller_id(), 16) + ".tmp";
+	{
+		Ref<FileAccess> f = FileAccess::open(temp_path, FileAccess::WRITE);
+		ERR_FAIL_COND_MSG(f.is_null(), String("Could not write {0}").format(varray(temp_path)));
+		f->store_32(MESH_CACHE_VERSION);
+		key.store(**f);
+		f->store_var(d, false);
+		const Error err = f->get_error();
+		f->close();
+		if (err != OK) {
+			DirAccess::remove_absolute(temp_path);
+			ERR_FAIL_MSG(String("Could not write {0}").format(varray(temp_path)));
+		}
+	}
+	if (DirAccess::rename_absolute(temp_path, fpath) != OK) {
+		// Most likely another import stored the same entry at the same time
+		DirAccess::remove_absolute(temp_path);
+	}
+}
+
+// Removes the oldest entries until the cache fits in `max_size` bytes
+void trim_mesh_cache(String dir_path, uint64_t max_size) {
+	struct Entry {
+		String path;
+		uint64_t modified_time;
+		uint64_t size;
+	};
+	std::vector<Entry> entries;
+	uint64_t total_size = 0;
+
+	const PackedStringArray file_names = DirAccess::get_files_at(dir_path);
+	for (int i = 0; i < file_names.size(); ++i) {
+		const String &file_name = file_names[i];
+		if (!file_name.ends_with(".voxmesh")) {
+			// Temporary files are left to the import writing them
+			continue;
+		}
+		Entry entry;
+		entry.path = dir_path.path_join(file_name);
+		entry.modified_time = FileAccess::get_modified_time(entry.path);
+		Ref<FileAccess> f = FileAccess::open(entry.path, FileAccess::READ);
+		entry.size = f.is_valid() ? f->get_length() : 0;
+		total_size += entry.size;
+		entries.push_back(entry);
+	}
+
+	if (total_size <= max_size) {
+		return;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+		return a.modified_time < b.modified_time;
+	});
+	for (size_t i = 0; i < entries.size() && total_size > max_size; ++i) {
+		const Entry &entry = entries[i];
+		if (DirAccess::remove_absolute(entry.path) == OK) {
+			total_size -= entry.size;
+		}
+	}
+}
+
+// Meshes models independently. Only produces surface arrays, resources are
+// created afterwards on the calling thread.
+struct MeshModelsTask {
+	const vox::Data *data;
+	VoxelMesher *mesher;
+	// Models to mesh. Each of them has `lod_count` consecutive outputs and
+	// errors, one per level of detail.
+	const std::vector<unsigned int> *model_indices;
+	unsigned int lod_count;
+	std::vector<VoxelMesher::Output> *outputs;
+	std::vector<Error> *errors;
+	// Time spent on each output, filling voxels and meshing them
+	std::vector<uint64_t> *buffer_fill_times;
+	std::vector<uint64_t> *mesh_times;
+	// Set to 1 for outputs loaded from the cache
+	std::vector<uint8_t> *cache_hits;
+	// If not empty, outputs are looked up there first, keyed by model content
+	// and `settings_hash`, which covers the mesher settings and the palette
+	String cache_dir;
+	uint64_t settings_hash;
+
+	static void run(void *userdata, uint32_t i) {
+		MeshModelsTask &task = *static_cast<MeshModelsTask *>(userdata);
+		const unsigned int lod_index = i % task.lod_count;
+		const vox::Model *model_ptr =
+				&task.data->get_model((*task.model_indices)[i / task.lod_count]);
+
+		String cache_path;
+		MeshCacheKey cache_key;
+		if (!task.cache_dir.is_empty()) {
+			cache_key.model_size = model_ptr->size;
+			cache_key.content_hash = model_ptr->get_content_hash();
+			cache_key.settings_hash = task.settings_hash;
+			cache_key.lod_index = lod_index;
+			cache_path = task.cache_dir.path_join(
+					String::num_uint64(cache_key.get_hash(), 16).pad_zeros(16) + ".voxmesh");
+			if (load_cached_output(cache_path, cache_key, (*task.outputs)[i])) {
+				(*task.cache_hits)[i] = 1;
+				return;
+			}
+		}
+
+		ProfilingClock clock;
+
+		// Each LOD halves the resolution of the previous one
+		vox::Model lod_models[2];
+		for (unsigned int lod = 1; lod <= lod_index; ++lod) {
+			vox::Model &lod_model = lod_models[lod & 1];
+			model_ptr->downsample(lod_model);
+			model_ptr = &lod_model;
+		}
+		const vox::Model &model = *model_ptr;
+
+		Ref<VoxelBuffer> voxels;
+		voxels.instantiate();
+		voxels->create(model.size + VoxelVector3i(VoxelMesherCubes::PADDING * 2));
+		voxels->decompress_channel(VoxelBuffer::CHANNEL_COLOR);
+		Span<uint8_t> dst_color_indices;
+		if (!voxels->get_channel_raw(VoxelBuffer::CHANNEL_COLOR, dst_color_indices)) {
+			(*task.errors)[i] = ERR_BUG;
+			return;
+		}
+		// The model is sparse, voxels are written directly into the padded buffer
+		model.scatter_zxy(dst_color_indices, voxels->get_size(),
+				VoxelVector3i(VoxelMesherCubes::PADDING),
+				[](uint8_t color_index) { return color_index; });
+		(*task.buffer_fill_times)[i] = clock.restart();
+
+		VoxelMesher::Input input = { **voxels, 0 };
+		task.mesher->build_cached((*task.outputs)[i], input);
+		(*task.mesh_times)[i] = clock.restart();
+
+		if (!cache_path.is_empty()) {
+			save_cached_output(cache_path, cache_key, (*task.outputs)[i]);
+		}
+	}
+};
+
+// Lists models having different contents. Copies of the same model are
+// meshed only once.
+void find_unique_models(const vox::Data &data,
+		std::vector<unsigned int> &unique_model_indices,
+		std::vector<unsigned int> &model_to_unique) {
+	std::unordered_map<uint64_t, unsigned int> hash_to_unique;
+	model_to_unique.resize(data.get_model_count());
+
+	for (unsigned int model_index = 0; model_index < data.get_model_count();
+			++model_index) {
+		const vox::Model &model = data.get_model(model_index);
+		const uint64_t hash = model.get_content_hash();
+
+		auto it = hash_to_unique.find(hash);
+		if (it != hash_to_unique.end()) {
+			const unsigned int unique_index = it->second;
+			// Hashes can collide, in which case the model is just not shared
+			if (model.has_same_content(
+						data.get_model(unique_model_indices[unique_index]))) {
+				model_to_unique[model_index] = unique_index;
+				continue;
+			}
+		}
+
+		const unsigned int unique_index = unique_model_indices.size();
+		unique_model_indices.push_back(model_index);
+		model_to_unique[model_index] = unique_index;
+		hash_to_unique.insert(std::make_pair(hash, unique_index));
+	}
+}
+
+// Packs atlases of all outputs into one image, and updates their UVs to use it.
+// Returns a null image if it would be too big.
+Ref<Image> make_global_atlas(std::vector<VoxelMesher::Output> &outputs) {
+	static const int MAX_ATLAS_SIZE = 16384;
+
+	std::vector<unsigned int> output_indices;
+	Vector<Vector2i> sizes;
+	for (unsigned int i = 0; i < outputs.size(); ++i) {
+		const Ref<Image> &atlas = outputs[i].atlas_image;
+		if (atlas.is_valid()) {
+			output_indices.push_back(i);
+			sizes.push_back(Vector2i(atlas->get_width(), atlas->get_height()));
+		}
+	}
+	if (sizes.size() == 0) {
+		return Ref<Image>();
+	}
+
+	Vector<Vector2i> positions;
+	Vector2i atlas_size;
+	Geometry2D::make_atlas(sizes, positions, atlas_size);
+	if (atlas_size.x > MAX_ATLAS_SIZE || atlas_size.y > MAX_ATLAS_SIZE) {
+		WARN_PRINT("Global atlas would be too big, using one atlas per model. "
+				   "Merged scene mode will only merge copies of the same model.");
+		return Ref<Image>();
+	}
+
+	Vector<uint8_t> im_data;
+	im_data.resize(atlas_size.x * atlas_size.y * 4);
+	memset(im_data.ptrw(), 0, im_data.size());
+	Ref<Image> image = Image::create_from_data(atlas_size.x, atlas_size.y, false,
+			Image::FORMAT_RGBA8, im_data);
+
+	const Vector2 inv_atlas_size(1.f / float(atlas_size.x), 1.f / float(atlas_size.y));
+
+	for (unsigned int i = 0; i < output_indices.size(); ++i) {
+		VoxelMesher::Output &output = outputs[output_indices[i]];
+		Ref<Image> src = output.atlas_image;
+		if (src->get_format() != Image::FORMAT_RGBA8) {
+			src = src->duplicate();
+			src->convert(Image::FORMAT_RGBA8);
+		}
+		const Vector2 src_size(sizes[i]);
+		const Vector2 dst_pos(positions[i]);
+		image->blit_rect(src, Rect2i(Vector2i(), sizes[i]), positions[i]);
+
+		for (int surface_index = 0; surface_index < output.surfaces.size();
+				++surface_index) {
+			const Array &surface = output.surfaces[surface_index];
+			if (surface.is_empty()) {
+				continue;
+			}
+			PackedVector2Array uvs = surface[Mesh::ARRAY_TEX_UV];
+			Vector2 *uvs_w = uvs.ptrw();
+			for (int vi = 0; vi < uvs.size(); ++vi) {
+				uvs_w[vi] = (dst_pos + uvs_w[vi] * src_size) * inv_atlas_size;
+			}
+			// Surfaces can be shared with the mesh cache, so they are not modified
+			Array remapped_surface = surface.duplicate();
+			remapped_surface[Mesh::ARRAY_TEX_UV] = uvs;
+			output.surfaces.write[surface_index] = remapped_surface;
+		}
+		output.atlas_image = image;
+	}
+
+	return image;
+}
+
+// Surfaces of several instances sharing the same material, in scene space
+struct MergedSurface {
+	Ref<Material> material;
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
+	std::vector<Color> colors;
+	std::vector<int> indices;
+	// Simplified indices, as many levels as the most simplified source surface.
+	// Sources with fewer levels repeat their last one.
+	std::vector<std::vector<int>> lod_indices;
+	std::vector<float> lod_sizes;
+
+	static void append_indices(std::vector<int> &dst, const Vector<int> &src, int first_vertex,
+			bool flip) {
+		for (int i = 0; i + 2 < src.size(); i += 3) {
+			dst.push_back(first_vertex + src[i]);
+			if (flip) {
+				dst.push_back(first_vertex + src[i + 2]);
+				dst.push_back(first_vertex + src[i + 1]);
+			} else {
+				dst.push_back(first_vertex + src[i + 1]);
+				dst.push_back(first_vertex + src[i + 2]);
+			}
+		}
+	}
+
+	void append(const ImporterMesh &mesh, int surface_index, const Transform3D &transform) {
+		const Array surface = mesh.get_surface_arrays(surface_index);
+		const PackedVector3Array src_positions = surface[Mesh::ARRAY_VERTEX];
+		const PackedVector3Array src_normals = surface[Mesh::ARRAY_NORMAL];
+		const PackedVector2Array src_uvs = surface[Mesh::ARRAY_TEX_UV];
+		const PackedColorArray src_colors = surface[Mesh::ARRAY_COLOR];
+		const PackedInt32Array src_indices = surface[Mesh::ARRAY_INDEX];
+
+		const int first_vertex = positions.size();
+
+		for (int i = 0; i < src_positions.size(); ++i) {
+			positions.push_back(transform.xform(src_positions[i]));
+		}
+		for (int i = 0; i < src_normals.size(); ++i) {
+			normals.push_back(transform.basis.xform(src_normals[i]).normalized());
+		}
+		uvs.insert(uvs.end(), src_uvs.ptr(), src_uvs.ptr() + src_uvs.size());
+		colors.insert(colors.end(), src_colors.ptr(), src_colors.ptr() + src_colors.size());
+
+		// Surfaces merged before this one had fewer levels, so they repeat
+		// their last one
+		const int src_lod_count = mesh.get_surface_lod_count(surface_index);
+		while (lod_indices.size() < static_cast<size_t>(src_lod_count)) {
+			lod_indices.push_back(lod_indices.size() == 0 ? indices : lod_indices.back());
+			lod_sizes.push_back(0.f);
+		}
+
+		// MagicaVoxel rotations can be mirrors, which flip the winding of triangles
+		const bool flip = transform.basis.determinant() < 0;
+		append_indices(indices, src_indices, first_vertex, flip);
+
+		for (size_t lod_index = 0; lod_index < lod_indices.size(); ++lod_index) {
+			if (src_lod_count == 0) {
+				append_indices(lod_indices[lod_index], src_indices, first_vertex, flip);
+				continue;
+			}
+			const int src_lod_index = MIN(static_cast<int>(lod_index), src_lod_count - 1);
+			append_indices(lod_indices[lod_index],
+					mesh.get_surface_lod_indices(surface_index, src_lod_index), first_vertex, flip);
+			// Switching when the least simplified source would is conservative
+			lod_sizes[lod_index] = MAX(lod_sizes[lod_index],
+					mesh.get_surface_lod_size(surface_index, src_lod_index));
+		}
+	}
+
+	Dictionary get_lods() const {
+		Dictionary lods;
+		float prev_size = 0.f;
+		for (size_t i = 0; i < lod_indices.size(); ++i) {
+			// Sizes must increase, a level that doesn't is dropped
+			if (lod_sizes[i] <= prev_size) {
+				continue;
+			}
+			prev_size = lod_sizes[i];
+			Vector<int> dst_indices;
+			raw_copy_to(dst_indices, lod_indices[i]);
+			lods[lod_sizes[i]] = dst_indices;
+		}
+		return lods;
+	}
+
+	Array to_arrays() const {
+		Array arrays;
+		arrays.resize(Mesh::ARRAY_MAX);
+		Vector<Vector3> dst_positions;
+		Vector<int> dst_indices;
+		raw_copy_to(dst_positions, positions);
+		raw_copy_to(dst_indices, indices);
+		arrays[Mesh::ARRAY_VERTEX] = dst_positions;
+		arrays[Mesh::ARRAY_INDEX] = dst_indices;
+		// Optional arrays are only kept if all merged surfaces had them
+		if (normals.size() == positions.size()) {
+			Vector<Vector3> dst_normals;
+			raw_copy_to(dst_normals, normals);
+			arrays[Mesh::ARRAY_NORMAL] = dst_normals;
+		}
+		if (uvs.size() == positions.size()) {
+			Vector<Vector2> dst_uvs;
+			raw_copy_to(dst_uvs, uvs);
+			arrays[Mesh::ARRAY_TEX_UV] = dst_uvs;
+		}
+		if (colors.size() == positions.size()) {
+			Vector<Color> dst_colors;
+			raw_copy_to(dst_colors, colors);
+			arrays[Mesh::ARRAY_COLOR] = dst_colors;
+		}
+		return arrays;
+	}
+};
+
+struct MergedChunk {
+	// Surfaces for each voxel LOD
+	std::vector<std::vector<MergedSurface>> lods;
+
+	MergedSurface &get_or_create_surface(unsigned int lod_index, Ref<Material> material) {
+		if (lod_index >= lods.size()) {
+			lods.resize(lod_index + 1);
+		}
+		std::vector<MergedSurface> &surfaces = lods[lod_index];
+		for (size_t i = 0; i < surfaces.size(); ++i) {
+			if (surfaces[i].material == material) {
+				return surfaces[i];
+			}
+		}
+		surfaces.push_back(MergedSurface());
+		surfaces.back().material = material;
+		return surfaces.back();
+	}
+};
+
+// Chunk containing the center of a shape instance. Instances are grouped by
+// chunk so each group can still be culled and switch LOD by region.
+Vector3i get_instance_chunk_position(const vox::ShapeInstance &instance,
+		const vox::Model &model, const Vector3 pivot, float chunk_size) {
+	const Vector3 center = instance.transform.xform(model.size.to_vec3() * 0.5f - pivot);
+	return Vector3i(
+			static_cast<int>(Math::floor(center.x / chunk_size)),
+			static_cast<int>(Math::floor(center.y / chunk_size)),
+			static_cast<int>(Math::floor(center.z / chunk_size)));
+}
+
+void count_geometry(const VoxelMesher::Output &output,
+		uint64_t &vertex_count, uint64_t &triangle_count) {
+	for (int i = 0; i < output.surfaces.size(); ++i) {
+		const Array &surface = output.surfaces[i];
+		if (surface.is_empty()) {
+			continue;
+		}
+		const PackedVector3Array positions = surface[Mesh::ARRAY_VERTEX];
+		const PackedInt32Array indices = surface[Mesh::ARRAY_INDEX];
+		vertex_count += positions.size();
+		triangle_count += indices.size() / 3;
+	}
+}
+
+// Each LOD is visible twice as far as the previous one
+template <typename Instance_T>
+void set_lod_visibility_range(Instance_T &instance, unsigned int lod_index,
+		unsigned int lod_count, float lod_distance) {
+	if (lod_index > 0) {
+		instance.set_visibility_range_begin(lod_distance * (1 << (lod_index - 1)));
+	}
+	if (lod_index + 1 < lod_count) {
+		instance.set_visibility_range_end(lod_distance * (1 << lod_index));
+	}
+}
+
+String get_lod_node_name(unsigned int lod_index, const String &base_name) {
+	return lod_index == 0 ? base_name : String("LOD{0}").format(varray(lod_index));
+}
+
+bool has_vertex_colors(const VoxelMesher::Output &output) {
+	for (int i = 0; i < output.surfaces.size(); ++i) {
+		const Array &surface = output.surfaces[i];
+		if (!surface.is_empty() &&
+				surface[Mesh::ARRAY_COLOR].get_type() != Variant::NIL) {
+			return true;
+		}
+	}
+	return false;
+}
+} // namespace
+
+Ref<StandardMaterial3D> VoxelVoxImporter::create_material(Ref<Image> atlas,
+		bool vertex_colors) {
+	Ref<StandardMaterial3D> material;
+	material.instantiate();
+	material->set_roughness(1.f);
+	material->set_transparency(StandardMaterial3D::TRANSPARENCY_ALPHA);
+	Ref<ImageTexture> texture;
+	texture.instantiate();
+	texture->set_image(atlas);
+	material->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, texture);
+	material->set_texture_filter(BaseMaterial3D::TEXTURE_FILTER_NEAREST_WITH_MIPMAPS);
+	if (vertex_colors) {
+		// Vertex colors carry baked occlusion
+		material->set_flag(BaseMaterial3D::FLAG_ALBEDO_FROM_VERTEX_COLOR, true);
+	}
+	return material;
+}
+
 Ref<ImporterMesh>
-VoxelVoxImporter::build_mesh(VoxelBuffer &voxels, VoxelMesher &mesher,
-		Ref<Image> &out_atlas) {
+VoxelVoxImporter::build_mesh(const VoxelMesher::Output &output,
+		Ref<Material> material) {
 	//
-	VoxelMesher::Output output;
-	VoxelMesher::Input input = { voxels, 0 };
-	mesher.build(output, input);
-
 	if (output.surfaces.is_empty()) {
 		return Ref<ImporterMesh>();
 	}
@@ -127,41 +691,288 @@ VoxelVoxImporter::build_mesh(VoxelBuffer &voxels, VoxelMesher &mesher,
 			continue;
 		}
 
-		Ref<StandardMaterial3D> material;
-		material.instantiate();
-		material->set_roughness(1.f);
-		material->set_transparency(StandardMaterial3D::TRANSPARENCY_ALPHA);
-		if (output.atlas_image.is_valid()) {
-			out_atlas = output.atlas_image;
+		Dictionary lods;
+		if (i < output.surfaces_lods.size()) {
+			lods = output.surfaces_lods[i];
 		}
-		Ref<ImageTexture> texture;
-		texture.instantiate();
-		texture->set_image(out_atlas);
-		material->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, texture);
-		material->set_texture_filter(BaseMaterial3D::TEXTURE_FILTER_NEAREST_WITH_MIPMAPS);
-		mesh->add_surface(output.primitive_type, surface, Array(), Dictionary(), material);
+		mesh->add_surface(output.primitive_type, surface, Array(), lods, material);
 	}
 
 	return mesh;
 }
 
 void VoxelVoxImporter::add_mesh_instance(Ref<ImporterMesh> mesh, Node *parent, Node *owner,
-		Vector3 offset) {
+		const Transform3D &transform, unsigned int lod_index, unsigned int lod_count,
+		float lod_distance) {
 	ImporterMeshInstance3D *mesh_instance = memnew(ImporterMeshInstance3D);
 	mesh_instance->set_mesh(mesh);
-	mesh_instance->set_name(MeshInstance3D::get_class_static());
+	mesh_instance->set_name(get_lod_node_name(lod_index, MeshInstance3D::get_class_static()));
 	parent->add_child(mesh_instance, true);
 	mesh_instance->set_owner(owner);
-	mesh_instance->set_position(offset);
+	mesh_instance->set_transform(transform);
+	set_lod_visibility_range(*mesh_instance, lod_index, lod_count, lod_distance);
+}
+
+Transform3D VoxelVoxImporter::get_lod_transform(const VoxMesh &mesh_data,
+		unsigned int lod_index) {
+	// Lower LODs are meshed at a lower resolution, then scaled back up
+	const float lod_scale = 1 << lod_index;
+	return Transform3D(Basis().scaled(Vector3(lod_scale, lod_scale, lod_scale)), -mesh_data.pivot);
+}
+
+void VoxelVoxImporter::add_mesh_instances(const VoxMesh &mesh_data, Node *parent,
+		Node *owner, const Transform3D &transform) {
+	// One instance per LOD, switching with visibility ranges
+	const unsigned int lod_count = mesh_data.get_lod_count();
+	for (unsigned int lod_index = 0; lod_index < lod_count; ++lod_index) {
+		Ref<ImporterMesh> mesh = mesh_data.get_lod_mesh(lod_index);
+		if (mesh.is_null()) {
+			continue;
+		}
+		add_mesh_instance(mesh, parent, owner, transform * get_lod_transform(mesh_data, lod_index),
+				lod_index, lod_count, mesh_data.lod_distance);
+	}
+}
+
+void VoxelVoxImporter::add_merged_mesh_instances(const vox::Data &data,
+		const Vector<VoxMesh> &meshes, Node3D *root_node, float chunk_size) {
+	std::vector<vox::ShapeInstance> instances;
+	const Error err = data.get_shape_instances(instances);
+	ERR_FAIL_COND(err != OK);
+
+	HashMap<Vector3i, unsigned int> chunk_indices;
+	std::vector<MergedChunk> chunks;
+	// All models have the same LOD settings
+	float lod_distance = 0.f;
+
+	for (size_t i = 0; i < instances.size(); ++i) {
+		const vox::ShapeInstance &instance = instances[i];
+		const VoxMesh &mesh_data = meshes[instance.model_id];
+		if (mesh_data.mesh.is_null()) {
+			continue;
+		}
+		const Vector3i chunk_pos = get_instance_chunk_position(instance,
+				data.get_model(instance.model_id), mesh_data.pivot, chunk_size);
+
+		unsigned int chunk_index;
+		HashMap<Vector3i, unsigned int>::Iterator chunk_it = chunk_indices.find(chunk_pos);
+		if (chunk_it == chunk_indices.end()) {
+			chunk_index = chunks.size();
+			chunks.push_back(MergedChunk());
+			chunk_indices.insert(chunk_pos, chunk_index);
+		} else {
+			chunk_index = chunk_it->value;
+		}
+		MergedChunk &chunk = chunks[chunk_index];
+		lod_distance = mesh_data.lod_distance;
+
+		const unsigned int lod_count = mesh_data.get_lod_count();
+		for (unsigned int lod_index = 0; lod_index < lod_count; ++lod_index) {
+			Ref<ImporterMesh> mesh = mesh_data.get_lod_mesh(lod_index);
+			if (mesh.is_null()) {
+				continue;
+			}
+			const Transform3D lod_transform =
+					instance.transform * get_lod_transform(mesh_data, lod_index);
+			for (int surface_index = 0; surface_index < mesh->get_surface_count();
+					++surface_index) {
+				MergedSurface &merged_surface = chunk.get_or_create_surface(
+						lod_index, mesh->get_surface_material(surface_index));
+				merged_surface.append(**mesh, surface_index, lod_transform);
+			}
+		}
+	}
+
+	for (size_t chunk_index = 0; chunk_index < chunks.size(); ++chunk_index) {
+		const MergedChunk &chunk = chunks[chunk_index];
+		// One instance per voxel LOD, switching with visibility ranges like
+		// `add_mesh_instances`
+		for (size_t lod_index = 0; lod_index < chunk.lods.size(); ++lod_index) {
+			const std::vector<MergedSurface> &surfaces = chunk.lods[lod_index];
+			if (surfaces.size() == 0) {
+				continue;
+			}
+			Ref<ImporterMesh> mesh;
+			mesh.instantiate();
+			for (size_t i = 0; i < surfaces.size(); ++i) {
+				const MergedSurface &surface = surfaces[i];
+				mesh->add_surface(Mesh::PRIMITIVE_TRIANGLES, surface.to_arrays(), Array(),
+						surface.get_lods(), surface.material);
+			}
+			add_mesh_instance(mesh, root_node, root_node, Transform3D(), lod_index,
+					chunk.lods.size(), lod_distance);
+		}
+	}
+}
+
+void VoxelVoxImporter::add_instanced_mesh_instances(const vox::Data &data,
+		const Vector<VoxMesh> &meshes, Node3D *root_node, float chunk_size,
+		unsigned int min_instances) {
+	std::vector<vox::ShapeInstance> instances;
+	const Error err = data.get_shape_instances(instances);
+	ERR_FAIL_COND(err != OK);
+
+	// Shapes are grouped by mesh rather than model ID, so copies of the same
+	// model are instanced together too. Groups are split in chunks, because
+	// visibility ranges apply to a whole MultiMeshInstance3D, so instances
+	// switch LOD by region instead of all at once.
+	std::map<std::pair<Vector3i, const ImporterMesh *>, unsigned int> group_indices;
+	std::vector<std::vector<Transform3D>> groups;
+	std::vector<const VoxMesh *> group_meshes;
+
+	for (size_t i = 0; i < instances.size(); ++i) {
+		const vox::ShapeInstance &instance = instances[i];
+		const VoxMesh &mesh_data = meshes[instance.model_id];
+		if (mesh_data.mesh.is_null()) {
+			continue;
+		}
+
+		const Vector3i chunk_pos = get_instance_chunk_position(instance,
+				data.get_model(instance.model_id), mesh_data.pivot, chunk_size);
+		const std::pair<Vector3i, const ImporterMesh *> key(chunk_pos, mesh_data.mesh.ptr());
+
+		auto group_it = group_indices.find(key);
+		if (group_it == group_indices.end()) {
+			group_indices.insert(std::make_pair(key, groups.size()));
+			groups.push_back(std::vector<Transform3D>());
+			group_meshes.push_back(&mesh_data);
+			groups.back().push_back(instance.transform);
+		} else {
+			groups[group_it->second].push_back(instance.transform);
+		}
+	}
+
+	std::vector<Transform3D> lod_transforms;
+
+	for (size_t group_index = 0; group_index < groups.size(); ++group_index) {
+		const std::vector<Transform3D> &transforms = groups[group_index];
+		const VoxMesh &mesh_data = *group_meshes[group_index];
+
+		if (transforms.size() < min_instances) {
+			for (size_t i = 0; i < transforms.size(); ++i) {
+				add_mesh_instances(mesh_data, root_node, root_node, transforms[i]);
+			}
+			continue;
+		}
+
+		// One MultiMesh per LOD, switching with visibility ranges like
+		// `add_mesh_instances`
+		const unsigned int lod_count = mesh_data.get_lod_count();
+		for (unsigned int lod_index = 0; lod_index < lod_count; ++lod_index) {
+			Ref<ImporterMesh> mesh = mesh_data.get_lod_mesh(lod_index);
+			if (mesh.is_null()) {
+				continue;
+			}
+
+			const Transform3D lod_transform = get_lod_transform(mesh_data, lod_index);
+			lod_transforms.resize(transforms.size());
+			for (size_t i = 0; i < transforms.size(); ++i) {
+				lod_transforms[i] = transforms[i] * lod_transform;
+			}
+
+			Ref<MultiMesh> multimesh;
+			multimesh.instantiate();
+			multimesh->set_transform_format(MultiMesh::TRANSFORM_3D);
+			// MultiMesh needs a final mesh, it won't go through the importer like
+			// ImporterMeshInstance3D does
+			multimesh->set_mesh(mesh->get_mesh());
+			multimesh->set_instance_count(lod_transforms.size());
+			multimesh->set_buffer(DirectMultiMeshInstance::make_transform_3d_bulk_array(
+					Span<const Transform3D>(lod_transforms.data(), lod_transforms.size())));
+
+			MultiMeshInstance3D *multimesh_instance = memnew(MultiMeshInstance3D);
+			multimesh_instance->set_multimesh(multimesh);
+			multimesh_instance->set_name(
+					get_lod_node_name(lod_index, MultiMeshInstance3D::get_class_static()));
+			root_node->add_child(multimesh_instance, true);
+			multimesh_instance->set_owner(root_node);
+			set_lod_visibility_range(*multimesh_instance, lod_index, lod_count, mesh_data.lod_distance);
+		}
+	}
+}
+
+void VoxelVoxImporter::get_import_options(const String &p_path, List<ResourceImporter::ImportOption> *r_options) {
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::BOOL, "vox/optimize_meshes"), true));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::INT, "vox/simplification_lod_count", PROPERTY_HINT_RANGE, "0,8,1"), 0));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::FLOAT, "vox/simplification_error", PROPERTY_HINT_RANGE, "0,1,0.001"), 0.01f));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::BOOL, "vox/global_atlas"), false));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::INT, "vox/voxel_lod_count", PROPERTY_HINT_RANGE, "0,4,1"), 0));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::FLOAT, "vox/voxel_lod_distance", PROPERTY_HINT_RANGE, "1,1000,0.1,or_greater"), 64.f));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::INT, "vox/scene_mode", PROPERTY_HINT_ENUM, "Nodes,Merged,Instanced"), SCENE_MODE_NODES));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::FLOAT, "vox/merge_chunk_size", PROPERTY_HINT_RANGE, "1,1000,0.1,or_greater"), 64.f));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::INT, "vox/multimesh_min_instances", PROPERTY_HINT_RANGE, "2,1000,1,or_greater"), 2));
+	r_options->push_back(ResourceImporter::ImportOption(
+			PropertyInfo(Variant::BOOL, "vox/use_mesh_cache"), false));
 }
 
 Node *VoxelVoxImporter::import_scene(const String &p_path, uint32_t p_flags, const HashMap<StringName, Variant> &p_options, List<String> *r_missing_deps, Error *r_err) {
+	return import_vox_scene(p_path, p_options, r_err, nullptr);
+}
+
+Dictionary VoxelVoxImporter::benchmark_import(String p_path, Dictionary p_options) {
+	HashMap<StringName, Variant> options;
+	const Array keys = p_options.keys();
+	for (int i = 0; i < keys.size(); ++i) {
+		options.insert(keys[i], p_options[keys[i]]);
+	}
+
+	// Memory tracked by the engine, which is process-wide and only counted in
+	// debug builds. Editor builds are, and this class only exists in them.
+	const uint64_t static_memory_before = Memory::get_mem_usage();
+	const uint64_t static_memory_peak_before = Memory::get_mem_max_usage();
+
+	ImportStats stats;
+	Error err = OK;
+	Node *root_node = import_vox_scene(p_path, options, &err, &stats);
+	if (root_node != nullptr) {
+		memdelete(root_node);
+	}
+
+	Dictionary d;
+	d["path"] = p_path;
+	d["error"] = int(err);
+	d["parse_usec"] = stats.parse_usec;
+	d["buffer_fill_usec"] = stats.buffer_fill_usec;
+	d["mesh_usec"] = stats.mesh_usec;
+	d["mesh_wall_usec"] = stats.mesh_wall_usec;
+	d["atlas_usec"] = stats.atlas_usec;
+	d["scene_usec"] = stats.scene_usec;
+	d["model_count"] = stats.model_count;
+	d["unique_model_count"] = stats.unique_model_count;
+	d["cached_mesh_count"] = stats.cached_mesh_count;
+	d["vertex_count"] = stats.vertex_count;
+	d["triangle_count"] = stats.triangle_count;
+	d["static_memory_before"] = static_memory_before;
+	d["static_memory_after"] = Memory::get_mem_usage();
+	// Zero if the import stayed below a previous peak of the process
+	d["peak_memory_growth"] = Memory::get_mem_max_usage() - static_memory_peak_before;
+	return d;
+}
+
+Node *VoxelVoxImporter::import_vox_scene(const String &p_path,
+		const HashMap<StringName, Variant> &p_options, Error *r_err,
+		ImportStats *r_stats) {
+	ImportStats stats;
+	ProfilingClock clock;
+
 	vox::Data data;
 	const Error load_err = data.load_from_file(p_path);
-	if (load_err != OK && r_err) {
-		*r_err = load_err;
+	if (load_err != OK) {
+		if (r_err) {
+			*r_err = load_err;
+		}
 		return nullptr;
 	}
+	stats.parse_usec = clock.restart();
 
 	Vector<VoxMesh> meshes;
 	meshes.resize(data.get_model_count());
@@ -179,50 +990,216 @@ Node *VoxelVoxImporter::import_scene(const String &p_path, uint32_t p_flags, con
 	mesher->set_palette(palette);
 	mesher->set_greedy_meshing_enabled(true);
 	mesher->set_store_colors_in_texture(true);
+	if (p_options.has("vox/optimize_meshes")) {
+		mesher->set_mesh_optimization_enabled(p_options["vox/optimize_meshes"]);
+	}
+	if (p_options.has("vox/simplification_lod_count")) {
+		// The scene importer replaces LODs of meshes when its own LOD generation
+		// is on, which is the default, so simplifying would be wasted
+		const bool engine_generates_lods =
+				p_options.has("meshes/generate_lods") && bool(p_options["meshes/generate_lods"]);
+		const int simplification_lod_count = p_options["vox/simplification_lod_count"];
+		if (simplification_lod_count > 0 && engine_generates_lods) {
+			WARN_PRINT("vox/simplification_lod_count is ignored because meshes/generate_lods is on, "
+					   "turn it off to keep simplified LODs");
+		} else {
+			mesher->set_simplification_lod_count(simplification_lod_count);
+		}
+	}
+	if (p_options.has("vox/simplification_error")) {
+		mesher->set_simplification_error(p_options["vox/simplification_error"]);
+	}
 
-	for (unsigned int model_index = 0; model_index < data.get_model_count();
-			++model_index) {
-		const vox::Model &model = data.get_model(model_index);
-		Ref<VoxelBuffer> voxels;
-		voxels.instantiate();
-		voxels->create(model.size + VoxelVector3i(VoxelMesherCubes::PADDING * 2));
-		voxels->decompress_channel(VoxelBuffer::CHANNEL_COLOR);
-		Span<uint8_t> dst_color_indices;
-		if (!voxels->get_channel_raw(VoxelBuffer::CHANNEL_COLOR, dst_color_indices)) {
+	std::vector<unsigned int> unique_model_indices;
+	std::vector<unsigned int> model_to_unique;
+	find_unique_models(data, unique_model_indices, model_to_unique);
+
+	// Level 0 is the model itself, others are meshed from downsampled voxels
+	unsigned int lod_count = 1;
+	if (p_options.has("vox/voxel_lod_count")) {
+		lod_count += CLAMP(int(p_options["vox/voxel_lod_count"]), 0, 4);
+	}
+	float lod_distance = 64.f;
+	if (p_options.has("vox/voxel_lod_distance")) {
+		lod_distance = p_options["vox/voxel_lod_distance"];
+	}
+
+	const unsigned int unique_count = unique_model_indices.size();
+	const unsigned int output_count = unique_count * lod_count;
+	std::vector<VoxelMesher::Output> outputs;
+	outputs.resize(output_count);
+	std::vector<Error> errors;
+	errors.resize(output_count, OK);
+	std::vector<uint64_t> buffer_fill_times;
+	buffer_fill_times.resize(output_count, 0);
+	std::vector<uint64_t> mesh_times;
+	mesh_times.resize(output_count, 0);
+	std::vector<uint8_t> cache_hits;
+	cache_hits.resize(output_count, 0);
+
+	MeshModelsTask task;
+	task.data = &data;
+	task.mesher = *mesher;
+	task.model_indices = &unique_model_indices;
+	task.lod_count = lod_count;
+	task.outputs = &outputs;
+	task.errors = &errors;
+	task.buffer_fill_times = &buffer_fill_times;
+	task.mesh_times = &mesh_times;
+	task.cache_hits = &cache_hits;
+	task.settings_hash = 0;
+
+	// Models that didn't change since the last import, or that are shared with
+	// other files, don't need meshing again
+	if (p_options.has("vox/use_mesh_cache") && bool(p_options["vox/use_mesh_cache"])) {
+		// Everything affecting mesher outputs besides voxels, including the palette
+		task.settings_hash = mesher->get_output_settings_hash();
+		if (task.settings_hash != 0) {
+			task.cache_dir = ProjectSettings::get_singleton()->get_imported_files_path().path_join("vox_mesh_cache");
+			if (DirAccess::make_dir_recursive_absolute(task.cache_dir) != OK) {
+				WARN_PRINT(String("Could not create {0}, mesh cache disabled").format(varray(task.cache_dir)));
+				task.cache_dir = String();
+			}
+		}
+	}
+
+	// Models are independent, and the mesher can be used from several threads
+	clock.restart();
+	WorkerThreadPool *thread_pool = WorkerThreadPool::get_singleton();
+	if (thread_pool != nullptr && output_count > 1) {
+		const WorkerThreadPool::GroupID group_id = thread_pool->add_native_group_task(
+				&MeshModelsTask::run, &task, output_count, -1, true,
+				"Mesh vox models");
+		thread_pool->wait_for_group_task_completion(group_id);
+	} else {
+		for (uint32_t i = 0; i < output_count; ++i) {
+			MeshModelsTask::run(&task, i);
+		}
+	}
+	stats.mesh_wall_usec = clock.restart();
+
+	if (!task.cache_dir.is_empty()) {
+		trim_mesh_cache(task.cache_dir, MESH_CACHE_MAX_SIZE);
+		// Not part of meshing
+		clock.restart();
+	}
+
+	for (unsigned int i = 0; i < output_count; ++i) {
+		if (errors[i] != OK) {
 			if (r_err) {
-				*r_err = ERR_BUG;
+				*r_err = errors[i];
 			}
 			return nullptr;
 		}
-		Span<const uint8_t> src_color_indices = to_span_const(model.color_indexes);
-		copy_3d_region_zxy(dst_color_indices, voxels->get_size(),
-				VoxelVector3i(VoxelMesherCubes::PADDING),
-				src_color_indices, model.size, VoxelVector3i(),
-				model.size);
-		Ref<Image> atlas;
-		Ref<ImporterMesh> mesh = build_mesh(**voxels, **mesher, atlas);
+		stats.buffer_fill_usec += buffer_fill_times[i];
+		stats.mesh_usec += mesh_times[i];
+		stats.cached_mesh_count += cache_hits[i];
+		count_geometry(outputs[i], stats.vertex_count, stats.triangle_count);
+	}
+	stats.model_count = data.get_model_count();
+	stats.unique_model_count = unique_count;
+
+	SceneMode scene_mode = SCENE_MODE_NODES;
+	if (p_options.has("vox/scene_mode")) {
+		scene_mode = SceneMode(CLAMP(int(p_options["vox/scene_mode"]), 0, SCENE_MODE_COUNT - 1));
+	}
+
+	// All models can use the same material if their atlases are merged. Merged
+	// scene mode always does it, because only surfaces with the same material
+	// can be merged.
+	bool use_global_atlas = scene_mode == SCENE_MODE_MERGED;
+	if (p_options.has("vox/global_atlas")) {
+		use_global_atlas |= bool(p_options["vox/global_atlas"]);
+	}
+	Ref<Material> global_material;
+	if (use_global_atlas) {
+		Ref<Image> global_atlas = make_global_atlas(outputs);
+		if (global_atlas.is_valid()) {
+			bool vertex_colors = false;
+			for (unsigned int i = 0; i < output_count; ++i) {
+				vertex_colors |= has_vertex_colors(outputs[i]);
+			}
+			global_material = create_material(global_atlas, vertex_colors);
+		}
+	}
+
+	std::vector<Ref<ImporterMesh>> unique_meshes;
+	unique_meshes.resize(output_count);
+
+	for (unsigned int i = 0; i < output_count; ++i) {
+		const VoxelMesher::Output &output = outputs[i];
+		// One material per atlas, shared by all surfaces
+		Ref<Material> material = global_material;
+		if (material.is_null() && !output.surfaces.is_empty()) {
+			material = create_material(output.atlas_image, has_vertex_colors(output));
+		}
+		unique_meshes[i] = build_mesh(output, material);
+		// Arrays are no longer needed once in the mesh
+		outputs[i] = VoxelMesher::Output();
+	}
+	stats.atlas_usec = clock.restart();
+
+	for (unsigned int model_index = 0; model_index < data.get_model_count();
+			++model_index) {
+		const unsigned int first_output_index = model_to_unique[model_index] * lod_count;
+		Ref<ImporterMesh> mesh = unique_meshes[first_output_index];
 
 		if (mesh.is_null()) {
 			continue;
 		}
 
+		const vox::Model &model = data.get_model(model_index);
+		const VoxelVector3i padded_size =
+				model.size + VoxelVector3i(VoxelMesherCubes::PADDING * 2);
+
 		VoxMesh mesh_info;
 		mesh_info.mesh = mesh;
+		for (unsigned int lod_index = 1; lod_index < lod_count; ++lod_index) {
+			mesh_info.lod_meshes.push_back(unique_meshes[first_output_index + lod_index]);
+		}
+		mesh_info.lod_distance = lod_distance;
 		// In MagicaVoxel scene graph, pivots are at the center of models, not at
 		// the lower corner.
-		mesh_info.pivot = (voxels->get_size() / VoxelVector3i(2, 2, 2) - VoxelVector3i(1)).to_vec3();
+		mesh_info.pivot = (padded_size / VoxelVector3i(2, 2, 2) - VoxelVector3i(1)).to_vec3();
 		meshes.write[model_index] = mesh_info;
 	}
 
+	// Merged and instanced shapes are grouped by regions of that size
+	float chunk_size = 64.f;
+	if (p_options.has("vox/merge_chunk_size")) {
+		chunk_size = MAX(float(p_options["vox/merge_chunk_size"]), 1.f);
+	}
+
 	Node3D *root_node = memnew(Node3D);
-	if (data.get_root_node_id() != -1) {
+	if (data.get_root_node_id() != -1 && scene_mode == SCENE_MODE_MERGED) {
+		// Transforms are baked into a few big meshes
+		add_merged_mesh_instances(data, meshes, root_node, chunk_size);
+	} else if (data.get_root_node_id() != -1 && scene_mode == SCENE_MODE_INSTANCED) {
+		// Repeated shapes become MultiMesh instances
+		unsigned int min_instances = 2;
+		if (p_options.has("vox/multimesh_min_instances")) {
+			min_instances = MAX(int(p_options["vox/multimesh_min_instances"]), 2);
+		}
+		add_instanced_mesh_instances(data, meshes, root_node, chunk_size, min_instances);
+	} else if (data.get_root_node_id() != -1) {
 		// Convert scene graph into a node tree
 		process_scene_node_recursively(data, data.get_root_node_id(), root_node,
 				root_node, 0, meshes);
 	} else if (meshes.size() > 0) {
 		// Some vox files don't have a scene graph
-		const VoxMesh &mesh0 = meshes[0];
-		add_mesh_instance(mesh0.mesh, root_node, root_node, Vector3());
+		VoxMesh mesh0 = meshes[0];
+		mesh0.pivot = Vector3();
+		add_mesh_instances(mesh0, root_node, root_node);
+	}
+	stats.scene_usec = clock.restart();
+
+	if (r_stats != nullptr) {
+		*r_stats = stats;
 	}
 	return root_node;
 }
+
+void VoxelVoxImporter::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("benchmark_import", "path", "options"),
+			&VoxelVoxImporter::benchmark_import);
+}
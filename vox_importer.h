@@ -34,18 +34,43 @@
 #include "editor/import/3d/resource_importer_scene.h"
 #include "scene/3d/importer_mesh_instance_3d.h"
 #include "scene/resources/importer_mesh.h"
+#include "scene/resources/material.h"
 #include <editor/import/editor_import_plugin.h>
 
+#include "meshers/voxel_mesher.h"
 #include "streams/vox_data.h"
 
-class VoxelBuffer;
-class VoxelMesher;
 class VoxelVoxImporter : public EditorSceneFormatImporter {
 	GDCLASS(VoxelVoxImporter, EditorSceneFormatImporter);
 
+	enum SceneMode {
+		// One node per shape of the scene graph
+		SCENE_MODE_NODES = 0,
+		// Shapes are merged by material, in spatial chunks. Models share a global
+		// atlas, so they all have the same material.
+		SCENE_MODE_MERGED,
+		// Shapes sharing the same mesh are drawn with a MultiMesh, in spatial chunks
+		SCENE_MODE_INSTANCED,
+		SCENE_MODE_COUNT
+	};
+
 	struct VoxMesh {
 		Ref<ImporterMesh> mesh;
+		// Meshes of downsampled voxels, starting from LOD 1. Can contain nulls.
+		Vector<Ref<ImporterMesh>> lod_meshes;
+		// Distance from which LOD 1 is used instead of the full mesh
+		float lod_distance = 0.f;
 		Vector3 pivot;
+
+		unsigned int get_lod_count() const {
+			return lod_meshes.size() + 1;
+		}
+
+		// Returns null if the LOD has no geometry. Downsampling can leave nothing
+		// when the model is thin.
+		Ref<ImporterMesh> get_lod_mesh(unsigned int lod_index) const {
+			return lod_index == 0 ? mesh : lod_meshes[lod_index - 1];
+		}
 	};
 
 	static Error process_scene_node_recursively(const vox::Data &data, int node_id,
@@ -53,12 +78,56 @@ class VoxelVoxImporter : public EditorSceneFormatImporter {
 			Node3D *&root_node, int depth,
 			const Vector<VoxMesh> &meshes);
 	static void add_mesh_instance(Ref<ImporterMesh> mesh, Node *parent, Node *owner,
-			Vector3 offset);
+			const Transform3D &transform, unsigned int lod_index, unsigned int lod_count,
+			float lod_distance);
+	// Transform of the lower-resolution mesh of a LOD, relative to the model
+	static Transform3D get_lod_transform(const VoxMesh &mesh_data,
+			unsigned int lod_index);
+	static void add_mesh_instances(const VoxMesh &mesh_data, Node *parent,
+			Node *owner, const Transform3D &transform = Transform3D());
+	static void add_merged_mesh_instances(const vox::Data &data,
+			const Vector<VoxMesh> &meshes, Node3D *root_node, float chunk_size);
+	static void add_instanced_mesh_instances(const vox::Data &data,
+			const Vector<VoxMesh> &meshes, Node3D *root_node, float chunk_size,
+			unsigned int min_instances);
+	static Ref<StandardMaterial3D> create_material(Ref<Image> atlas,
+			bool vertex_colors);
 	static Ref<ImporterMesh>
-	build_mesh(VoxelBuffer &voxels, VoxelMesher &mesher,
-			Ref<Image> &out_atlas);
+	build_mesh(const VoxelMesher::Output &output, Ref<Material> material);
+
+protected:
+	static void _bind_methods();
 
 public:
+	// Measured while importing a file. Times are in microseconds. Filling and
+	// meshing run on several threads, so their times are summed over all of
+	// them and can be larger than the wall time.
+	struct ImportStats {
+		uint64_t parse_usec = 0;
+		uint64_t buffer_fill_usec = 0;
+		uint64_t mesh_usec = 0;
+		uint64_t mesh_wall_usec = 0;
+		// Atlases, materials and mesh resources
+		uint64_t atlas_usec = 0;
+		uint64_t scene_usec = 0;
+		uint32_t model_count = 0;
+		uint32_t unique_model_count = 0;
+		// Meshes loaded from the mesh cache instead of being built
+		uint32_t cached_mesh_count = 0;
+		// Of all meshes built, including voxel LODs
+		uint64_t vertex_count = 0;
+		uint64_t triangle_count = 0;
+	};
+
+	// Same as `import_scene`, usable without the editor
+	static Node *import_vox_scene(const String &p_path,
+			const HashMap<StringName, Variant> &p_options, Error *r_err,
+			ImportStats *r_stats);
+
+	// Imports a file and discards the result, returning `ImportStats` and
+	// static memory usage as a dictionary
+	Dictionary benchmark_import(String p_path, Dictionary p_options);
+
 	virtual uint32_t get_import_flags() const override {
 		return EditorSceneFormatImporter::IMPORT_SCENE;
 	}
@@ -66,6 +135,7 @@ public:
 		ERR_FAIL_NULL(r_extensions);
 		r_extensions->push_back("vox");
 	}
+	virtual void get_import_options(const String &p_path, List<ResourceImporter::ImportOption> *r_options) override;
 	virtual Node *import_scene(const String &p_path, uint32_t p_flags, const HashMap<StringName, Variant> &p_options, List<String> *r_missing_deps, Error *r_err) override;
 	VoxelVoxImporter() {}
 };